@@ -12,10 +12,18 @@
  *             path length. Displays the best result found, including all
  *             visualizations.
  *
+ *   db     -- Inspect and combine persistent result databases written by
+ *             search --db (stats, merge, top).
+ *
+ *   merge  -- Combine the result files of a search split with --shard i/N
+ *             and report the merged counters, histogram and best maze.
+ *
  * Usage:
  *   repeated-maze solve <maze_string>
  *   repeated-maze search <nterm> --max-aport <N>
  *   repeated-maze norm <nterm> <maze_string>
+ *   repeated-maze db stats|merge|top ...
+ *   repeated-maze merge [-o <out>] <shard_file>...
  *   repeated-maze --version | -v
  */
 #include <stdio.h>
@@ -34,10 +42,25 @@ static void usage(void) {
     fprintf(stderr,
         "Usage:\n"
         "  repeated-maze solve <maze_string> [--bfs] [--directed] [-v]\n"
-        "  repeated-maze search <nterm> --max-aport <N> [--min-aport <N>] [--max-len <N>] [--random <seed>] [--bfs] [--directed] [-v]\n"
-        "  repeated-maze search <nterm> --topdown [--max-len <N>] [--bfs] [--directed] [-v]\n"
+        "  repeated-maze search <nterm> --max-aport <N> [--min-aport <N>] [--max-len <N>] [--random <seed> [--threads <N> | --pipeline <G:F:S>] [--constructive] [--dedupe-mem <MB>]] [--bfs] [--directed] [-v]\n"
+        "  repeated-maze search <nterm> --topdown [--max-len <N>] [--lossy-seen] [--spill-dir <dir> [--spill-mem <MB>]]\n"
+        "      [--checkpoint <file> [--checkpoint-interval <sec>]] [--beam <W> [--diversity <D>]] [--threads <N>] [--bfs] [--directed] [-v]\n"
+        "  repeated-maze search <nterm> --anneal [--max-aport <N>] [--max-len <N>] [--random <seed>] [--steps <N>] [--restarts <N>]\n"
+        "                       [--t-start <T>] [--t-end <T>] [--moves flip,swap,endpoint] [--seed-maze <file>] [--bfs] [--directed] [-v]\n"
+        "  repeated-maze search <nterm> --genetic [--max-aport <N>] [--max-len <N>] [--random <seed>] [--pop <N>] [--generations <N>]\n"
+        "                       [--tournament <N>] [--elite <N>] [--mutation <P>] [--threads <N>] [--bfs] [--directed] [-v]\n"
+        "  repeated-maze search <nterm> --bottomup --beam <W> [--max-aport <N>] [--max-len <N>] [--threads <N>] [--bfs] [--directed] [-v]\n"
+        "  repeated-maze search <nterm> --mcts --max-aport <N> [--max-len <N>] [--random <seed>] [--iterations <N>] [--uct-c <C>] [--bfs] [--directed] [-v]\n"
         "  repeated-maze norm <nterm> <maze_string>\n"
-        "\nDefault is undirected graph (A->B also sets B->A). Use --directed for directed graph.\n");
+        "  repeated-maze db stats <file>\n"
+        "  repeated-maze db merge <out> <in>...\n"
+        "  repeated-maze db top <file> [<N>]\n"
+        "  repeated-maze merge [-o <out>] <shard_file>...\n"
+        "\nDefault is undirected graph (A->B also sets B->A). Use --directed for directed graph.\n"
+        "All search modes except --topdown accept --len-cache <MB> to memoize lengths by reachable core.\n"
+        "All search modes accept --db <file> to reuse and record solved mazes across runs.\n"
+        "Exhaustive and --random search accept --shard <i>/<N> [--shard-out <file>] to run slice i of N\n"
+        "and write a result file (default shard-<i>-of-<N>.txt) for merge.\n");
     exit(1);
 }
 
@@ -95,6 +118,47 @@ static int cmd_solve(int argc, char **argv) {
     return 0;
 }
 
+/*
+ * read_maze_file -- read a maze string from a file for --seed-maze.
+ * Returns a malloc'd string with trailing whitespace removed, or NULL.
+ */
+static char *read_maze_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return NULL;
+    size_t cap = 256, len = 0;
+    char *buf = malloc(cap);
+    int c;
+    while ((c = fgetc(fp)) != EOF) {
+        if (len + 1 >= cap) buf = realloc(buf, cap *= 2);
+        buf[len++] = (char)c;
+    }
+    fclose(fp);
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r' ||
+                       buf[len - 1] == ' ' || buf[len - 1] == '\t'))
+        len--;
+    buf[len] = '\0';
+    return buf;
+}
+
+/*
+ * parse_moves -- parse a comma-separated move list into QM_MOVE_* bits.
+ * Returns 0 if any name is unknown.
+ */
+static int parse_moves(const char *str) {
+    int moves = 0;
+    const char *p = str;
+    while (*p) {
+        size_t n = strcspn(p, ",");
+        if (n == 4 && strncmp(p, "flip", 4) == 0) moves |= QM_MOVE_FLIP;
+        else if (n == 4 && strncmp(p, "swap", 4) == 0) moves |= QM_MOVE_SWAP;
+        else if (n == 8 && strncmp(p, "endpoint", 8) == 0) moves |= QM_MOVE_ENDPOINT;
+        else return 0;
+        p += n;
+        if (*p == ',') p++;
+    }
+    return moves;
+}
+
 /*
  * cmd_search -- handle the "search" subcommand.
  *
@@ -108,15 +172,33 @@ static int cmd_search(int argc, char **argv) {
         fprintf(stderr, "nterm must be >= 2\n");
         return 1;
     }
+    if (nterm > MAZE_MAX_NTERM) {
+        fprintf(stderr, "nterm must be <= %d\n", MAZE_MAX_NTERM);
+        return 1;
+    }
 
     int min_aport = 0;
     int max_aport = -1;
     int max_len = 0;
     int random_seed = -1;
     int topdown = 0;
+    QMTopdownOptions topts = {0};
+    int anneal = 0;
+    int genetic = 0;
+    int mcts = 0;
+    int bottomup = 0;
+    int beam = 0;
+    int len_cache_mb = 0;
+    const char *db_path = NULL;
+    QMMctsOptions mopts = {0, 0.7};
+    QMGeneticOptions gopts = {64, 0, 3, 2, 0.0, 1};
+    const char *seed_maze_file = NULL;
+    QMAnnealOptions aopts = {2.0, 0.05, 20000, 0, QM_MOVE_ALL, NULL};
     int use_bfs = 0;
     int verbose = 0;
     int directed = 0;
+    QMRandomOptions ropts = {1, 0, 0, {0, 1, NULL}, {0, 0, 0}};
+    char shard_file[64];
 
     for (int i = 3; i < argc; i++) {
         if (strcmp(argv[i], "--max-aport") == 0 && i + 1 < argc)
@@ -129,6 +211,87 @@ static int cmd_search(int argc, char **argv) {
             random_seed = atoi(argv[++i]);
         else if (strcmp(argv[i], "--topdown") == 0)
             topdown = 1;
+        else if (strcmp(argv[i], "--lossy-seen") == 0)
+            topts.lossy_seen = 1;
+        else if (strcmp(argv[i], "--spill-dir") == 0 && i + 1 < argc)
+            topts.spill_dir = argv[++i];
+        else if (strcmp(argv[i], "--spill-mem") == 0 && i + 1 < argc)
+            topts.spill_mem = (size_t)atoi(argv[++i]) << 20;
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+            topts.checkpoint = argv[++i];
+        else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc)
+            topts.checkpoint_interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--anneal") == 0)
+            anneal = 1;
+        else if (strcmp(argv[i], "--genetic") == 0)
+            genetic = 1;
+        else if (strcmp(argv[i], "--bottomup") == 0)
+            bottomup = 1;
+        else if (strcmp(argv[i], "--beam") == 0 && i + 1 < argc)
+            beam = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--diversity") == 0 && i + 1 < argc)
+            topts.diversity = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--len-cache") == 0 && i + 1 < argc)
+            len_cache_mb = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--db") == 0 && i + 1 < argc)
+            db_path = argv[++i];
+        else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d/%d", &ropts.shard.index, &ropts.shard.count) != 2 ||
+                ropts.shard.count < 1 || ropts.shard.index < 0 ||
+                ropts.shard.index >= ropts.shard.count) {
+                fprintf(stderr, "Invalid --shard %s (use i/N with 0 <= i < N)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--shard-out") == 0 && i + 1 < argc)
+            ropts.shard.result_file = argv[++i];
+        else if (strcmp(argv[i], "--mcts") == 0)
+            mcts = 1;
+        else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+            mopts.iterations = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--uct-c") == 0 && i + 1 < argc)
+            mopts.uct_c = atof(argv[++i]);
+        else if (strcmp(argv[i], "--pop") == 0 && i + 1 < argc)
+            gopts.pop_size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--generations") == 0 && i + 1 < argc)
+            gopts.generations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--tournament") == 0 && i + 1 < argc)
+            gopts.tournament = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--elite") == 0 && i + 1 < argc)
+            gopts.elite = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--mutation") == 0 && i + 1 < argc)
+            gopts.mutation = atof(argv[++i]);
+        else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+            aopts.steps = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--restarts") == 0 && i + 1 < argc)
+            aopts.restarts = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--t-start") == 0 && i + 1 < argc)
+            aopts.t_start = atof(argv[++i]);
+        else if (strcmp(argv[i], "--t-end") == 0 && i + 1 < argc)
+            aopts.t_end = atof(argv[++i]);
+        else if (strcmp(argv[i], "--moves") == 0 && i + 1 < argc) {
+            aopts.moves = parse_moves(argv[++i]);
+            if (!aopts.moves) {
+                fprintf(stderr, "Unknown move in --moves %s (use flip,swap,endpoint)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--seed-maze") == 0 && i + 1 < argc)
+            seed_maze_file = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            ropts.nthreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--constructive") == 0)
+            ropts.constructive = 1;
+        else if (strcmp(argv[i], "--dedupe-mem") == 0 && i + 1 < argc)
+            ropts.dedupe_mem = (size_t)atoi(argv[++i]) << 20;
+        else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d:%d:%d", &ropts.pipeline[0], &ropts.pipeline[1],
+                       &ropts.pipeline[2]) != 3 ||
+                ropts.pipeline[0] < 1 || ropts.pipeline[1] < 1 || ropts.pipeline[2] < 1) {
+                fprintf(stderr, "Invalid --pipeline %s (use G:F:S thread counts, each >= 1)\n", argv[i]);
+                return 1;
+            }
+        }
         else if (strcmp(argv[i], "--bfs") == 0)
             use_bfs = 1;
         else if (strcmp(argv[i], "--directed") == 0)
@@ -137,21 +300,110 @@ static int cmd_search(int argc, char **argv) {
             verbose = 1;
     }
 
+    int sharded = ropts.shard.count > 1 || ropts.shard.result_file;
+    if (sharded && (bottomup || mcts || genetic || anneal || topdown)) {
+        fprintf(stderr, "Error: --shard is only supported by exhaustive and --random search\n");
+        return 1;
+    }
+    if (sharded && !ropts.shard.result_file) {
+        snprintf(shard_file, sizeof(shard_file), "shard-%d-of-%d.txt",
+                 ropts.shard.index, ropts.shard.count);
+        ropts.shard.result_file = shard_file;
+    }
+
     QMResult r;
-    if (topdown) {
-        printf("Top-down search: nterm=%d max_len=%d bfs=%d directed=%d\n", nterm, max_len, use_bfs, directed);
-        r = quizmaster_topdown_search(nterm, max_len, use_bfs, directed);
+    quizmaster_set_length_cache((size_t)len_cache_mb << 20);
+    ResultDB *db = NULL;
+    if (db_path) {
+        db = resultdb_open(db_path, nterm, 1);
+        if (!db) return 1;
+        quizmaster_set_result_db(db);
+    }
+    gopts.nthreads = ropts.nthreads;
+    topts.nthreads = ropts.nthreads;
+    topts.beam = beam;
+    if (bottomup) {
+        if (beam < 1) { fprintf(stderr, "Error: --beam <W> is required\n"); usage(); }
+        printf("Bottom-up search: nterm=%d beam=%d max_aport=%d max_len=%d threads=%d bfs=%d directed=%d\n",
+               nterm, beam, max_aport, max_len, ropts.nthreads, use_bfs, directed);
+        r = quizmaster_bottomup_search(nterm, max_aport > 0 ? max_aport : 0, max_len,
+                                       beam, use_bfs, directed, ropts.nthreads);
+    } else if (mcts) {
+        if (max_aport < 1) { fprintf(stderr, "Error: --max-aport <N> is required\n"); usage(); }
+        unsigned int seed = random_seed >= 0 ? (unsigned int)random_seed : 0;
+        printf("MCTS search: nterm=%d max_aport=%d max_len=%d seed=%u iterations=%llu uct_c=%g bfs=%d directed=%d\n",
+               nterm, max_aport, max_len, seed, (unsigned long long)mopts.iterations,
+               mopts.uct_c, use_bfs, directed);
+        r = quizmaster_mcts_search(nterm, max_aport, max_len, seed, use_bfs,
+                                   directed, &mopts);
+    } else if (genetic) {
+        unsigned int seed = random_seed >= 0 ? (unsigned int)random_seed : 0;
+        printf("Genetic search: nterm=%d max_aport=%d max_len=%d seed=%u pop=%d generations=%d threads=%d bfs=%d directed=%d\n",
+               nterm, max_aport, max_len, seed, gopts.pop_size, gopts.generations,
+               gopts.nthreads, use_bfs, directed);
+        r = quizmaster_genetic_search(nterm, max_aport > 0 ? max_aport : 0, max_len,
+                                      seed, use_bfs, directed, &gopts);
+    } else if (anneal) {
+        Maze *seed_maze = NULL;
+        if (seed_maze_file) {
+            char *str = read_maze_file(seed_maze_file);
+            if (!str) {
+                fprintf(stderr, "Cannot read %s\n", seed_maze_file);
+                return 1;
+            }
+            if (maze_detect_nterm(str) > nterm) {
+                fprintf(stderr, "Seed maze uses terminals beyond nterm=%d\n", nterm);
+                free(str);
+                return 1;
+            }
+            seed_maze = maze_parse(nterm, str);
+            free(str);
+            if (!seed_maze) {
+                fprintf(stderr, "Failed to parse seed maze\n");
+                return 1;
+            }
+            aopts.seed_maze = seed_maze;
+        }
+        unsigned int seed = random_seed >= 0 ? (unsigned int)random_seed : 0;
+        printf("Anneal search: nterm=%d max_aport=%d max_len=%d seed=%u steps=%llu restarts=%d t_start=%g t_end=%g bfs=%d directed=%d\n",
+               nterm, max_aport, max_len, seed, (unsigned long long)aopts.steps,
+               aopts.restarts, aopts.t_start, aopts.t_end, use_bfs, directed);
+        r = quizmaster_anneal_search(nterm, max_aport > 0 ? max_aport : 0, max_len,
+                                     seed, use_bfs, directed, &aopts);
+        maze_destroy(seed_maze);
+    } else if (topdown) {
+        printf("Top-down search: nterm=%d max_len=%d threads=%d beam=%d diversity=%d bfs=%d directed=%d\n",
+               nterm, max_len, ropts.nthreads, beam, topts.diversity, use_bfs, directed);
+        r = quizmaster_topdown_search(nterm, max_len, use_bfs, directed, &topts);
     } else if (random_seed >= 0) {
         if (max_aport < 0) { fprintf(stderr, "Error: --max-aport <N> is required\n"); usage(); }
-        printf("Random search: nterm=%d min_aport=%d max_aport=%d max_len=%d seed=%d bfs=%d directed=%d\n",
-               nterm, min_aport, max_aport, max_len, random_seed, use_bfs, directed);
+        printf("Random search: nterm=%d min_aport=%d max_aport=%d max_len=%d seed=%d threads=%d constructive=%d dedupe_mem=%zuMB bfs=%d directed=%d",
+               nterm, min_aport, max_aport, max_len, random_seed, ropts.nthreads,
+               ropts.constructive, ropts.dedupe_mem >> 20, use_bfs, directed);
+        if (ropts.pipeline[0])
+            printf(" pipeline=%d:%d:%d", ropts.pipeline[0], ropts.pipeline[1], ropts.pipeline[2]);
+        if (sharded)
+            printf(" shard=%d/%d", ropts.shard.index, ropts.shard.count);
+        printf("\n");
         r = quizmaster_random_search(nterm, min_aport, max_aport, max_len,
-                                     (unsigned int)random_seed, use_bfs, directed);
+                                     (unsigned int)random_seed, use_bfs, directed,
+                                     &ropts);
     } else {
         if (max_aport < 0) { fprintf(stderr, "Error: --max-aport <N> is required\n"); usage(); }
-        printf("Search: nterm=%d min_aport=%d max_aport=%d max_len=%d bfs=%d directed=%d\n",
+        printf("Search: nterm=%d min_aport=%d max_aport=%d max_len=%d bfs=%d directed=%d",
                nterm, min_aport, max_aport, max_len, use_bfs, directed);
-        r = quizmaster_search(nterm, min_aport, max_aport, max_len, use_bfs, directed);
+        if (sharded)
+            printf(" shard=%d/%d", ropts.shard.index, ropts.shard.count);
+        printf("\n");
+        r = quizmaster_search(nterm, min_aport, max_aport, max_len, use_bfs, directed,
+                              sharded ? &ropts.shard : NULL);
+    }
+
+    quizmaster_length_cache_report();
+    quizmaster_set_length_cache(0);
+    if (db) {
+        quizmaster_set_result_db(NULL);
+        resultdb_close(db);
     }
 
     if (r.best_maze) {
@@ -177,7 +429,7 @@ static int cmd_search(int argc, char **argv) {
  * cmd_norm -- handle the "norm" subcommand.
  *
  * Parses a maze from the command-line string, normalizes terminal indices,
- * and prints the normalized maze.
+ * and prints the normalized maze and its canonical representative.
  */
 static int cmd_norm(int argc, char **argv) {
     if (argc < 4) usage();
@@ -202,10 +454,222 @@ static int cmd_norm(int argc, char **argv) {
     printf("Normalized: ");
     maze_print(m);
 
+    maze_canonicalize(m, NULL);
+
+    printf("Canonical: ");
+    maze_print(m);
+
     maze_destroy(m);
     return 0;
 }
 
+/* db_histogram -- "db stats" callback: count entries per path length. */
+static void db_histogram(const uint64_t *key, int len, void *ctx) {
+    (void)key;
+    uint64_t *hist = ctx;
+    hist[len < 0 ? 0 : (len >= 255 ? 255 : len + 1)]++;
+}
+
+/* db_merge_into -- "db merge" callback: insert into the output database. */
+static void db_merge_into(const uint64_t *key, int len, void *ctx) {
+    resultdb_insert(ctx, key, len);
+}
+
+/*
+ * DBTop -- "db top" state: the n longest entries seen so far, kept sorted
+ * by length (descending).
+ */
+typedef struct {
+    int n, count, nwords;
+    int *lens;
+    uint64_t *keys;
+} DBTop;
+
+static void db_top_add(const uint64_t *key, int len, void *ctx) {
+    DBTop *t = ctx;
+    if (t->count == t->n && len <= t->lens[t->n - 1]) return;
+    int i = t->count < t->n ? t->count++ : t->n - 1;
+    while (i > 0 && t->lens[i - 1] < len) {
+        t->lens[i] = t->lens[i - 1];
+        memcpy(t->keys + (size_t)i * t->nwords, t->keys + (size_t)(i - 1) * t->nwords,
+               t->nwords * sizeof(uint64_t));
+        i--;
+    }
+    t->lens[i] = len;
+    memcpy(t->keys + (size_t)i * t->nwords, key, t->nwords * sizeof(uint64_t));
+}
+
+/*
+ * cmd_db -- handle the "db" subcommand.
+ *
+ *   db stats <file>            -- size, load and length histogram
+ *   db merge <out> <in>...     -- insert every entry of the inputs into out
+ *   db top <file> [<N>]        -- the N (default 10) longest stored mazes
+ */
+static int cmd_db(int argc, char **argv) {
+    if (argc < 4) usage();
+    const char *action = argv[2];
+
+    if (strcmp(action, "stats") == 0) {
+        ResultDB *db = resultdb_open(argv[3], 0, 0);
+        if (!db) return 1;
+        ResultDBStats st;
+        resultdb_stats(db, &st);
+        uint64_t hist[256] = {0};
+        resultdb_foreach(db, db_histogram, hist);
+        printf("Database: %s\n", argv[3]);
+        printf("  nterm=%d entries=%llu slots=%llu load=%.1f%% generation=%llu\n",
+               st.nterm, (unsigned long long)st.count, (unsigned long long)st.nslots,
+               st.nslots ? 100.0 * st.count / st.nslots : 0.0,
+               (unsigned long long)st.generation);
+        printf("  file=%.1f MB (%.1f MB superseded)\n",
+               st.file_bytes / 1048576.0, st.dead_bytes / 1048576.0);
+        printf("  lengths:");
+        if (hist[0]) printf(" none:%llu", (unsigned long long)hist[0]);
+        for (int i = 1; i < 256; i++)
+            if (hist[i]) printf(" %d:%llu", i - 1, (unsigned long long)hist[i]);
+        printf("\n");
+        resultdb_close(db);
+        return 0;
+    }
+
+    if (strcmp(action, "merge") == 0) {
+        if (argc < 5) usage();
+        ResultDB *out = NULL;
+        for (int i = 4; i < argc; i++) {
+            ResultDB *in = resultdb_open(argv[i], 0, 0);
+            if (!in) {
+                resultdb_close(out);
+                return 1;
+            }
+            if (!out) {
+                out = resultdb_open(argv[3], resultdb_nterm(in), 1);
+                if (!out) {
+                    resultdb_close(in);
+                    return 1;
+                }
+            }
+            if (resultdb_nterm(in) != resultdb_nterm(out)) {
+                fprintf(stderr, "Error: %s holds nterm=%d mazes, %s holds nterm=%d\n",
+                        argv[i], resultdb_nterm(in), argv[3], resultdb_nterm(out));
+                resultdb_close(in);
+                resultdb_close(out);
+                return 1;
+            }
+            resultdb_foreach(in, db_merge_into, out);
+            resultdb_close(in);
+        }
+        ResultDBStats st;
+        resultdb_stats(out, &st);
+        printf("Merged %d database%s into %s: %llu entries\n", argc - 4,
+               argc - 4 > 1 ? "s" : "", argv[3], (unsigned long long)st.count);
+        resultdb_close(out);
+        return 0;
+    }
+
+    if (strcmp(action, "top") == 0) {
+        ResultDB *db = resultdb_open(argv[3], 0, 0);
+        if (!db) return 1;
+        int nterm = resultdb_nterm(db);
+        Maze *m = maze_create(nterm);
+        DBTop t;
+        t.n = argc > 4 ? atoi(argv[4]) : 10;
+        if (t.n < 1) t.n = 1;
+        t.count = 0;
+        t.nwords = maze_bits_nwords(m);
+        t.lens = malloc(t.n * sizeof(int));
+        t.keys = malloc((size_t)t.n * t.nwords * sizeof(uint64_t));
+        resultdb_foreach(db, db_top_add, &t);
+
+        uint64_t *sym = malloc(t.nwords * sizeof(uint64_t));
+        for (int i = 0; i < t.count; i++) {
+            const uint64_t *key = t.keys + (size_t)i * t.nwords;
+            /* Print symmetric entries as undirected mazes */
+            memcpy(sym, key, t.nwords * sizeof(uint64_t));
+            maze_bits_make_undirected(m, sym);
+            m->directed = maze_bits_cmp(sym, key, t.nwords) != 0;
+            maze_from_bits(m, key);
+            printf("%d\t", t.lens[i]);
+            maze_print(m);
+        }
+        free(sym);
+        free(t.lens);
+        free(t.keys);
+        maze_destroy(m);
+        resultdb_close(db);
+        return 0;
+    }
+
+    usage();
+    return 1;
+}
+
+/*
+ * cmd_merge -- handle the "merge" subcommand.
+ *
+ * Reads the result files of a sharded search, checks that they belong to
+ * the same search, sums them and prints the merged report and best maze
+ * (re-solved for its path). With -o the merged result is also written as
+ * a result file, so merges can be done in stages.
+ */
+static int cmd_merge(int argc, char **argv) {
+    const char *out = NULL;
+    ShardResult *acc = NULL;
+    int nfiles = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out = argv[++i];
+            continue;
+        }
+        ShardResult *r = shard_result_read(argv[i]);
+        if (!r || (acc && shard_result_merge(acc, r) != 0)) {
+            if (r) fprintf(stderr, "Cannot merge %s\n", argv[i]);
+            shard_result_free(r);
+            shard_result_free(acc);
+            return 1;
+        }
+        if (acc) shard_result_free(r);
+        else acc = r;
+        nfiles++;
+    }
+    if (!acc) usage();
+
+    printf("Merged %d shard file%s\n", nfiles, nfiles > 1 ? "s" : "");
+    shard_result_fprint(stdout, acc);
+
+    if (acc->best_maze) {
+        Maze *m = maze_parse(acc->nterm, acc->best_maze);
+        if (m) {
+            m->directed = acc->directed;
+            if (!acc->directed)
+                maze_make_undirected(m);
+            State *path = NULL;
+            int path_len = 0;
+            int len = solve_bfs(m, &path, &path_len);
+            printf("\n=== Best result ===\n");
+            printf("Maze:\n");
+            maze_print(m);
+            if (len >= 0) {
+                printf("Path:\n");
+                path_print(path, path_len);
+                printf("\nPath length: %d\n", len);
+            }
+            free(path);
+            maze_destroy(m);
+        }
+    } else {
+        printf("No maze with a valid path found.\n");
+    }
+
+    int ret = 0;
+    if (out) {
+        ret = shard_result_write(acc, out) != 0;
+        if (!ret) fprintf(stderr, "Merged result written to %s\n", out);
+    }
+    shard_result_free(acc);
+    return ret;
+}
+
 /*
  * main -- program entry point. Dispatches to subcommands.
  */
@@ -222,6 +686,10 @@ int main(int argc, char **argv) {
         return cmd_search(argc, argv);
     if (strcmp(argv[1], "norm") == 0)
         return cmd_norm(argc, argv);
+    if (strcmp(argv[1], "db") == 0)
+        return cmd_db(argc, argv);
+    if (strcmp(argv[1], "merge") == 0)
+        return cmd_merge(argc, argv);
 
     usage();
     return 1;
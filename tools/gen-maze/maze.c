@@ -9,14 +9,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <assert.h>
 
 /*
- * maze_create -- allocate a new maze with the given nterm.
- * All port arrays are zero-initialized (no connections).
+ * maze_layout -- fill in nterm and the port counts of a maze header.
  * For nterm=2: normal has 64 ports, nx and ny each have 2 ports, total 68.
  */
-Maze *maze_create(int nterm) {
-    Maze *m = calloc(1, sizeof(Maze));
+static void maze_layout(Maze *m, int nterm) {
     m->nterm = nterm;
     int n4 = 4 * nterm;
     m->normal_nports = n4 * n4;
@@ -24,12 +23,37 @@ Maze *maze_create(int nterm) {
     m->ny_nports = nterm * (nterm - 1);
     m->total_nports = m->normal_nports + m->nx_nports + m->ny_nports;
     m->directed = 0;
-    m->normal_ports = calloc(m->normal_nports > 0 ? m->normal_nports : 1, 1);
-    m->nx_ports     = calloc(m->nx_nports > 0 ? m->nx_nports : 1, 1);
-    m->ny_ports     = calloc(m->ny_nports > 0 ? m->ny_nports : 1, 1);
+}
+
+/* maze_alloc_size -- bytes for a Maze header plus its three port arrays. */
+static size_t maze_alloc_size(int nterm) {
+    Maze tmp;
+    maze_layout(&tmp, nterm);
+    return sizeof(Maze) + (size_t)tmp.total_nports + 1;
+}
+
+/*
+ * maze_place -- lay out a zeroed block as a maze: the port arrays follow
+ * the header in the same block, so a maze is a single allocation.
+ */
+static Maze *maze_place(void *block, int nterm) {
+    Maze *m = block;
+    maze_layout(m, nterm);
+    uint8_t *ports = (uint8_t *)(m + 1);
+    m->normal_ports = ports;
+    m->nx_ports     = ports + m->normal_nports;
+    m->ny_ports     = ports + m->normal_nports + m->nx_nports;
     return m;
 }
 
+/*
+ * maze_create -- allocate a new maze with the given nterm.
+ * All port arrays are zero-initialized (no connections).
+ */
+Maze *maze_create(int nterm) {
+    return maze_place(calloc(1, maze_alloc_size(nterm)), nterm);
+}
+
 /* maze_clear -- zero all port arrays (no connections). */
 void maze_clear(Maze *m) {
     memset(m->normal_ports, 0, m->normal_nports);
@@ -37,22 +61,23 @@ void maze_clear(Maze *m) {
     memset(m->ny_ports,     0, m->ny_nports);
 }
 
-/* maze_destroy -- free the maze and all its port arrays. */
+/* maze_destroy -- free the maze (header and port arrays are one block). */
 void maze_destroy(Maze *m) {
-    if (!m) return;
-    free(m->normal_ports);
-    free(m->nx_ports);
-    free(m->ny_ports);
     free(m);
 }
 
+/* maze_copy -- copy ports and flags of src into dst without allocating. */
+void maze_copy(Maze *dst, const Maze *src) {
+    dst->directed = src->directed;
+    memcpy(dst->normal_ports, src->normal_ports, src->normal_nports);
+    memcpy(dst->nx_ports,     src->nx_ports,     src->nx_nports);
+    memcpy(dst->ny_ports,     src->ny_ports,     src->ny_nports);
+}
+
 /* maze_clone -- create a deep copy of the maze. */
 Maze *maze_clone(const Maze *m) {
     Maze *c = maze_create(m->nterm);
-    c->directed = m->directed;
-    memcpy(c->normal_ports, m->normal_ports, m->normal_nports);
-    memcpy(c->nx_ports,     m->nx_ports,     m->nx_nports);
-    memcpy(c->ny_ports,     m->ny_ports,     m->ny_nports);
+    maze_copy(c, m);
     return c;
 }
 
@@ -167,6 +192,195 @@ void maze_randomize(Maze *m, uint64_t *rng) {
         maze_set_port(m, i, rng_next(rng) & 1);
 }
 
+/*
+ * maze_reverse_port -- flat index of the port with source and destination
+ * exchanged. nx/ny ports stay within their own block.
+ */
+int maze_reverse_port(const Maze *m, int idx) {
+    int n = m->nterm;
+    if (idx < m->normal_nports) {
+        int n4 = 4 * n;
+        return (idx % n4) * n4 + idx / n4;
+    }
+    int base = m->normal_nports;
+    idx -= base;
+    if (idx >= m->nx_nports) {
+        idx -= m->nx_nports;
+        base += m->nx_nports;
+    }
+    int si = idx / (n - 1);
+    int adj = idx % (n - 1);
+    int di = adj < si ? adj : adj + 1;
+    return base + edge_idx(n, di, si);
+}
+
+/* --- Bit-packed port sets --- */
+
+/*
+ * pack_bytes -- pack len 0/1 bytes into bits starting at bit offset off.
+ * Eight bytes are gathered into one byte of bits with a single multiply:
+ * byte i of the chunk lands on bit 56+i of the product.
+ */
+static void pack_bytes(uint64_t *bits, int off, const uint8_t *src, int len) {
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, src + i, 8);
+        uint64_t v = (chunk * 0x0102040810204080ULL) >> 56;
+        int pos = off + i;
+        bits[pos >> 6] |= v << (pos & 63);
+        if ((pos & 63) > 56)
+            bits[(pos >> 6) + 1] |= v >> (64 - (pos & 63));
+    }
+    for (; i < len; i++)
+        if (src[i]) maze_bits_set(bits, off + i);
+}
+
+/* unpack_bytes -- inverse of pack_bytes. */
+static void unpack_bytes(uint8_t *dst, const uint64_t *bits, int off, int len) {
+    for (int i = 0; i < len; i++)
+        dst[i] = (uint8_t)maze_bits_get(bits, off + i);
+}
+
+/* maze_to_bits -- pack all port arrays into a flat bitset. */
+void maze_to_bits(const Maze *m, uint64_t *bits) {
+    memset(bits, 0, maze_bits_nwords(m) * sizeof(uint64_t));
+    pack_bytes(bits, 0, m->normal_ports, m->normal_nports);
+    pack_bytes(bits, m->normal_nports, m->nx_ports, m->nx_nports);
+    pack_bytes(bits, m->normal_nports + m->nx_nports, m->ny_ports, m->ny_nports);
+}
+
+/* maze_from_bits -- unpack a flat bitset into all port arrays. */
+void maze_from_bits(Maze *m, const uint64_t *bits) {
+    unpack_bytes(m->normal_ports, bits, 0, m->normal_nports);
+    unpack_bytes(m->nx_ports, bits, m->normal_nports, m->nx_nports);
+    unpack_bytes(m->ny_ports, bits, m->normal_nports + m->nx_nports, m->ny_nports);
+}
+
+/*
+ * bits_extract -- read width (<= 64) bits starting at bit offset off.
+ * A row may straddle two words.
+ */
+static uint64_t bits_extract(const uint64_t *bits, int off, int width) {
+    int w = off >> 6, sh = off & 63;
+    uint64_t v = bits[w] >> sh;
+    if (sh + width > 64)
+        v |= bits[w + 1] << (64 - sh);
+    return width == 64 ? v : v & ((1ULL << width) - 1);
+}
+
+/* bits_deposit -- OR width (<= 64) bits of v in at bit offset off. */
+static void bits_deposit(uint64_t *bits, int off, int width, uint64_t v) {
+    int w = off >> 6, sh = off & 63;
+    bits[w] |= v << sh;
+    if (sh + width > 64)
+        bits[w + 1] |= v >> (64 - sh);
+}
+
+/* maze_bits_row -- the 4*nterm destination bits of normal terminal t. */
+uint64_t maze_bits_row(const Maze *m, const uint64_t *bits, int t) {
+    assert(m->nterm <= MAZE_MAX_NTERM);
+    int n4 = 4 * m->nterm;
+    return bits_extract(bits, t * n4, n4);
+}
+
+/* maze_bits_count -- popcount over all words. */
+int maze_bits_count(const uint64_t *bits, int nwords) {
+    int c = 0;
+    for (int i = 0; i < nwords; i++)
+        c += __builtin_popcountll(bits[i]);
+    return c;
+}
+
+/* maze_bits_out_degree -- popcount of the row of terminal t. */
+int maze_bits_out_degree(const Maze *m, const uint64_t *bits, int t) {
+    return __builtin_popcountll(maze_bits_row(m, bits, t));
+}
+
+/* maze_bits_in_degree -- count rows that have column t set. */
+int maze_bits_in_degree(const Maze *m, const uint64_t *bits, int t) {
+    int n4 = 4 * m->nterm;
+    int c = 0;
+    for (int s = 0; s < n4; s++)
+        c += (int)((maze_bits_row(m, bits, s) >> t) & 1);
+    return c;
+}
+
+/*
+ * transpose64 -- transpose a 64x64 bit matrix in place (row i, bit j).
+ * Swaps successively smaller off-diagonal blocks (32, 16, ..., 1).
+ */
+static void transpose64(uint64_t *a) {
+    int j = 32;
+    uint64_t mask = 0x00000000FFFFFFFFULL;
+    for (; j != 0; j >>= 1, mask ^= mask << j) {
+        for (int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            uint64_t t = ((a[k] >> j) ^ a[k | j]) & mask;
+            a[k] ^= t << j;
+            a[k | j] ^= t;
+        }
+    }
+}
+
+/*
+ * maze_bits_make_undirected -- symmetrize a packed maze.
+ * The normal rows are transposed as a 64x64 bit matrix and OR-ed back;
+ * nx/ny ports are mirrored through maze_reverse_port. Rows wider than a
+ * word (nterm > MAZE_MAX_NTERM) are mirrored port by port as well.
+ */
+void maze_bits_make_undirected(const Maze *m, uint64_t *bits) {
+    int n = m->nterm;
+    int hi = m->total_nports;
+    if (n > MAZE_MAX_NTERM) {
+        for (int idx = 0; idx < hi; idx++)
+            if (maze_bits_get(bits, idx))
+                maze_bits_set(bits, maze_reverse_port(m, idx));
+        return;
+    }
+
+    int n4 = 4 * n;
+    uint64_t rows[64], tr[64];
+    memset(rows, 0, sizeof(rows));
+    for (int t = 0; t < n4; t++)
+        rows[t] = maze_bits_row(m, bits, t);
+    memcpy(tr, rows, sizeof(rows));
+    transpose64(tr);
+    for (int t = 0; t < n4; t++) {
+        uint64_t add = tr[t] & ~rows[t];
+        if (add) bits_deposit(bits, t * n4, n4, add);
+    }
+
+    for (int idx = m->normal_nports; idx < hi; idx++)
+        if (maze_bits_get(bits, idx))
+            maze_bits_set(bits, maze_reverse_port(m, idx));
+}
+
+/*
+ * maze_bits_hash -- multiply-xorshift hash over words, finished with the
+ * splitmix64 finalizer so that every output bit (low bits included) can
+ * serve as a table index. No bit is forced; callers that need a nonzero
+ * value map 0 themselves.
+ */
+uint64_t maze_bits_hash(const uint64_t *bits, int nwords) {
+    uint64_t h = 0x517cc1b727220a95ULL;
+    for (int i = 0; i < nwords; i++) {
+        h ^= bits[i];
+        h *= 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+/* maze_bits_cmp -- compare word by word. */
+int maze_bits_cmp(const uint64_t *a, const uint64_t *b, int nwords) {
+    for (int i = 0; i < nwords; i++)
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
 /* --- Undirected --- */
 
 /*
@@ -364,26 +578,25 @@ void maze_print_table(const Maze *m) {
 /* --- Normalize --- */
 
 /*
- * maze_normalize -- normalize terminal indices by first-appearance order.
+ * normalize_maps -- index mappings by first-appearance order.
  *
- * Two independent permutations are applied:
+ * Two independent permutations are computed:
  *   ew_map: E/W terminal indices (0 and 1 fixed, rest by first appearance)
  *   ns_map: N/S terminal indices (all by first appearance)
  *
  * Ports are scanned in flat index order: normal block ports first (by
  * src * n4 + dst), then nx ports (by src * n + dst), then ny ports.
  * The first unseen index encountered gets the next available canonical index.
+ * Both maps must hold nterm entries.
  */
-void maze_normalize(Maze *m) {
+static void normalize_maps(const Maze *m, int *ew_map, int *ns_map) {
     int n = m->nterm;
-    if (n < 2) return;
     int n4 = 4 * n;
 
-    /* Build index mappings via first-appearance scan */
-    int *ew_map = malloc(n * sizeof(int));
-    int *ns_map = malloc(n * sizeof(int));
-    memset(ew_map, -1, n * sizeof(int));
-    memset(ns_map, -1, n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        ew_map[i] = -1;
+        ns_map[i] = -1;
+    }
 
     /* E/W: indices 0 and 1 are fixed (start and goal terminals) */
     ew_map[0] = 0;
@@ -425,11 +638,20 @@ void maze_normalize(Maze *m) {
         if (ew_map[i] == -1) ew_map[i] = next_ew++;
         if (ns_map[i] == -1) ns_map[i] = next_ns++;
     }
+}
 
-    /* Apply mapping to create new port arrays */
-    uint8_t *new_normal = calloc(m->normal_nports, 1);
-    uint8_t *new_nx = calloc(m->nx_nports > 0 ? m->nx_nports : 1, 1);
-    uint8_t *new_ny = calloc(m->ny_nports > 0 ? m->ny_nports : 1, 1);
+/*
+ * normalize_into -- write the normalized ports of m into out.
+ * out must have the same nterm and must not alias m.
+ */
+static void normalize_into(const Maze *m, Maze *out) {
+    int n = m->nterm;
+    out->directed = m->directed;
+    maze_clear(out);
+    if (n < 2) return;
+    int n4 = 4 * n;
+    int ew_map[n], ns_map[n];
+    normalize_maps(m, ew_map, ns_map);
 
     for (int src = 0; src < n4; src++) {
         for (int dst = 0; dst < n4; dst++) {
@@ -438,52 +660,628 @@ void maze_normalize(Maze *m) {
             int dd = dst / n, di = dst % n;
             int nsi = (sd < 2) ? ew_map[si] : ns_map[si];
             int ndi = (dd < 2) ? ew_map[di] : ns_map[di];
-            int new_src = sd * n + nsi;
-            int new_dst = dd * n + ndi;
-            new_normal[new_src * n4 + new_dst] = 1;
+            out->normal_ports[(sd * n + nsi) * n4 + dd * n + ndi] = 1;
         }
     }
 
     for (int si = 0; si < n; si++)
-        for (int di = 0; di < n; di++)
-            if (si != di && maze_nx_port(m, si, di)) {
-                int nsi = ew_map[si], ndi = ew_map[di];
-                int adj = ndi < nsi ? ndi : ndi - 1;
-                new_nx[nsi * (n - 1) + adj] = 1;
-            }
+        for (int di = 0; di < n; di++) {
+            if (si == di) continue;
+            if (maze_nx_port(m, si, di))
+                maze_set_nx_port(out, ew_map[si], ew_map[di], 1);
+            if (maze_ny_port(m, si, di))
+                maze_set_ny_port(out, ns_map[si], ns_map[di], 1);
+        }
+}
+
+/*
+ * maze_normalize -- normalize terminal indices by first-appearance order.
+ * Works in-place through maze_permute (no heap allocation) when nterm
+ * fits a MazePerm; larger mazes go through a temporary copy.
+ */
+void maze_normalize(Maze *m) {
+    int n = m->nterm;
+    if (n < 2) return;
+    if (n > MAZE_MAX_NTERM) {
+        Maze *tmp = maze_create(n);
+        normalize_into(m, tmp);
+        maze_copy(m, tmp);
+        maze_destroy(tmp);
+        return;
+    }
+    int ew_map[MAZE_MAX_NTERM], ns_map[MAZE_MAX_NTERM];
+    normalize_maps(m, ew_map, ns_map);
+    MazePerm p;
+    for (int i = 0; i < n; i++) {
+        p.ew[i] = (int8_t)ew_map[i];
+        p.ns[i] = (int8_t)ns_map[i];
+    }
+    p.reverse = 0;
+    maze_permute(m, &p);
+}
+
+/*
+ * maze_is_normalized -- check if a maze is already in canonical form.
+ * The mapping is a bijection on ports, so normalize(m) == m exactly when
+ * the image of every active port is itself active. No copy is made.
+ */
+int maze_is_normalized(const Maze *m) {
+    int n = m->nterm;
+    if (n < 2) return 1;
+    int n4 = 4 * n;
+    int ew_map[n], ns_map[n];
+    normalize_maps(m, ew_map, ns_map);
+
+    for (int src = 0; src < n4; src++) {
+        for (int dst = 0; dst < n4; dst++) {
+            if (!m->normal_ports[src * n4 + dst]) continue;
+            int sd = src / n, si = src % n;
+            int dd = dst / n, di = dst % n;
+            int nsi = (sd < 2) ? ew_map[si] : ns_map[si];
+            int ndi = (dd < 2) ? ew_map[di] : ns_map[di];
+            if (!m->normal_ports[(sd * n + nsi) * n4 + dd * n + ndi])
+                return 0;
+        }
+    }
 
     for (int si = 0; si < n; si++)
-        for (int di = 0; di < n; di++)
-            if (si != di && maze_ny_port(m, si, di)) {
-                int nsi = ns_map[si], ndi = ns_map[di];
-                int adj = ndi < nsi ? ndi : ndi - 1;
-                new_ny[nsi * (n - 1) + adj] = 1;
+        for (int di = 0; di < n; di++) {
+            if (si == di) continue;
+            if (maze_nx_port(m, si, di) &&
+                !maze_nx_port(m, ew_map[si], ew_map[di]))
+                return 0;
+            if (maze_ny_port(m, si, di) &&
+                !maze_ny_port(m, ns_map[si], ns_map[di]))
+                return 0;
+        }
+    return 1;
+}
+
+/* --- Canonical form --- */
+
+/*
+ * PortRows -- port sets as bit rows, one uint64_t per source terminal.
+ *   normal[t] bit d -- normal port t->d (t, d = dir * nterm + idx)
+ *   nx[i]     bit j -- nx port E[i]->E[j]
+ *   ny[i]     bit j -- ny port N[i]->N[j]
+ * Rows are ordered normal, nx, ny for lexicographic comparison.
+ */
+typedef struct {
+    uint64_t normal[4 * MAZE_MAX_NTERM];
+    uint64_t nx[MAZE_MAX_NTERM];
+    uint64_t ny[MAZE_MAX_NTERM];
+} PortRows;
+
+/* term_map -- image of normal-block terminal t under the index maps. */
+static int term_map(int n, int t, const int8_t *ew, const int8_t *ns) {
+    int d = t / n, i = t % n;
+    return d * n + (d < 2 ? ew[i] : ns[i]);
+}
+
+/* perm_identity -- fill p with the identity relabeling. */
+static void perm_identity(int n, MazePerm *p) {
+    for (int i = 0; i < n; i++) {
+        p->ew[i] = (int8_t)i;
+        p->ns[i] = (int8_t)i;
+    }
+    p->reverse = 0;
+}
+
+/* rows_build -- read the maze ports into rows through relabeling p. */
+static void rows_build(const Maze *m, const MazePerm *p, PortRows *r) {
+    int n = m->nterm;
+    int n4 = 4 * n;
+    memset(r->normal, 0, n4 * sizeof(uint64_t));
+    memset(r->nx, 0, n * sizeof(uint64_t));
+    memset(r->ny, 0, n * sizeof(uint64_t));
+
+    for (int s = 0; s < n4; s++)
+        for (int d = 0; d < n4; d++) {
+            if (!m->normal_ports[s * n4 + d]) continue;
+            int a = term_map(n, s, p->ew, p->ns);
+            int b = term_map(n, d, p->ew, p->ns);
+            if (p->reverse) { int t = a; a = b; b = t; }
+            r->normal[a] |= 1ULL << b;
+        }
+
+    for (int si = 0; si < n; si++)
+        for (int di = 0; di < n; di++) {
+            if (si == di) continue;
+            if (maze_nx_port(m, si, di)) {
+                int a = p->ew[si], b = p->ew[di];
+                if (p->reverse) { int t = a; a = b; b = t; }
+                r->nx[a] |= 1ULL << b;
+            }
+            if (maze_ny_port(m, si, di)) {
+                int a = p->ns[si], b = p->ns[di];
+                if (p->reverse) { int t = a; a = b; b = t; }
+                r->ny[a] |= 1ULL << b;
             }
+        }
+}
 
-    /* Replace port arrays */
-    free(m->normal_ports);
-    free(m->nx_ports);
-    free(m->ny_ports);
-    m->normal_ports = new_normal;
-    m->nx_ports = new_nx;
-    m->ny_ports = new_ny;
+/* rows_cmp -- lexicographic comparison of two row sets (-1, 0, 1). */
+static int rows_cmp(const PortRows *a, const PortRows *b, int n) {
+    for (int t = 0; t < 4 * n; t++)
+        if (a->normal[t] != b->normal[t])
+            return a->normal[t] < b->normal[t] ? -1 : 1;
+    for (int i = 0; i < n; i++)
+        if (a->nx[i] != b->nx[i])
+            return a->nx[i] < b->nx[i] ? -1 : 1;
+    for (int i = 0; i < n; i++)
+        if (a->ny[i] != b->ny[i])
+            return a->ny[i] < b->ny[i] ? -1 : 1;
+    return 0;
+}
 
-    free(ew_map);
-    free(ns_map);
+/* permute_bits -- move every set bit b of row to position map[b]. */
+static uint64_t permute_bits(uint64_t row, const int *map) {
+    uint64_t out = 0;
+    while (row) {
+        int b = __builtin_ctzll(row);
+        row &= row - 1;
+        out |= 1ULL << map[b];
+    }
+    return out;
 }
 
 /*
- * maze_is_normalized -- check if a maze is already in canonical form.
- * Clones and normalizes, then compares all port arrays.
+ * Signature length used by refine_colors: per neighbor color, counts of
+ * normal ports (2 sides x in/out x 4 neighbor directions) plus nx/ny
+ * ports (in/out).
  */
-int maze_is_normalized(const Maze *m) {
-    Maze *norm = maze_clone(m);
-    maze_normalize(norm);
-    int eq = (memcmp(m->normal_ports, norm->normal_ports, m->normal_nports) == 0 &&
-              memcmp(m->nx_ports, norm->nx_ports, m->nx_nports) == 0 &&
-              memcmp(m->ny_ports, norm->ny_ports, m->ny_nports) == 0);
-    maze_destroy(norm);
-    return eq;
+#define SIG_LEN(n) (18 * (n))
+
+/*
+ * sig_slot -- signature slot for a normal port seen from one endpoint.
+ *   side  -- 0 for E/N terminals, 1 for W/S terminals of this index
+ *   inout -- 0 for outgoing ports, 1 for incoming ports
+ *   ndir  -- TDIR_* of the other endpoint
+ *   color -- color of the other endpoint's index
+ */
+static int sig_slot(int n, int side, int inout, int ndir, int color) {
+    return (((side * 2 + inout) * 4 + ndir) * n) + color;
+}
+
+/*
+ * assign_colors -- sort indices by (old color, signature) and assign ranks.
+ * Returns the number of distinct colors.
+ */
+static int assign_colors(int n, int *color,
+                         uint8_t sig[][SIG_LEN(MAZE_MAX_NTERM)]) {
+    int order[MAZE_MAX_NTERM];
+    int len = SIG_LEN(n);
+    for (int i = 0; i < n; i++) order[i] = i;
+    /* Insertion sort (n is tiny), stable by index */
+    for (int i = 1; i < n; i++) {
+        int v = order[i], j = i - 1;
+        while (j >= 0) {
+            int u = order[j];
+            int c = color[u] != color[v] ? (color[u] > color[v] ? 1 : -1)
+                                         : memcmp(sig[u], sig[v], len);
+            if (c <= 0) break;
+            order[j + 1] = u;
+            j--;
+        }
+        order[j + 1] = v;
+    }
+    int newc[MAZE_MAX_NTERM];
+    int ncolors = 0;
+    for (int i = 0; i < n; i++) {
+        int v = order[i];
+        if (i > 0) {
+            int u = order[i - 1];
+            if (color[u] != color[v] || memcmp(sig[u], sig[v], len) != 0)
+                ncolors++;
+        }
+        newc[v] = ncolors;
+    }
+    memcpy(color, newc, n * sizeof(int));
+    return ncolors + 1;
+}
+
+/*
+ * count_colors -- number of distinct colors among col[0..n-1] (the colors
+ * are ranks 0..k-1, so this is the largest one plus one).
+ */
+static int count_colors(int n, const int *col) {
+    int k = 0;
+    for (int i = 0; i < n; i++)
+        if (col[i] >= k) k = col[i] + 1;
+    return k;
+}
+
+/*
+ * refine_colors -- color refinement of E/W and N/S indices.
+ *
+ * Starts from the given colors (ranks on each side) and splits colors by
+ * the number of ports to and from every (direction, color) pair, until
+ * no color class splits further. Colors are ordered by (old color,
+ * signature), so the result depends only on the maze structure and the
+ * starting colors, not on how the indices happen to be labeled.
+ */
+static void refine_colors(const PortRows *r, int n, int *cew, int *cns) {
+    uint8_t sew[MAZE_MAX_NTERM][SIG_LEN(MAZE_MAX_NTERM)];
+    uint8_t sns[MAZE_MAX_NTERM][SIG_LEN(MAZE_MAX_NTERM)];
+    int n4 = 4 * n;
+    int nxbase = 16 * n;
+    int ncew = count_colors(n, cew);
+    int ncns = count_colors(n, cns);
+
+    while (ncew < n || ncns < n) {
+        for (int i = 0; i < n; i++) {
+            memset(sew[i], 0, SIG_LEN(n));
+            memset(sns[i], 0, SIG_LEN(n));
+        }
+        for (int s = 0; s < n4; s++) {
+            int sd = s / n, si = s % n;
+            int sc = sd < 2 ? cew[si] : cns[si];
+            uint8_t *ssig = sd < 2 ? sew[si] : sns[si];
+            uint64_t row = r->normal[s];
+            while (row) {
+                int d = __builtin_ctzll(row);
+                row &= row - 1;
+                int dd = d / n, di = d % n;
+                int dc = dd < 2 ? cew[di] : cns[di];
+                uint8_t *dsig = dd < 2 ? sew[di] : sns[di];
+                ssig[sig_slot(n, sd & 1, 0, dd, dc)]++;
+                dsig[sig_slot(n, dd & 1, 1, sd, sc)]++;
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            uint64_t row = r->nx[i];
+            while (row) {
+                int j = __builtin_ctzll(row);
+                row &= row - 1;
+                sew[i][nxbase + cew[j]]++;
+                sew[j][nxbase + n + cew[i]]++;
+            }
+            row = r->ny[i];
+            while (row) {
+                int j = __builtin_ctzll(row);
+                row &= row - 1;
+                sns[i][nxbase + cns[j]]++;
+                sns[j][nxbase + n + cns[i]]++;
+            }
+        }
+        int new_ew = assign_colors(n, cew, sew);
+        int new_ns = assign_colors(n, cns, sns);
+        if (new_ew == ncew && new_ns == ncns) break;
+        ncew = new_ew;
+        ncns = new_ns;
+    }
+}
+
+/*
+ * individualize -- give index v a color of its own, ordered just before
+ * the rest of its old color class, and re-rank the colors of that side.
+ */
+static void individualize(int n, int *col, int v) {
+    int c = col[v];
+    int used[2 * MAZE_MAX_NTERM] = {0};
+    for (int i = 0; i < n; i++) {
+        col[i] = 2 * col[i] + (col[i] == c && i != v);
+        used[col[i]] = 1;
+    }
+    int rank[2 * MAZE_MAX_NTERM];
+    for (int k = 0, next = 0; k < 2 * n; k++)
+        rank[k] = used[k] ? next++ : 0;
+    for (int i = 0; i < n; i++)
+        col[i] = rank[col[i]];
+}
+
+/* Automorphisms kept per search; more are dropped (less pruning only). */
+#define CANON_MAX_AUTO 64
+
+/*
+ * CanonSearch -- state of one individualization-refinement search.
+ *
+ * Indices are numbered as vertices: v < n is E/W index v, v >= n is N/S
+ * index v - n. A path is the sequence of individualized vertices from the
+ * root; a leaf is a path whose refined coloring is discrete, and its
+ * colors are its relabeling.
+ *
+ * Fields:
+ *   first, best     -- rows of the first leaf and of the smallest leaf
+ *   pfirst, pbest   -- their relabelings and paths
+ *   autos           -- automorphisms (vertex maps) found by comparing
+ *                      leaves with equal rows
+ *   jump            -- level to backtrack to (-1 = none)
+ */
+typedef struct {
+    const PortRows *r;
+    int n;
+    int have_first;
+    PortRows first, best;
+    MazePerm pfirst, pbest;
+    int8_t path[2 * MAZE_MAX_NTERM];
+    int8_t path_first[2 * MAZE_MAX_NTERM];
+    int8_t path_best[2 * MAZE_MAX_NTERM];
+    int nauto;
+    int8_t autos[CANON_MAX_AUTO][2 * MAZE_MAX_NTERM];
+    int jump;
+} CanonSearch;
+
+/* leaf_rows -- rows of r relabeled by p (E/W 0/1 stay fixed by p). */
+static void leaf_rows(const PortRows *r, int n, const MazePerm *p,
+                      PortRows *out) {
+    int tmap[4 * MAZE_MAX_NTERM], ewmap[MAZE_MAX_NTERM], nsmap[MAZE_MAX_NTERM];
+    for (int i = 0; i < n; i++) {
+        ewmap[i] = p->ew[i];
+        nsmap[i] = p->ns[i];
+    }
+    for (int t = 0; t < 4 * n; t++)
+        tmap[t] = term_map(n, t, p->ew, p->ns);
+    for (int t = 0; t < 4 * n; t++)
+        out->normal[tmap[t]] = permute_bits(r->normal[t], tmap);
+    for (int i = 0; i < n; i++) {
+        out->nx[ewmap[i]] = permute_bits(r->nx[i], ewmap);
+        out->ny[nsmap[i]] = permute_bits(r->ny[i], nsmap);
+    }
+}
+
+/*
+ * canon_found_auto -- leaf p (at the end of the current path) has the
+ * same rows as leaf q (reached by path qpath). Records the automorphism
+ * q^-1 * p, which maps the current path onto qpath, and backtracks to
+ * where the two paths split: everything below that point on the current
+ * side mirrors a subtree that has already been searched.
+ */
+static void canon_found_auto(CanonSearch *s, const MazePerm *p,
+                             const MazePerm *q, const int8_t *qpath,
+                             int depth) {
+    int n = s->n;
+    if (s->nauto < CANON_MAX_AUTO) {
+        int8_t qinv_ew[MAZE_MAX_NTERM], qinv_ns[MAZE_MAX_NTERM];
+        int8_t *a = s->autos[s->nauto++];
+        for (int i = 0; i < n; i++) {
+            qinv_ew[(int)q->ew[i]] = (int8_t)i;
+            qinv_ns[(int)q->ns[i]] = (int8_t)i;
+        }
+        for (int i = 0; i < n; i++) {
+            a[i] = qinv_ew[(int)p->ew[i]];
+            a[n + i] = (int8_t)(n + qinv_ns[(int)p->ns[i]]);
+        }
+    }
+    int l = 0;
+    while (l < depth && s->path[l] == qpath[l]) l++;
+    s->jump = l;
+}
+
+/* canon_leaf -- compare a discrete coloring with the first and best leaves. */
+static void canon_leaf(CanonSearch *s, const int *cew, const int *cns,
+                       int depth) {
+    int n = s->n;
+    MazePerm p;
+    PortRows cand;
+    for (int i = 0; i < n; i++) {
+        p.ew[i] = (int8_t)cew[i];
+        p.ns[i] = (int8_t)cns[i];
+    }
+    p.reverse = 0;
+    leaf_rows(s->r, n, &p, &cand);
+
+    if (!s->have_first) {
+        s->first = s->best = cand;
+        s->pfirst = s->pbest = p;
+        memcpy(s->path_first, s->path, depth);
+        memcpy(s->path_best, s->path, depth);
+        s->have_first = 1;
+        return;
+    }
+    if (rows_cmp(&cand, &s->first, n) == 0) {
+        canon_found_auto(s, &p, &s->pfirst, s->path_first, depth);
+        return;
+    }
+    int cmp = rows_cmp(&cand, &s->best, n);
+    if (cmp < 0) {
+        s->best = cand;
+        s->pbest = p;
+        memcpy(s->path_best, s->path, depth);
+    } else if (cmp == 0) {
+        canon_found_auto(s, &p, &s->pbest, s->path_best, depth);
+    }
+}
+
+/* orbit_root -- union-find root with path halving. */
+static int orbit_root(int8_t *parent, int v) {
+    while (parent[v] != v) {
+        parent[v] = parent[(int)parent[parent[v]]];
+        v = parent[v];
+    }
+    return v;
+}
+
+/*
+ * canon_orbits -- orbits of the automorphisms found so far that fix the
+ * first depth vertices of the current path (as union-find parents).
+ */
+static void canon_orbits(const CanonSearch *s, int depth, int8_t *parent) {
+    int nv = 2 * s->n;
+    for (int v = 0; v < nv; v++) parent[v] = (int8_t)v;
+    for (int a = 0; a < s->nauto; a++) {
+        const int8_t *g = s->autos[a];
+        int fixes = 1;
+        for (int l = 0; l < depth && fixes; l++)
+            fixes = g[(int)s->path[l]] == s->path[l];
+        if (!fixes) continue;
+        for (int v = 0; v < nv; v++) {
+            int x = orbit_root(parent, v), y = orbit_root(parent, g[v]);
+            if (x != y) parent[x > y ? x : y] = (int8_t)(x < y ? x : y);
+        }
+    }
+}
+
+/*
+ * canon_search -- refine, then individualize each index of the first
+ * non-singleton color class in turn and recurse.
+ *
+ * Children that an automorphism fixing the current path maps onto an
+ * already searched child are skipped, and a leaf equal to an earlier one
+ * backtracks to where their paths split, so symmetric mazes cost about
+ * one path per orbit instead of one leaf per permutation.
+ */
+static void canon_search(CanonSearch *s, int *cew, int *cns, int depth) {
+    int n = s->n;
+    refine_colors(s->r, n, cew, cns);
+
+    /* Target cell: smallest non-singleton E/W color, else N/S color */
+    int side = -1, color = 0;
+    for (int sd = 0; sd < 2 && side < 0; sd++) {
+        const int *col = sd ? cns : cew;
+        int cnt[MAZE_MAX_NTERM] = {0};
+        for (int i = 0; i < n; i++) cnt[col[i]]++;
+        for (int c = 0; c < n; c++)
+            if (cnt[c] > 1) { side = sd; color = c; break; }
+    }
+    if (side < 0) {
+        canon_leaf(s, cew, cns, depth);
+        return;
+    }
+
+    const int *col = side ? cns : cew;
+    int8_t done[2 * MAZE_MAX_NTERM];
+    int ndone = 0;
+    for (int i = 0; i < n; i++) {
+        if (col[i] != color) continue;
+        int v = side * n + i;
+        if (ndone > 0) {
+            int8_t parent[2 * MAZE_MAX_NTERM];
+            canon_orbits(s, depth, parent);
+            int rv = orbit_root(parent, v), same = 0;
+            for (int k = 0; k < ndone && !same; k++)
+                same = orbit_root(parent, done[k]) == rv;
+            if (same) continue;
+        }
+        int ew[MAZE_MAX_NTERM], ns[MAZE_MAX_NTERM];
+        memcpy(ew, cew, n * sizeof(int));
+        memcpy(ns, cns, n * sizeof(int));
+        individualize(n, side ? ns : ew, i);
+        s->path[depth] = (int8_t)v;
+        canon_search(s, ew, ns, depth + 1);
+        done[ndone++] = (int8_t)v;
+        if (s->jump >= 0) {
+            if (s->jump < depth) return;
+            s->jump = -1;
+        }
+    }
+}
+
+/*
+ * rows_canon -- canonical relabeling of r that keeps E/W indices 0 and 1
+ * fixed.
+ *
+ * Individualization-refinement: starting from color refinement with E/W
+ * 0 and 1 colored apart, every discrete coloring reachable by repeatedly
+ * individualizing an index of the first non-singleton class is a
+ * candidate, and the one with the lexicographically smallest rows wins.
+ * The candidate set depends only on the maze structure, so isomorphic
+ * mazes get the same rows. On return *best holds the smallest rows and
+ * *bp the relabeling (relative to r) that produces them.
+ */
+static void rows_canon(const PortRows *r, int n, PortRows *best, MazePerm *bp) {
+    CanonSearch s;
+    int cew[MAZE_MAX_NTERM], cns[MAZE_MAX_NTERM];
+    for (int i = 0; i < n; i++) {
+        cew[i] = i < 2 ? i : 2;
+        cns[i] = 0;
+    }
+    s.r = r;
+    s.n = n;
+    s.have_first = 0;
+    s.nauto = 0;
+    s.jump = -1;
+    canon_search(&s, cew, cns, 0);
+    memcpy(best->normal, s.best.normal, 4 * n * sizeof(uint64_t));
+    memcpy(best->nx, s.best.nx, n * sizeof(uint64_t));
+    memcpy(best->ny, s.best.ny, n * sizeof(uint64_t));
+    *bp = s.pbest;
+}
+
+/*
+ * canonical_rows -- canonical rows of m and the relabeling that yields them.
+ * Tries the maze as is and with start/goal swapped; keeps the smaller.
+ */
+static void canonical_rows(const Maze *m, PortRows *best, MazePerm *perm) {
+    int n = m->nterm;
+    PortRows base, alt;
+    MazePerm id, swap, p1;
+
+    perm_identity(n, &id);
+    rows_build(m, &id, &base);
+    rows_canon(&base, n, best, perm);
+
+    swap = id;
+    swap.ew[0] = 1;
+    swap.ew[1] = 0;
+    swap.reverse = m->directed;
+    rows_build(m, &swap, &base);
+    rows_canon(&base, n, &alt, &p1);
+    if (rows_cmp(&alt, best, n) < 0) {
+        *best = alt;
+        /* Compose: apply swap first, then p1 */
+        for (int i = 0; i < n; i++) {
+            perm->ew[i] = p1.ew[(int)swap.ew[i]];
+            perm->ns[i] = p1.ns[i];
+        }
+        perm->reverse = swap.reverse;
+    }
+}
+
+/*
+ * maze_permute -- relabel indices (and optionally reverse ports) in-place.
+ * Port data is rebuilt through PortRows, so no heap allocation is needed.
+ */
+void maze_permute(Maze *m, const MazePerm *p) {
+    int n = m->nterm;
+    int n4 = 4 * n;
+    PortRows r;
+    rows_build(m, p, &r);
+    maze_clear(m);
+    for (int s = 0; s < n4; s++) {
+        uint64_t row = r.normal[s];
+        while (row) {
+            int d = __builtin_ctzll(row);
+            row &= row - 1;
+            m->normal_ports[s * n4 + d] = 1;
+        }
+    }
+    for (int si = 0; si < n; si++)
+        for (int di = 0; di < n; di++) {
+            if (si == di) continue;
+            if ((r.nx[si] >> di) & 1) maze_set_nx_port(m, si, di, 1);
+            if ((r.ny[si] >> di) & 1) maze_set_ny_port(m, si, di, 1);
+        }
+}
+
+/*
+ * maze_canonicalize -- relabel the maze into its canonical representative.
+ */
+void maze_canonicalize(Maze *m, MazePerm *perm_out) {
+    if (m->nterm < 2) return;
+    if (m->nterm > MAZE_MAX_NTERM) {
+        maze_normalize(m);
+        return;
+    }
+    PortRows best;
+    MazePerm perm;
+    canonical_rows(m, &best, &perm);
+    maze_permute(m, &perm);
+    if (perm_out) *perm_out = perm;
+}
+
+/*
+ * maze_is_canonical -- compare the maze against its canonical rows.
+ */
+int maze_is_canonical(const Maze *m) {
+    if (m->nterm < 2) return 1;
+    if (m->nterm > MAZE_MAX_NTERM) return maze_is_normalized(m);
+    PortRows best, cur;
+    MazePerm perm, id;
+    canonical_rows(m, &best, &perm);
+    perm_identity(m->nterm, &id);
+    rows_build(m, &id, &cur);
+    return rows_cmp(&cur, &best, m->nterm) == 0;
 }
 
 /* --- Parse helpers --- */
@@ -21,7 +21,8 @@
  *   W[n] @ (bx, by) is identical to E[n] @ (bx-1, by)
  *   S[n] @ (bx, by) is identical to N[n] @ (bx, by-1)
  *
- * Port arrays use one byte per port (0 = absent, 1 = present).
+ * Port arrays use one byte per port (0 = absent, 1 = present). A bit-packed
+ * form (one bit per port, see maze_to_bits) is used for storing many mazes.
  */
 #ifndef MAZE_H
 #define MAZE_H
@@ -79,6 +80,19 @@ static inline uint64_t rng_next(uint64_t *state) {
     return x;
 }
 
+/*
+ * rng_split -- seed for the stream-th independent xorshift64 generator.
+ * Applies the splitmix64 finalizer to seed + (stream+1) * golden ratio,
+ * so nearby seeds and stream numbers give unrelated, non-zero states.
+ */
+static inline uint64_t rng_split(uint64_t seed, int stream) {
+    uint64_t z = seed + (uint64_t)(stream + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return z ? z : 0x9e3779b97f4a7c15ULL;
+}
+
 /* Allocate a new maze with all ports cleared (no connections). */
 Maze *maze_create(int nterm);
 
@@ -91,6 +105,9 @@ void  maze_destroy(Maze *m);
 /* Deep-copy a maze including all port data. */
 Maze *maze_clone(const Maze *m);
 
+/* Copy all port data (and the directed flag) into dst; same nterm required. */
+void  maze_copy(Maze *dst, const Maze *src);
+
 /*
  * Typed port accessors for normal blocks.
  *   sd, si -- source terminal direction (TDIR_*) and index
@@ -134,6 +151,79 @@ void maze_set_from_array(Maze *m, const uint8_t *data);
  */
 void maze_randomize(Maze *m, uint64_t *rng);
 
+/*
+ * maze_reverse_port -- flat index of the reversed port (A->B becomes B->A).
+ * Self-loops map to themselves.
+ */
+int maze_reverse_port(const Maze *m, int idx);
+
+/*
+ * Bit-packed port sets.
+ *
+ * A packed maze is a bitset over the flat port index: port idx is bit
+ * idx % 64 of word idx / 64. Normal ports come first, so the row of
+ * normal source terminal t occupies bits [t*4n, t*4n + 4n), followed by
+ * the nx rows and the ny rows (nterm-1 bits each). Unused high bits of
+ * the last word are always 0, so words can be hashed and compared as is.
+ */
+
+/* maze_bits_nwords -- number of uint64_t words in a packed maze. */
+static inline int maze_bits_nwords(const Maze *m) {
+    return (m->total_nports + 63) / 64;
+}
+
+static inline int maze_bits_get(const uint64_t *bits, int idx) {
+    return (int)((bits[idx >> 6] >> (idx & 63)) & 1);
+}
+
+static inline void maze_bits_set(uint64_t *bits, int idx) {
+    bits[idx >> 6] |= 1ULL << (idx & 63);
+}
+
+static inline void maze_bits_clear(uint64_t *bits, int idx) {
+    bits[idx >> 6] &= ~(1ULL << (idx & 63));
+}
+
+static inline void maze_bits_flip(uint64_t *bits, int idx) {
+    bits[idx >> 6] ^= 1ULL << (idx & 63);
+}
+
+/* maze_to_bits / maze_from_bits -- convert between port arrays and bits. */
+void maze_to_bits(const Maze *m, uint64_t *bits);
+void maze_from_bits(Maze *m, const uint64_t *bits);
+
+/*
+ * maze_bits_row -- destination bitset of normal source terminal t
+ * (terminal = dir * nterm + idx); bit d is the port t -> d. A row is one
+ * word, so m->nterm must not exceed MAZE_MAX_NTERM (asserted).
+ */
+uint64_t maze_bits_row(const Maze *m, const uint64_t *bits, int t);
+
+/* maze_bits_count -- number of active ports (popcount of all words). */
+int maze_bits_count(const uint64_t *bits, int nwords);
+
+/*
+ * maze_bits_out_degree / maze_bits_in_degree -- number of normal ports
+ * leaving / entering terminal t. Built on maze_bits_row, so nterm must
+ * not exceed MAZE_MAX_NTERM either.
+ */
+int maze_bits_out_degree(const Maze *m, const uint64_t *bits, int t);
+int maze_bits_in_degree(const Maze *m, const uint64_t *bits, int t);
+
+/*
+ * maze_bits_make_undirected -- packed equivalent of maze_make_undirected.
+ * The normal block is symmetrized by OR-ing the row matrix with its
+ * word-level transpose; mazes with nterm > MAZE_MAX_NTERM take the
+ * per-port path instead.
+ */
+void maze_bits_make_undirected(const Maze *m, uint64_t *bits);
+
+/* maze_bits_hash -- well-mixed 64-bit hash of a packed maze (may be 0). */
+uint64_t maze_bits_hash(const uint64_t *bits, int nwords);
+
+/* maze_bits_cmp -- memcmp-style comparison of two packed mazes. */
+int maze_bits_cmp(const uint64_t *a, const uint64_t *b, int nwords);
+
 /*
  * maze_fprint -- print maze string representation to the given stream.
  * Format: "normal: E0->N1, ...; nx: E0->E1, ...; ny: N0->N1, ..."
@@ -184,9 +274,62 @@ Maze *maze_parse(int nterm, const char *str);
 void maze_normalize(Maze *m);
 
 /*
- * maze_is_normalized -- return 1 if the maze is already in canonical form.
+ * Largest nterm supported by the canonical-form routines: every normal-block
+ * row of 4*nterm destination bits must fit in one uint64_t.
+ */
+#define MAZE_MAX_NTERM 16
+
+/*
+ * MazePerm -- a relabeling that preserves the shortest path length.
+ *
+ * Fields:
+ *   ew      -- new E/W index of each old E/W index (ew[0], ew[1] in {0, 1})
+ *   ns      -- new N/S index of each old N/S index
+ *   reverse -- 1 if every port is also reversed (A->B becomes B->A)
+ *
+ * Swapping E/W indices 0 and 1 exchanges start and goal. For an undirected
+ * maze this preserves the length as is; a directed maze must also be
+ * reversed so that the old goal->start direction becomes start->goal.
+ */
+typedef struct {
+    int8_t ew[MAZE_MAX_NTERM];
+    int8_t ns[MAZE_MAX_NTERM];
+    int reverse;
+} MazePerm;
+
+/* maze_permute -- apply a relabeling to the maze in-place. */
+void maze_permute(Maze *m, const MazePerm *p);
+
+/*
+ * maze_canonicalize -- replace the maze by the canonical representative
+ * of its symmetry class.
+ *
+ * The symmetry class is generated by permutations of E/W indices 2+, all
+ * permutations of N/S indices, and the start/goal swap (0<->1, plus port
+ * reversal when m->directed). Indices are split into cells by color
+ * refinement on port degrees; cells are then broken up by individualizing
+ * one index at a time and refining again, and the discrete labeling with
+ * the lexicographically smallest port matrix is kept. Automorphisms found
+ * along the way prune symmetric branches, so highly symmetric mazes (such
+ * as the empty and the fully connected maze) stay cheap.
+ *
+ * If perm_out is non-NULL it receives the relabeling that was applied.
+ * Mazes with nterm > MAZE_MAX_NTERM fall back to maze_normalize() and
+ * leave perm_out untouched.
+ */
+void maze_canonicalize(Maze *m, MazePerm *perm_out);
+
+/*
+ * maze_is_canonical -- return 1 if maze_canonicalize() would leave the
+ * maze unchanged, 0 otherwise. Does not modify the maze.
+ */
+int maze_is_canonical(const Maze *m);
+
+/*
+ * maze_is_normalized -- return 1 if the maze is already in normalized form.
  *
- * Clones the maze, normalizes the clone, and compares port arrays.
+ * Checks that the normalization mapping sends every active port to an
+ * active port, without copying the maze.
  * Returns 1 if normalize(m) == m, 0 otherwise.
  */
 int maze_is_normalized(const Maze *m);
@@ -12,6 +12,13 @@
  *   2. Abstract terminal reachability: a tiny directed graph (2*nterm nodes)
  *      checks whether the goal is reachable from the start at the terminal
  *      type level. This subsumes start-exit and goal-entry checks.
+ *   3. Dead ports: a port whose abstract source is unreachable from the
+ *      start, or whose abstract destination cannot reach the goal, never
+ *      lies on a path. A combination containing one has the length of a
+ *      smaller combination that is evaluated anyway, so it is skipped.
+ *   4. Branch-and-bound: combinations are walked as a tree of growing port
+ *      sets. Adding a port never lengthens the shortest path, so a subtree
+ *      whose root is solvable with length <= best is skipped entirely.
  *
  * Progress and new-best discoveries are logged to stderr so that stdout
  * remains clean for the final result output.
@@ -21,8 +28,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-/* SIGINT handling for graceful Ctrl+C exit in random search */
+/* SIGINT handling for graceful Ctrl+C exit in random and top-down search */
 static volatile sig_atomic_t interrupted = 0;
 static void sigint_handler(int sig) { (void)sig; interrupted = 1; }
 
@@ -72,7 +88,61 @@ static int is_self_loop_port(const Maze *m, int idx) {
 }
 
 /*
- * has_abstract_path -- check reachability in the abstract terminal graph.
+ * abstract_node -- map a normal-block terminal (dir * nterm + idx) to its
+ * abstract node: E/W terminals with index j -> node j, N/S -> nterm + j.
+ */
+static int abstract_node(int n, int terminal) {
+    return (terminal / n < 2) ? (terminal % n) : n + (terminal % n);
+}
+
+/*
+ * port_abstract_edge -- abstract source and destination of a flat port.
+ * nx ports connect E nodes, ny ports connect N nodes.
+ */
+static void port_abstract_edge(const Maze *m, int idx, int *asrc, int *adst) {
+    int n = m->nterm;
+    if (idx < m->normal_nports) {
+        int n4 = 4 * n;
+        *asrc = abstract_node(n, idx / n4);
+        *adst = abstract_node(n, idx % n4);
+        return;
+    }
+    idx -= m->normal_nports;
+    int base = 0;
+    if (idx >= m->nx_nports) {
+        idx -= m->nx_nports;
+        base = n;
+    }
+    int si = idx / (n - 1);
+    int adj = idx % (n - 1);
+    *asrc = base + si;
+    *adst = base + (adj < si ? adj : adj + 1);
+}
+
+/*
+ * bitmask_closure -- all nodes reachable from `seed` along adj[].
+ * BFS over uint64_t bitmasks (no heap allocation).
+ */
+static uint64_t bitmask_closure(const uint64_t *adj, uint64_t seed) {
+    uint64_t reachable = seed;
+    uint64_t frontier = reachable;
+    while (frontier) {
+        uint64_t next = 0;
+        uint64_t f = frontier;
+        while (f) {
+            int bit = __builtin_ctzll(f);
+            f &= f - 1;
+            next |= adj[bit] & ~reachable;
+        }
+        reachable |= next;
+        frontier = next;
+    }
+    return reachable;
+}
+
+/*
+ * abstract_reach -- forward and backward reachability in the abstract
+ * terminal graph.
  *
  * The abstract graph has 2*nterm nodes representing canonical state types:
  *   (E, i) for i=0..nterm-1: indices 0..nterm-1
@@ -89,69 +159,773 @@ static int is_self_loop_port(const Maze *m, int idx) {
  *
  * Start: node 0 = (E, 0).  Goal: node 1 = (E, 1).
  *
- * BFS from start node using uint64_t bitmasks (no heap allocation).
- * Returns 1 if goal is reachable, 0 otherwise.
+ * On return *fwd holds the nodes reachable from the start and *bwd the
+ * nodes from which the goal is reachable. Either pointer may be NULL.
  */
-static int has_abstract_path(const Maze *m) {
+static void abstract_reach(const Maze *m, uint64_t *fwd, uint64_t *bwd) {
     int n = m->nterm;
     int n4 = 4 * n;
-    uint64_t adj[64];
+    uint64_t adj[64], radj[64];
     memset(adj, 0, sizeof(adj));
+    memset(radj, 0, sizeof(radj));
 
     /* Normal block ports */
     for (int st = 0; st < n4; st++) {
-        int asrc = (st / n < 2) ? (st % n) : n + (st % n);
+        int asrc = abstract_node(n, st);
         for (int dt = 0; dt < n4; dt++) {
             if (st == dt) continue;
             if (!m->normal_ports[st * n4 + dt]) continue;
-            int adst = (dt / n < 2) ? (dt % n) : n + (dt % n);
+            int adst = abstract_node(n, dt);
             adj[asrc] |= 1ULL << adst;
+            radj[adst] |= 1ULL << asrc;
         }
     }
 
     /* nx ports: E[si] -> E[di], abstract node si -> di */
     for (int si = 0; si < n; si++)
         for (int di = 0; di < n; di++)
-            if (si != di && maze_nx_port(m, si, di))
+            if (si != di && maze_nx_port(m, si, di)) {
                 adj[si] |= 1ULL << di;
+                radj[di] |= 1ULL << si;
+            }
 
     /* ny ports: N[si] -> N[di], abstract node (n+si) -> (n+di) */
     for (int si = 0; si < n; si++)
         for (int di = 0; di < n; di++)
-            if (si != di && maze_ny_port(m, si, di))
+            if (si != di && maze_ny_port(m, si, di)) {
                 adj[n + si] |= 1ULL << (n + di);
+                radj[n + di] |= 1ULL << (n + si);
+            }
 
-    /* BFS from node 0 (E, 0) */
-    uint64_t reachable = 1ULL << 0;
-    uint64_t frontier = reachable;
-    while (frontier) {
-        uint64_t next = 0;
-        uint64_t f = frontier;
-        while (f) {
-            int bit = __builtin_ctzll(f);
-            f &= f - 1;
-            next |= adj[bit] & ~reachable;
+    if (fwd) *fwd = bitmask_closure(adj, 1ULL << 0);
+    if (bwd) *bwd = bitmask_closure(radj, 1ULL << 1);
+}
+
+/*
+ * has_abstract_path -- check reachability in the abstract terminal graph.
+ * Returns 1 if node 1 (E, 1) is reachable from node 0 (E, 0), 0 otherwise.
+ */
+static int has_abstract_path(const Maze *m) {
+    uint64_t fwd;
+    abstract_reach(m, &fwd, NULL);
+    return (fwd >> 1) & 1;
+}
+
+/*
+ * AbstractCounts -- multiplicity of every abstract edge a -> b (index
+ * a * nnodes + b) over the active ports of one maze, with the abstract
+ * adjacency and reachability it induces. Many ports share an abstract
+ * edge, so removing ports only changes the abstract graph when the count
+ * of one of their edges drops to zero.
+ */
+typedef struct {
+    int nnodes;                 /* 2 * nterm */
+    uint16_t count[64 * 64];
+    uint64_t adj[64];
+    uint64_t fwd, bwd;          /* reachable from start / reaching the goal */
+    uint64_t cut_known[64];     /* memo bit e: cut[] is valid for edge e */
+    uint64_t cut[64];           /* memo bit e: losing edge e disconnects */
+} AbstractCounts;
+
+/*
+ * abstract_counts_build -- count the abstract edges of the active ports in
+ * bits; port_aedge maps a flat port index to its abstract edge.
+ */
+static void abstract_counts_build(AbstractCounts *ac, const uint64_t *bits, int nwords,
+                                  const uint16_t *port_aedge, int nnodes) {
+    ac->nnodes = nnodes;
+    memset(ac->count, 0, (size_t)nnodes * nnodes * sizeof(uint16_t));
+    memset(ac->adj, 0, sizeof(ac->adj));
+    memset(ac->cut_known, 0, sizeof(ac->cut_known));
+    for (int w = 0; w < nwords; w++)
+        for (uint64_t b = bits[w]; b; b &= b - 1) {
+            int e = port_aedge[w * 64 + __builtin_ctzll(b)];
+            if (ac->count[e]++ == 0)
+                ac->adj[e / nnodes] |= 1ULL << (e % nnodes);
+        }
+    uint64_t radj[64];
+    memset(radj, 0, sizeof(radj));
+    for (int a = 0; a < nnodes; a++)
+        for (uint64_t b = ac->adj[a]; b; b &= b - 1)
+            radj[__builtin_ctzll(b)] |= 1ULL << a;
+    ac->fwd = bitmask_closure(ac->adj, 1ULL << 0);
+    ac->bwd = bitmask_closure(radj, 1ULL << 1);
+}
+
+/* abstract_counts_reach_without -- goal reachable without edges e[0..ne). */
+static int abstract_counts_reach_without(const AbstractCounts *ac, const int *e, int ne) {
+    uint64_t adj[64];
+    memcpy(adj, ac->adj, ac->nnodes * sizeof(uint64_t));
+    for (int k = 0; k < ne; k++)
+        adj[e[k] / ac->nnodes] &= ~(1ULL << (e[k] % ac->nnodes));
+    return (bitmask_closure(adj, 1ULL << 0) >> 1) & 1;
+}
+
+/*
+ * abstract_counts_connected_without -- whether the goal stays abstractly
+ * reachable after removing one port on abstract edge e1 and, if e2 >= 0,
+ * another on e2. An edge whose count stays positive, a self-loop, or an
+ * edge off every start-to-goal abstract path cannot matter; a single lost
+ * edge that does is answered from a per-maze memo.
+ */
+static int abstract_counts_connected_without(AbstractCounts *ac, int e1, int e2) {
+    int n2 = ac->nnodes;
+    int gone[2], ngone = 0;
+    ac->count[e1]--;
+    if (e2 >= 0) ac->count[e2]--;
+    int cand[2] = {e1, e2};
+    for (int k = 0; k < 2; k++) {
+        int e = cand[k];
+        if (e < 0 || ac->count[e] != 0) continue;
+        if (k == 1 && e == e1) continue;
+        int a = e / n2, b = e % n2;
+        if (a == b || !((ac->fwd >> a) & 1) || !((ac->bwd >> b) & 1)) continue;
+        gone[ngone++] = e;
+    }
+    ac->count[e1]++;
+    if (e2 >= 0) ac->count[e2]++;
+
+    int connected = (ac->fwd >> 1) & 1;
+    if (!connected || ngone == 0) return connected;
+    if (ngone == 2) return abstract_counts_reach_without(ac, gone, 2);
+
+    int e = gone[0];
+    uint64_t bit = 1ULL << (e & 63);
+    if (!(ac->cut_known[e >> 6] & bit)) {
+        ac->cut_known[e >> 6] |= bit;
+        if (!abstract_counts_reach_without(ac, &e, 1))
+            ac->cut[e >> 6] |= bit;
+        else
+            ac->cut[e >> 6] &= ~bit;
+    }
+    return !(ac->cut[e >> 6] & bit);
+}
+
+/*
+ * is_dead_port -- check whether a port can lie on a start->goal path.
+ *
+ * A port whose abstract source is not reachable from the start, or whose
+ * abstract destination cannot reach the goal, is never used by any path.
+ * Such a maze has the same shortest path as the maze without the port.
+ */
+static int is_dead_port(const Maze *m, int idx, uint64_t fwd, uint64_t bwd) {
+    int asrc, adst;
+    port_abstract_edge(m, idx, &asrc, &adst);
+    return !((fwd >> asrc) & 1) || !((bwd >> adst) & 1);
+}
+
+/* --- Length cache keyed by reachable core --- */
+
+/*
+ * The core of a maze is its set of live ports: abstract source reachable
+ * from the start and abstract destination reaching the goal. Dead ports
+ * never lie on a path, so every maze with the same core has the same
+ * shortest path length. Mazes that differ only in irrelevant ports are
+ * common in all strategies, and the cache turns repeated solves of one
+ * core into a lookup.
+ *
+ * The cache is a set-associative table of LC_WAYS entries per set with a
+ * CLOCK hand per set, shared by all threads under LC_STRIPES striped
+ * locks. Entries hold two independent 64-bit hashes of the core (nterm
+ * mixed in) instead of the core itself, so a wrong length needs a 128-bit
+ * collision.
+ */
+#define LC_WAYS      8
+#define LC_STRIPES   64
+#define LC_MAX_WORDS ((4 * 4 * MAZE_MAX_NTERM * MAZE_MAX_NTERM + \
+                       2 * MAZE_MAX_NTERM * (MAZE_MAX_NTERM - 1) + 63) / 64)
+
+typedef struct {
+    uint64_t h1, h2;            /* both 0 = empty */
+    int32_t  len;
+    uint8_t  ref;               /* CLOCK reference bit */
+} LCEntry;
+
+typedef struct {
+    LCEntry *entries;           /* nsets * LC_WAYS */
+    uint8_t *hands;             /* CLOCK hand per set */
+    size_t nsets;               /* power of 2 */
+    pthread_mutex_t locks[LC_STRIPES];
+    atomic_ullong hits;
+    atomic_ullong misses;
+} LengthCache;
+
+static LengthCache *len_cache;
+
+/* Result database shared by all strategies (see quizmaster_set_result_db) */
+static ResultDB *result_db;
+static atomic_ullong db_hits, db_misses;
+
+void quizmaster_set_result_db(ResultDB *db) {
+    result_db = db;
+    atomic_store(&db_hits, 0);
+    atomic_store(&db_misses, 0);
+}
+
+/*
+ * quizmaster_set_length_cache -- replace the shared length cache by one of
+ * about `bytes` bytes, or disable it if bytes is 0.
+ */
+void quizmaster_set_length_cache(size_t bytes) {
+    if (len_cache) {
+        for (int i = 0; i < LC_STRIPES; i++)
+            pthread_mutex_destroy(&len_cache->locks[i]);
+        free(len_cache->entries);
+        free(len_cache->hands);
+        free(len_cache);
+        len_cache = NULL;
+    }
+    size_t nsets = 1;
+    while (nsets * 2 * LC_WAYS * sizeof(LCEntry) <= bytes) nsets *= 2;
+    if (bytes == 0 || nsets < LC_STRIPES) return;
+
+    len_cache = calloc(1, sizeof(LengthCache));
+    len_cache->nsets = nsets;
+    len_cache->entries = calloc(nsets * LC_WAYS, sizeof(LCEntry));
+    len_cache->hands = calloc(nsets, 1);
+    for (int i = 0; i < LC_STRIPES; i++)
+        pthread_mutex_init(&len_cache->locks[i], NULL);
+}
+
+/*
+ * quizmaster_length_cache_report -- print hit statistics of the length
+ * cache and the result database to stderr (nothing if both are disabled).
+ */
+void quizmaster_length_cache_report(void) {
+    if (result_db) {
+        unsigned long long hits = atomic_load(&db_hits);
+        unsigned long long misses = atomic_load(&db_misses);
+        fprintf(stderr, "Result database: %llu hits, %llu misses (%.1f%% hit rate)\n",
+                hits, misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+    }
+    if (!len_cache) return;
+    unsigned long long hits = atomic_load(&len_cache->hits);
+    unsigned long long misses = atomic_load(&len_cache->misses);
+    fprintf(stderr, "Length cache: %zu entries, %llu hits, %llu misses (%.1f%% hit rate)\n",
+            len_cache->nsets * LC_WAYS, hits, misses,
+            hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+}
+
+/* lc_hash2 -- second hash of a core, independent of maze_bits_hash. */
+static uint64_t lc_hash2(const uint64_t *bits, int nwords, int nterm) {
+    uint64_t h = 0x6a09e667f3bcc909ULL ^ (uint64_t)nterm;
+    for (int i = 0; i < nwords; i++) {
+        h = (h ^ bits[i]) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+/* lc_store -- record a length in its set, evicting by CLOCK. */
+static void lc_store(LengthCache *lc, uint64_t h1, uint64_t h2, int len) {
+    size_t si = (size_t)(h1 >> 7) & (lc->nsets - 1);
+    LCEntry *set = lc->entries + si * LC_WAYS;
+    pthread_mutex_t *lock = &lc->locks[si & (LC_STRIPES - 1)];
+    pthread_mutex_lock(lock);
+    for (;;) {
+        /* Evict the first entry past the hand without a reference */
+        LCEntry *e = &set[lc->hands[si]];
+        lc->hands[si] = (uint8_t)((lc->hands[si] + 1) % LC_WAYS);
+        if (e->ref && e->h1) {
+            e->ref = 0;
+            continue;
+        }
+        e->h1 = h1;
+        e->h2 = h2;
+        e->len = len;
+        e->ref = 1;
+        break;
+    }
+    pthread_mutex_unlock(lock);
+}
+
+/* lc_lookup -- cached length for (h1, h2): returns 1 and sets *len on a hit. */
+static int lc_lookup(LengthCache *lc, uint64_t h1, uint64_t h2, int *len) {
+    size_t si = (size_t)(h1 >> 7) & (lc->nsets - 1);
+    LCEntry *set = lc->entries + si * LC_WAYS;
+    pthread_mutex_t *lock = &lc->locks[si & (LC_STRIPES - 1)];
+    int found = 0;
+    pthread_mutex_lock(lock);
+    for (int i = 0; i < LC_WAYS; i++)
+        if (set[i].h1 == h1 && set[i].h2 == h2) {
+            *len = set[i].len;
+            set[i].ref = 1;
+            found = 1;
+            break;
+        }
+    pthread_mutex_unlock(lock);
+    atomic_fetch_add_explicit(found ? &lc->hits : &lc->misses, 1, memory_order_relaxed);
+    return found;
+}
+
+/*
+ * LengthKey -- where a solved length goes: the length cache hashes and
+ * the result database key of one maze (see maze_length_lookup).
+ */
+typedef struct {
+    uint64_t h1, h2;
+    uint64_t key[LC_MAX_WORDS];
+} LengthKey;
+
+/*
+ * maze_core -- the packed ports of m minus its dead ports, given the
+ * abstract reach fwd/bwd of m. Mazes with equal cores have equal lengths.
+ */
+static void maze_core(const Maze *m, uint64_t fwd, uint64_t bwd, uint64_t *core) {
+    int nwords = maze_bits_nwords(m);
+    maze_to_bits(m, core);
+    for (int w = 0; w < nwords; w++)
+        for (uint64_t b = core[w]; b; b &= b - 1) {
+            int idx = w * 64 + __builtin_ctzll(b);
+            if (is_dead_port(m, idx, fwd, bwd))
+                maze_bits_clear(core, idx);
+        }
+}
+
+/*
+ * core_db_key -- result database key of a core of m: the canonical core,
+ * built in `scratch` (a maze of m's nterm). An undirected core keeps both
+ * port directions.
+ */
+static void core_db_key(const Maze *m, const uint64_t *core, Maze *scratch,
+                        uint64_t *key) {
+    scratch->directed = m->directed;
+    maze_from_bits(scratch, core);
+    if (!m->directed) maze_make_undirected(scratch);
+    maze_canonicalize(scratch, NULL);
+    maze_to_bits(scratch, key);
+}
+
+/*
+ * maze_db_key -- result database key of m, as maze_length_lookup builds
+ * it. Returns 0 if m has no abstract path; such mazes are never stored.
+ */
+static int maze_db_key(const Maze *m, Maze *scratch, uint64_t *key) {
+    uint64_t fwd, bwd;
+    abstract_reach(m, &fwd, &bwd);
+    if (!((fwd >> 1) & 1)) return 0;
+    uint64_t core[LC_MAX_WORDS];
+    maze_core(m, fwd, bwd, core);
+    core_db_key(m, core, scratch, key);
+    return 1;
+}
+
+/*
+ * maze_length_lookup -- the part of maze_length before the solver.
+ * Returns 1 and sets *len if the length is known without solving (no
+ * abstract path, or a cache or database hit); otherwise returns 0 with
+ * lk ready for maze_length_store. `scratch` is a caller-owned maze of
+ * m's nterm for the database key.
+ */
+static int maze_length_lookup(const Maze *m, Maze *scratch, LengthKey *lk, int *len) {
+    uint64_t fwd, bwd;
+    abstract_reach(m, &fwd, &bwd);
+    if (!((fwd >> 1) & 1)) {
+        *len = -1;
+        return 1;
+    }
+
+    LengthCache *lc = len_cache;
+    ResultDB *db = result_db;
+    int nwords = maze_bits_nwords(m);
+    uint64_t core[LC_MAX_WORDS];
+    if (lc || db) maze_core(m, fwd, bwd, core);
+    if (lc) {
+        lk->h1 = maze_bits_hash(core, nwords) ^ ((uint64_t)m->nterm << 56);
+        lk->h2 = lc_hash2(core, nwords, m->nterm);
+        lk->h1 |= 1;            /* never look like an empty entry */
+        if (lc_lookup(lc, lk->h1, lk->h2, len)) return 1;
+    }
+    if (db) {
+        core_db_key(m, core, scratch, lk->key);
+        int found = resultdb_lookup(db, lk->key, len);
+        atomic_fetch_add_explicit(found ? &db_hits : &db_misses, 1, memory_order_relaxed);
+        if (found) {
+            if (lc) lc_store(lc, lk->h1, lk->h2, *len);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* maze_length_store -- record a solved length under lk. */
+static void maze_length_store(const LengthKey *lk, int len) {
+    if (result_db) resultdb_insert(result_db, lk->key, len);
+    if (len_cache) lc_store(len_cache, lk->h1, lk->h2, len);
+}
+
+/*
+ * maze_length -- shortest path length of m, or -1 if it has no path.
+ * Abstractly disconnected mazes are rejected before the solver runs. The
+ * reachable core is then looked up in the length cache and in the result
+ * database (as a canonical maze), whichever are enabled, and a solved
+ * length is recorded in both. `scratch` is as for maze_length_lookup.
+ */
+static int maze_length(const Maze *m, Maze *scratch, int use_bfs) {
+    LengthKey lk;
+    int len;
+    if (maze_length_lookup(m, scratch, &lk, &len)) return len;
+
+    if (use_bfs) {
+        len = solve_bfs_len(m);
+    } else {
+        State *path = NULL;
+        int path_len = 0;
+        len = solve(m, &path, &path_len);
+        free(path);
+    }
+    maze_length_store(&lk, len);
+    return len;
+}
+
+/*
+ * maze_length_batch -- maze_length of n <= SOLVE_BATCH_MAX mazes of one
+ * nterm. The mazes that miss the cache and database are solved together
+ * by solve_bfs_batch in BFS mode, one at a time otherwise.
+ */
+static void maze_length_batch(Maze *const *ms, int n, Maze *scratch, int use_bfs,
+                              int *lens) {
+    if (!use_bfs) {
+        for (int i = 0; i < n; i++)
+            lens[i] = maze_length(ms[i], scratch, 0);
+        return;
+    }
+    LengthKey lks[SOLVE_BATCH_MAX];
+    const Maze *miss[SOLVE_BATCH_MAX];
+    int miss_idx[SOLVE_BATCH_MAX], miss_len[SOLVE_BATCH_MAX];
+    int nmiss = 0;
+    for (int i = 0; i < n; i++)
+        if (!maze_length_lookup(ms[i], scratch, &lks[nmiss], &lens[i])) {
+            miss[nmiss] = ms[i];
+            miss_idx[nmiss++] = i;
+        }
+    if (nmiss == 1)
+        miss_len[0] = solve_bfs_len(miss[0]);
+    else if (nmiss > 1)
+        solve_bfs_batch(miss, nmiss, miss_len);
+    for (int j = 0; j < nmiss; j++) {
+        lens[miss_idx[j]] = miss_len[j];
+        maze_length_store(&lks[j], miss_len[j]);
+    }
+}
+
+/*
+ * subtree_combos -- number of in-range combinations below a node.
+ *
+ * A node at depth `depth` whose children pick indices from next..ncand-1
+ * has C(ncand-next, j) descendants with depth+j ports. Only descendants
+ * with min_aport <= depth+j <= max_aport count as combinations.
+ */
+static uint64_t subtree_combos(int ncand, int next, int depth,
+                               int min_aport, int max_aport) {
+    uint64_t sum = 0;
+    for (int j = 1; depth + j <= max_aport; j++)
+        if (depth + j >= min_aport)
+            sum += binomial(ncand - next, j);
+    return sum;
+}
+
+/*
+ * BBCtx -- state shared by the depth-first walk of quizmaster_search.
+ *
+ * combo[0..depth-1] holds the candidate indices of the current node.
+ * Counters are in units of combinations (nodes with min_aport..max_aport
+ * ports), except visited which counts every node entered.
+ */
+typedef struct {
+    Maze *m;
+    Maze *scratch;      /* for maze_length */
+    const int *candidates;
+    int *combo;
+    int ncand;
+    int min_aport;
+    int max_aport;
+    int max_len;
+    int use_bfs;
+    int directed;
+    int done;           /* set when max_len is reached */
+
+    Maze  *best;
+    int    best_len;
+    State *best_path;
+    int    best_path_len;
+
+    uint64_t total_combos;
+    uint64_t visited;
+    uint64_t evaluated;
+    uint64_t solved;
+    uint64_t pruned;
+    uint64_t norm_pruned;
+    uint64_t dead_pruned;
+    uint64_t bb_pruned;
+
+    int shard;          /* this run covers shard `shard` of `nshards` */
+    int nshards;
+    ShardResult *res;   /* per-k counters and histograms (NULL = none) */
+    uint64_t *cut_k;    /* scratch for bb_cut, max_aport + 1 entries */
+    Maze *batch[SOLVE_BATCH_MAX];   /* leaves solved together (bb_leaves) */
+} BBCtx;
+
+/*
+ * bb_prefix_owned -- whether the subtree of the depth-2 node {a, b}
+ * belongs to this shard. Depth-2 nodes are numbered in walk order.
+ */
+static int bb_prefix_owned(const BBCtx *c, int a, int b) {
+    if (c->nshards <= 1) return 1;
+    uint64_t idx = (uint64_t)a * c->ncand - (uint64_t)a * (a + 1) / 2 +
+                   (uint64_t)(b - a - 1);
+    return (int)(idx % (uint64_t)c->nshards) == c->shard;
+}
+
+/*
+ * bb_owned_combos -- add to per_k[k] the combinations of k ports in range
+ * that lie strictly below the node combo[0..depth-1] (children from
+ * `next` on) and belong to this shard. Uses combo[depth..] as scratch.
+ */
+static void bb_owned_combos(BBCtx *c, int depth, int next, uint64_t *per_k) {
+    if (depth >= c->max_aport) return;
+    if (c->nshards <= 1 || depth >= 2) {
+        for (int j = 1; depth + j <= c->max_aport; j++)
+            if (depth + j >= c->min_aport)
+                per_k[depth + j] += binomial(c->ncand - next, j);
+        return;
+    }
+    for (int i = next; i < c->ncand; i++) {
+        c->combo[depth] = i;
+        if (depth + 1 == 2 && !bb_prefix_owned(c, c->combo[0], i))
+            continue;
+        if (depth + 1 >= c->min_aport && (depth + 1 == 2 || c->shard == 0))
+            per_k[depth + 1]++;
+        bb_owned_combos(c, depth + 1, i + 1, per_k);
+    }
+}
+
+/* bb_cut -- account for the subtree below a node cut by branch-and-bound. */
+static void bb_cut(BBCtx *c, int depth, int next) {
+    if (c->nshards <= 1 && !c->res) {
+        c->bb_pruned += subtree_combos(c->ncand, next, depth,
+                                       c->min_aport, c->max_aport);
+        return;
+    }
+    memset(c->cut_k, 0, (c->max_aport + 1) * sizeof(uint64_t));
+    bb_owned_combos(c, depth, next, c->cut_k);
+    for (int k = 0; k <= c->max_aport; k++) {
+        c->bb_pruned += c->cut_k[k];
+        if (c->res) c->res->counts[k * SHARD_NCOUNTS + SHARD_CUT] += c->cut_k[k];
+    }
+}
+
+/* bb_count -- bump a per-k counter of the shard result, if any. */
+static inline void bb_count(BBCtx *c, int k, int which) {
+    if (c->res) c->res->counts[k * SHARD_NCOUNTS + which]++;
+}
+
+/* Results of bb_check */
+#define BB_UNREACHABLE (-1)     /* no abstract start->goal path */
+#define BB_NO_EVAL     0        /* reachable, but not a node to evaluate */
+#define BB_EVAL        1        /* reachable node in range to evaluate */
+
+/*
+ * bb_check -- set up the maze of node combo[0..depth-1] in c->m, count
+ * it and run the cheap prunings. Returns BB_UNREACHABLE, BB_NO_EVAL or
+ * BB_EVAL.
+ */
+static int bb_check(BBCtx *c, int depth) {
+    Maze *m = c->m;
+    int owned = c->nshards <= 1 || depth >= 2 || c->shard == 0;
+    int in_range = owned && depth >= c->min_aport;
+
+    c->visited++;
+
+    /* Set up the maze for this node */
+    maze_clear(m);
+    for (int i = 0; i < depth; i++)
+        maze_set_port(m, c->candidates[c->combo[i]], 1);
+    if (!c->directed)
+        maze_make_undirected(m);
+
+    if (in_range) {
+        c->evaluated++;
+        bb_count(c, depth, SHARD_EVALUATED);
+    }
+
+    /* Pruning 1: abstract terminal reachability (no solve, no cut) */
+    uint64_t fwd, bwd;
+    abstract_reach(m, &fwd, &bwd);
+    if (!((fwd >> 1) & 1)) {
+        if (in_range) {
+            c->pruned++;
+            bb_count(c, depth, SHARD_PRUNED);
+        }
+        return BB_UNREACHABLE;
+    }
+
+    /* Pruning 2: canonical form -- only one member per symmetry class */
+    if (!in_range) return BB_NO_EVAL;
+    if (!maze_is_canonical(m)) {
+        c->norm_pruned++;
+        bb_count(c, depth, SHARD_SKIPPED);
+        return BB_NO_EVAL;
+    }
+
+    /*
+     * Pruning 3: dead ports -- the maze without them has the same length
+     * and is itself a node in range, so this node need not be evaluated.
+     */
+    int ndead = 0;
+    for (int i = 0; i < depth; i++)
+        if (is_dead_port(m, c->candidates[c->combo[i]], fwd, bwd))
+            ndead++;
+    if (ndead > 0 && depth - ndead >= c->min_aport) {
+        c->dead_pruned++;
+        bb_count(c, depth, SHARD_SKIPPED);
+        return BB_NO_EVAL;
+    }
+    return BB_EVAL;
+}
+
+/*
+ * bb_record -- account for the solved maze m of a node at depth and, if it
+ * was evaluated, record its length and update the best. Returns nonzero
+ * when max_len is reached.
+ */
+static int bb_record(BBCtx *c, const Maze *m, int depth, int need_eval, int len) {
+    c->solved++;
+    if (!need_eval) return 0;
+    if (c->res) {
+        bb_count(c, depth, SHARD_SOLVED);
+        c->res->hist[depth * SHARD_HIST_LEN +
+                     (len < SHARD_HIST_LEN ? len : SHARD_HIST_LEN - 1)]++;
+    }
+    if (len <= c->best_len) return 0;
+
+    State *tmp_path = NULL;
+    int tmp_path_len = 0;
+    if (c->use_bfs)
+        solve_bfs(m, &tmp_path, &tmp_path_len);
+    else
+        solve(m, &tmp_path, &tmp_path_len);
+    c->best_len = len;
+    if (c->best) maze_copy(c->best, m);
+    else c->best = maze_clone(m);
+    free(c->best_path);
+    c->best_path = tmp_path;
+    c->best_path_len = tmp_path_len;
+    fprintf(stderr, "[k=%d, node %llu] new best: length %d\n",
+            depth, (unsigned long long)c->visited, c->best_len);
+    fprintf(stderr, "  ");
+    maze_fprint(stderr, c->best);
+    fprintf(stderr, "  ");
+    path_fprint(stderr, c->best_path, c->best_path_len);
+    if (c->max_len > 0 && c->best_len >= c->max_len) {
+        c->done = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/* bb_progress -- progress line every 10000 visited nodes. */
+static void bb_progress(BBCtx *c, int depth) {
+    if (c->visited % 10000 != 0) return;
+    uint64_t covered = c->evaluated + c->bb_pruned;
+    fprintf(stderr, "[k=%d] progress: %llu/%llu (%.1f%%) best=%d solved=%llu pruned=%llu norm_pruned=%llu dead_pruned=%llu bb_pruned=%llu\n",
+            depth,
+            (unsigned long long)covered,
+            (unsigned long long)c->total_combos,
+            (double)covered / (double)c->total_combos * 100.0,
+            c->best_len,
+            (unsigned long long)c->solved,
+            (unsigned long long)c->pruned,
+            (unsigned long long)c->norm_pruned,
+            (unsigned long long)c->dead_pruned,
+            (unsigned long long)c->bb_pruned);
+}
+
+/*
+ * bb_leaves -- visit the children of a node whose children are all leaves
+ * (they have max_aport ports). The leaves to evaluate differ from each
+ * other in one port, so they are solved in batches of SOLVE_BATCH_MAX by
+ * maze_length_batch and then recorded in walk order.
+ */
+static void bb_leaves(BBCtx *c, int depth, int next) {
+    int nb = 0;
+    int lens[SOLVE_BATCH_MAX];
+    for (int i = next; i < c->ncand && !c->done; i++) {
+        c->combo[depth] = i;
+        if (bb_check(c, depth + 1) == BB_EVAL)
+            maze_copy(c->batch[nb++], c->m);
+        bb_progress(c, depth + 1);
+
+        if (nb == SOLVE_BATCH_MAX || (nb > 0 && i + 1 == c->ncand)) {
+            maze_length_batch(c->batch, nb, c->scratch, c->use_bfs, lens);
+            for (int j = 0; j < nb; j++)
+                if (bb_record(c, c->batch[j], depth + 1, 1,
+                              lens[j] < 0 ? 0 : lens[j]))
+                    return;
+            nb = 0;
+        }
+    }
+}
+
+/*
+ * bb_node -- visit one node of the combination tree, then its children.
+ *
+ * The node is the maze made of ports combo[0..depth-1]; its children add
+ * one more candidate with index >= next. Adding ports never lengthens the
+ * shortest path of a solvable maze, so once a node is solvable with a
+ * length not exceeding best_len, no descendant can beat the best and the
+ * whole subtree is cut.
+ */
+static void bb_node(BBCtx *c, int depth, int next) {
+    int has_children = depth < c->max_aport && next < c->ncand;
+    int st = bb_check(c, depth);
+
+    /* Internal nodes are solved too: their length bounds the subtree */
+    if (st != BB_UNREACHABLE && (st == BB_EVAL || has_children)) {
+        int len = maze_length(c->m, c->scratch, c->use_bfs);
+        if (len < 0) len = 0;
+        if (bb_record(c, c->m, depth, st == BB_EVAL, len)) return;
+
+        /* Pruning 4: branch-and-bound -- supersets cannot beat best_len */
+        if (len > 0 && len <= c->best_len && has_children) {
+            bb_cut(c, depth, next);
+            return;
         }
-        reachable |= next;
-        frontier = next;
     }
 
-    /* Check if node 1 (E, 1) is reachable */
-    return (reachable >> 1) & 1;
+    bb_progress(c, depth);
+
+    if (!has_children) return;
+    if (c->use_bfs && depth + 1 == c->max_aport && depth >= 2) {
+        bb_leaves(c, depth, next);
+        return;
+    }
+    for (int i = next; i < c->ncand && !c->done; i++) {
+        if (depth == 1 && !bb_prefix_owned(c, c->combo[0], i))
+            continue;
+        c->combo[depth] = i;
+        bb_node(c, depth + 1, i + 1);
+    }
 }
 
 /*
- * quizmaster_search -- exhaustive combination enumeration with pruning.
+ * quizmaster_search -- exhaustive branch-and-bound search.
  *
  * 1. Build candidate port list (excluding self-loop ports).
- * 2. For each k from 0 to max_aport, enumerate all C(ncand, k)
- *    combinations of candidate port indices.
- * 3. For each combination, set ports, check abstract reachability,
- *    solve if reachable, and track the global best.
- * 4. Stop early if max_len > 0 and best_len >= max_len.
+ * 2. Walk the combination tree depth-first: the node at depth d is a set
+ *    of d candidate ports in increasing index order, so every combination
+ *    with min_aport..max_aport ports is a node exactly once.
+ * 3. At each node, check abstract reachability, solve if reachable, and
+ *    track the global best over nodes in the size range.
+ * 4. Cut the subtree of any node that is solvable with length <= best_len
+ *    (monotonicity: adding ports never lengthens the shortest path).
+ * 5. Stop early if max_len > 0 and best_len >= max_len.
+ * With a shard, only the owned depth-2 subtrees are entered and the
+ * combinations below depth 2 are evaluated by shard 0 alone.
  */
 QMResult quizmaster_search(int nterm, int min_aport, int max_aport,
-                           int max_len, int use_bfs, int directed) {
+                           int max_len, int use_bfs, int directed,
+                           const QMShard *shard) {
     QMResult result = {NULL, 0, NULL, 0};
     if (nterm < 2) return result;
 
@@ -174,120 +948,2793 @@ QMResult quizmaster_search(int nterm, int min_aport, int max_aport,
     if (min_aport < 0) min_aport = 0;
     if (max_aport > ncand) max_aport = ncand;
 
-    Maze *best = NULL;
-    int best_len = 0;
-    State *best_path = NULL;
-    int best_path_len = 0;
-    uint64_t total_evaluated = 0;
-    uint64_t total_solved = 0;
-    uint64_t total_pruned = 0;
-    uint64_t total_norm_pruned = 0;
-
-    int *combo = malloc(ncand * sizeof(int));
+    BBCtx c;
+    memset(&c, 0, sizeof(c));
+    c.m = m;
+    c.scratch = maze_create(nterm);
+    c.candidates = candidates;
+    c.combo = malloc((ncand > 0 ? ncand : 1) * sizeof(int));
+    c.ncand = ncand;
+    c.min_aport = min_aport;
+    c.max_aport = max_aport;
+    c.max_len = max_len;
+    c.use_bfs = use_bfs;
+    c.directed = directed;
+    c.nshards = shard && shard->count > 1 ? shard->count : 1;
+    c.shard = c.nshards > 1 ? shard->index : 0;
+    c.cut_k = calloc(max_aport + 1 > 0 ? max_aport + 1 : 1, sizeof(uint64_t));
+    if (use_bfs)
+        for (int i = 0; i < SOLVE_BATCH_MAX; i++)
+            c.batch[i] = maze_create(nterm);
+    if (shard && shard->result_file)
+        c.res = shard_result_create(SHARD_EXHAUSTIVE, nterm, directed,
+                                    min_aport, max_aport, max_len, use_bfs, 0,
+                                    c.shard, c.nshards);
 
     for (int k = min_aport; k <= max_aport; k++) {
         uint64_t ncombs = binomial(ncand, k);
         fprintf(stderr, "k=%d: C(%d,%d) = %llu mazes\n",
                 k, ncand, k, (unsigned long long)ncombs);
+        c.total_combos += ncombs;
+    }
+    if (c.nshards > 1 && min_aport <= max_aport) {
+        uint64_t all = c.total_combos;
+        memset(c.cut_k, 0, (max_aport + 1) * sizeof(uint64_t));
+        bb_owned_combos(&c, 0, 0, c.cut_k);
+        c.total_combos = min_aport == 0 && c.shard == 0;
+        for (int k = 0; k <= max_aport; k++)
+            c.total_combos += c.cut_k[k];
+        fprintf(stderr, "Shard %d/%d: %llu of %llu mazes\n", c.shard, c.nshards,
+                (unsigned long long)c.total_combos, (unsigned long long)all);
+    }
 
-        /* Initialize combo to {0, 1, ..., k-1} */
-        for (int i = 0; i < k; i++)
-            combo[i] = i;
-
-        uint64_t combo_count = 0;
-        for (;;) {
-            /* Set up the maze for this combination */
-            maze_clear(m);
-            for (int i = 0; i < k; i++)
-                maze_set_port(m, candidates[combo[i]], 1);
-            if (!directed)
-                maze_make_undirected(m);
-
-            /* Pruning 1: normalization -- skip non-canonical forms */
-            if (!maze_is_normalized(m)) {
-                total_norm_pruned++;
-                goto next_combo;
-            }
+    if (min_aport <= max_aport)
+        bb_node(&c, 0, 0);
 
-            /* Pruning 2: abstract terminal reachability */
-            if (has_abstract_path(m)) {
-                int len;
-                State *tmp_path = NULL;
-                int tmp_path_len = 0;
-                if (use_bfs) {
-                    len = solve_bfs_len(m);
-                } else {
-                    len = solve(m, &tmp_path, &tmp_path_len);
-                }
-                if (len < 0) len = 0;
-                total_solved++;
-
-                if (len > best_len) {
-                    if (use_bfs)
-                        solve_bfs(m, &tmp_path, &tmp_path_len);
-                    best_len = len;
-                    if (best) maze_destroy(best);
-                    best = maze_clone(m);
-                    free(best_path);
-                    best_path = tmp_path;
-                    best_path_len = tmp_path_len;
-                    tmp_path = NULL;
-                    fprintf(stderr, "[k=%d, combo %llu] new best: length %d\n",
-                            k, (unsigned long long)combo_count, best_len);
-                    fprintf(stderr, "  ");
-                    maze_fprint(stderr, best);
-                    fprintf(stderr, "  ");
-                    path_fprint(stderr, best_path, best_path_len);
-                    if (max_len > 0 && best_len >= max_len) {
-                        total_evaluated++;
-                        combo_count++;
-                        goto search_done;
-                    }
-                } else {
-                    free(tmp_path);
-                }
-            } else {
-                total_pruned++;
-            }
+    free(c.combo);
+    free(c.cut_k);
+    for (int i = 0; i < SOLVE_BATCH_MAX; i++)
+        maze_destroy(c.batch[i]);
+    maze_destroy(c.scratch);
+    free(candidates);
 
-        next_combo:
-            total_evaluated++;
-            combo_count++;
-
-            /* Progress reporting every 10000 mazes */
-            if (combo_count % 10000 == 0) {
-                fprintf(stderr, "[k=%d] progress: %llu/%llu (%.1f%%) best=%d solved=%llu pruned=%llu norm_pruned=%llu\n",
-                        k,
-                        (unsigned long long)combo_count,
-                        (unsigned long long)ncombs,
-                        (double)combo_count / (double)ncombs * 100.0,
-                        best_len,
-                        (unsigned long long)total_solved,
-                        (unsigned long long)total_pruned,
-                        (unsigned long long)total_norm_pruned);
-            }
+    fprintf(stderr, "Search complete: %llu evaluated, %llu solved, %llu pruned, %llu norm_pruned, %llu dead_pruned, %llu bb_pruned, best length = %d\n",
+            (unsigned long long)c.evaluated,
+            (unsigned long long)c.solved,
+            (unsigned long long)c.pruned,
+            (unsigned long long)c.norm_pruned,
+            (unsigned long long)c.dead_pruned,
+            (unsigned long long)c.bb_pruned,
+            c.best_len);
 
-            /* Generate next combination in lexicographic order */
-            int i = k - 1;
-            while (i >= 0 && combo[i] == ncand - k + i)
-                i--;
-            if (i < 0) break;
-            combo[i]++;
-            for (int j = i + 1; j < k; j++)
-                combo[j] = combo[j - 1] + 1;
-        }
+    if (c.res) {
+        c.res->complete = !c.done;
+        if (c.best) shard_result_set_best(c.res, c.best, c.best_len);
+        if (shard_result_write(c.res, shard->result_file) == 0)
+            fprintf(stderr, "Shard result written to %s\n", shard->result_file);
+        shard_result_free(c.res);
     }
 
-search_done:
-    free(combo);
-    free(candidates);
+    if (c.best) {
+        result.best_maze     = c.best;
+        result.best_length   = c.best_len;
+        result.best_path     = c.best_path;
+        result.best_path_len = c.best_path_len;
+    }
 
-    fprintf(stderr, "Search complete: %llu evaluated, %llu solved, %llu pruned, %llu norm_pruned, best length = %d\n",
-            (unsigned long long)total_evaluated,
-            (unsigned long long)total_solved,
-            (unsigned long long)total_pruned,
-            (unsigned long long)total_norm_pruned,
-            best_len);
+    maze_destroy(m);
+    return result;
+}
+
+/*
+ * DupFilter -- blocked Bloom filter over canonical maze hashes.
+ *
+ * Each key touches one 512-bit block (a cache line) chosen by the high
+ * half of its hash and sets DUP_FILTER_BITS bits inside it, picked from a
+ * remix of the whole hash, with atomic fetch-or, so workers can
+ * test-and-insert concurrently without a lock. False positives make a new
+ * maze look like a repeat; false negatives cannot happen.
+ */
+#define DUP_FILTER_BITS 6
+
+typedef struct {
+    atomic_ullong *words;
+    uint64_t nblocks;           /* 8 words per block; 0 = disabled */
+} DupFilter;
+
+static void dup_filter_init(DupFilter *f, size_t bytes) {
+    f->nblocks = bytes / 64;
+    f->words = f->nblocks ? calloc(f->nblocks * 8, sizeof(atomic_ullong)) : NULL;
+    if (!f->words) f->nblocks = 0;
+}
+
+static void dup_filter_free(DupFilter *f) {
+    free(f->words);
+    f->words = NULL;
+    f->nblocks = 0;
+}
+
+/*
+ * dup_filter_test_and_set -- insert a key hash; return 1 if every bit was
+ * already set (the key was probably seen before), 0 if it is new.
+ */
+static int dup_filter_test_and_set(DupFilter *f, uint64_t h) {
+    atomic_ullong *block = f->words + ((h >> 32) % f->nblocks) * 8;
+    uint64_t bits = h * 0x9E3779B97F4A7C15ULL;
+    int seen = 1;
+    for (int i = 0; i < DUP_FILTER_BITS; i++) {
+        int b = (int)(bits >> (64 - 9 * (i + 1))) & 511;
+        uint64_t mask = 1ULL << (b & 63);
+        uint64_t old = atomic_fetch_or_explicit(&block[b >> 6], mask, memory_order_relaxed);
+        if (!(old & mask)) seen = 0;
+    }
+    return seen;
+}
+
+/*
+ * RandomShared -- state shared by all random-search workers.
+ *
+ * best_len is read lock-free by every worker; the best maze and path are
+ * only touched under best_lock. Counters are merged atomically.
+ */
+typedef struct {
+    int nterm;
+    int min_aport;
+    int max_aport;
+    int max_len;
+    int use_bfs;
+    int directed;
+    const int *candidates;
+    int ncand;
+    int constructive;
+
+    /* Constructive mode: candidate positions realizing each abstract edge
+     * a->b (a != b) are edge_cand[edge_off[a*2n+b] .. edge_off[a*2n+b+1]) */
+    const int *edge_off;
+    const int *edge_cand;
+
+    DupFilter dups;             /* canonical-sample filter (nblocks 0 = off) */
+
+    atomic_int stop;            /* set when max_len is reached */
+    atomic_int best_len;
+    pthread_mutex_t best_lock;
+    Maze  *best;
+    State *best_path;
+    int    best_path_len;
+
+    atomic_ullong total_evaluated;
+    atomic_ullong total_solved;
+    atomic_ullong total_pruned;
+    atomic_ullong total_dups;
+
+    /* Constructive mode, per k: samples drawn, and uniform probes drawn /
+     * found abstractly connected (the importance-weight estimate p_k) */
+    atomic_ullong *k_samples;
+    atomic_ullong *k_probes;
+    atomic_ullong *k_probe_hits;
+} RandomShared;
+
+/*
+ * RandomWorker -- per-thread state of a random-search worker. The per-k
+ * shard counters and histogram are private to the worker and summed
+ * after the run (NULL unless a shard result file is written).
+ */
+typedef struct {
+    RandomShared *sh;
+    int id;
+    uint64_t rng;               /* independent xorshift64 stream */
+    uint64_t *k_counts;         /* [(max_aport + 1) * SHARD_NCOUNTS] */
+    uint64_t *k_hist;           /* [(max_aport + 1) * SHARD_HIST_LEN] */
+} RandomWorker;
+
+/*
+ * random_pick_uniform -- move k uniformly chosen candidate positions to the
+ * front of indices[] (partial Fisher-Yates over the identity permutation).
+ */
+static void random_pick_uniform(RandomWorker *w, int *indices, int k) {
+    int ncand = w->sh->ncand;
+    for (int i = 0; i < ncand; i++)
+        indices[i] = i;
+    for (int i = 0; i < k; i++) {
+        int j = i + (int)(rng_next(&w->rng) % (uint64_t)(ncand - i));
+        int tmp = indices[i];
+        indices[i] = indices[j];
+        indices[j] = tmp;
+    }
+}
+
+/*
+ * random_pick_constructive -- move k candidate positions to the front of
+ * indices[] such that the maze they form has an abstract start->goal path.
+ *
+ * Picks h intermediate abstract nodes (h uniform in [0, min(k-1, 2n-2)],
+ * distinct, random order), realizes each edge of the path 0 -> v1 -> ...
+ * -> vh -> 1 by a random candidate port, and fills the remaining k-h-1
+ * slots uniformly from the other candidates. pos[] is scratch space for
+ * the inverse of indices[]. Requires k >= 1.
+ */
+static void random_pick_constructive(RandomWorker *w, int *indices, int *pos, int k) {
+    RandomShared *sh = w->sh;
+    int ncand = sh->ncand;
+    int na = 2 * sh->nterm;
+    int nodes[2 * MAZE_MAX_NTERM];
+
+    for (int i = 0; i < ncand; i++)
+        indices[i] = pos[i] = i;
+
+    int hmax = k - 1 < na - 2 ? k - 1 : na - 2;
+    int h = (int)(rng_next(&w->rng) % (uint64_t)(hmax + 1));
+    for (int i = 0; i < na - 2; i++)
+        nodes[i] = i + 2;
+    for (int i = 0; i < h; i++) {
+        int j = i + (int)(rng_next(&w->rng) % (uint64_t)(na - 2 - i));
+        int tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+
+    /* Path edges: distinct abstract edges, hence distinct candidates */
+    int prev = 0;
+    for (int i = 0; i <= h; i++) {
+        int next = i < h ? nodes[i] : 1;
+        int e = prev * na + next;
+        int cnt = sh->edge_off[e + 1] - sh->edge_off[e];
+        int c = sh->edge_cand[sh->edge_off[e] + (int)(rng_next(&w->rng) % (uint64_t)cnt)];
+        int j = pos[c];
+        indices[j] = indices[i];
+        pos[indices[j]] = j;
+        indices[i] = c;
+        pos[c] = i;
+        prev = next;
+    }
+
+    for (int i = h + 1; i < k; i++) {
+        int j = i + (int)(rng_next(&w->rng) % (uint64_t)(ncand - i));
+        int tmp = indices[i];
+        indices[i] = indices[j];
+        indices[j] = tmp;
+    }
+}
+
+/*
+ * random_fill_raw -- load the first k picked candidates into m, without
+ * adding reverse ports in undirected mode.
+ */
+static void random_fill_raw(RandomShared *sh, Maze *m, const int *indices, int k) {
+    maze_clear(m);
+    for (int i = 0; i < k; i++)
+        maze_set_port(m, sh->candidates[indices[i]], 1);
+}
+
+/*
+ * random_fill -- load the first k picked candidates into m.
+ */
+static void random_fill(RandomShared *sh, Maze *m, const int *indices, int k) {
+    random_fill_raw(sh, m, indices, k);
+    if (!sh->directed)
+        maze_make_undirected(m);
+}
+
+/*
+ * random_uniform_equiv -- uniform-equivalent iteration count of the
+ * constructive samples drawn so far: sum over k of n_k / p_k. A k with
+ * no connected probe yet contributes its raw sample count.
+ */
+static double random_uniform_equiv(RandomShared *sh) {
+    double sum = 0;
+    for (int k = sh->min_aport; k <= sh->max_aport; k++) {
+        double n = (double)atomic_load(&sh->k_samples[k]);
+        uint64_t probes = atomic_load(&sh->k_probes[k]);
+        uint64_t hits = atomic_load(&sh->k_probe_hits[k]);
+        sum += hits ? n * (double)probes / (double)hits : n;
+    }
+    return sum;
+}
+
+/*
+ * random_draw -- pick k in [min_aport, max_aport] and move k candidate
+ * positions to the front of indices[], uniformly or (in constructive mode)
+ * around an abstract start->goal path. In constructive mode a uniform
+ * probe of the same k is first loaded into m and checked for reachability
+ * to estimate p_k. Returns nonzero if the sample is connected by
+ * construction.
+ */
+static int random_draw(RandomWorker *w, Maze *m, int *indices, int *pos, int *k_out) {
+    RandomShared *sh = w->sh;
+    int k_range = sh->max_aport - sh->min_aport + 1;
+    int k = sh->min_aport + (int)(rng_next(&w->rng) % (uint64_t)k_range);
+    int constructed = sh->constructive && k > 0;
+
+    if (constructed) {
+        /* Cheap uniform probe for the acceptance rate p_k */
+        random_pick_uniform(w, indices, k);
+        random_fill(sh, m, indices, k);
+        atomic_fetch_add_explicit(&sh->k_probes[k], 1, memory_order_relaxed);
+        if (has_abstract_path(m))
+            atomic_fetch_add_explicit(&sh->k_probe_hits[k], 1, memory_order_relaxed);
+
+        random_pick_constructive(w, indices, pos, k);
+        atomic_fetch_add_explicit(&sh->k_samples[k], 1, memory_order_relaxed);
+    } else {
+        random_pick_uniform(w, indices, k);
+    }
+    *k_out = k;
+    return constructed;
+}
+
+/*
+ * random_offer_best -- record m (length len, k ports) as the new best if
+ * it beats the current one, and raise the stop flag at max_len.
+ */
+static void random_offer_best(RandomShared *sh, const Maze *m, int len,
+                              int k, int id) {
+    if (len <= atomic_load_explicit(&sh->best_len, memory_order_relaxed))
+        return;
+    pthread_mutex_lock(&sh->best_lock);
+    if (len > atomic_load(&sh->best_len)) {
+        State *tmp_path = NULL;
+        int tmp_path_len = 0;
+        if (sh->use_bfs)
+            solve_bfs(m, &tmp_path, &tmp_path_len);
+        else
+            solve(m, &tmp_path, &tmp_path_len);
+        atomic_store(&sh->best_len, len);
+        if (sh->best) maze_copy(sh->best, m);
+        else sh->best = maze_clone(m);
+        free(sh->best_path);
+        sh->best_path = tmp_path;
+        sh->best_path_len = tmp_path_len;
+        fprintf(stderr, "[iter %llu, k=%d, thread %d] new best: length %d\n",
+                (unsigned long long)atomic_load(&sh->total_evaluated),
+                k, id, len);
+        fprintf(stderr, "  ");
+        maze_fprint(stderr, sh->best);
+        fprintf(stderr, "  ");
+        path_fprint(stderr, sh->best_path, sh->best_path_len);
+        if (sh->max_len > 0 && len >= sh->max_len)
+            atomic_store(&sh->stop, 1);
+    }
+    pthread_mutex_unlock(&sh->best_lock);
+}
+
+/*
+ * random_progress -- print the progress line for `evaluated` samples
+ * (without the newline, so callers can append their own fields).
+ */
+static void random_progress(RandomShared *sh, uint64_t evaluated) {
+    fprintf(stderr, "[random] iter=%llu best=%d solved=%llu pruned=%llu",
+            (unsigned long long)evaluated,
+            atomic_load(&sh->best_len),
+            (unsigned long long)atomic_load(&sh->total_solved),
+            (unsigned long long)atomic_load(&sh->total_pruned));
+    if (sh->dups.nblocks) {
+        uint64_t dups = atomic_load(&sh->total_dups);
+        uint64_t seen = dups + atomic_load(&sh->total_solved);
+        fprintf(stderr, " dup=%.1f%%", seen ? 100.0 * (double)dups / (double)seen : 0.0);
+    }
+    if (sh->constructive)
+        fprintf(stderr, " uniform_equiv=%.0f", random_uniform_equiv(sh));
+}
+
+/*
+ * random_worker -- sampling loop of one worker thread.
+ *
+ * Each iteration randomly picks k in [min_aport, max_aport], selects k
+ * random candidates via partial Fisher-Yates, and solves the maze if it
+ * passes the abstract reachability check. In constructive mode the sample
+ * is connected by construction, and a uniform probe of the same k is only
+ * checked for reachability to estimate the importance weight p_k. With a
+ * duplicate filter, connected samples are canonicalized first and only
+ * solved when their canonical form was not seen before.
+ */
+static void *random_worker(void *arg) {
+    RandomWorker *w = arg;
+    RandomShared *sh = w->sh;
+    int ncand = sh->ncand;
+
+    Maze *m = maze_create(sh->nterm);
+    m->directed = sh->directed;
+    Maze *scratch = maze_create(sh->nterm);
+
+    /* Index array for Fisher-Yates shuffle, plus its inverse */
+    int *indices = malloc((ncand > 0 ? ncand : 1) * sizeof(int));
+    int *pos = malloc((ncand > 0 ? ncand : 1) * sizeof(int));
+    uint64_t *bits = malloc(maze_bits_nwords(m) * sizeof(uint64_t));
+
+    while (!interrupted && !atomic_load_explicit(&sh->stop, memory_order_relaxed)) {
+        int k;
+        int constructed = random_draw(w, m, indices, pos, &k);
+        random_fill(sh, m, indices, k);
+
+        uint64_t *kc = w->k_counts ? w->k_counts + k * SHARD_NCOUNTS : NULL;
+        if (kc) kc[SHARD_EVALUATED]++;
+
+        /* Pruning: abstract terminal reachability */
+        int connected = constructed || has_abstract_path(m);
+        if (connected && sh->dups.nblocks) {
+            maze_canonicalize(m, NULL);
+            maze_to_bits(m, bits);
+            if (dup_filter_test_and_set(&sh->dups,
+                                        maze_bits_hash(bits, maze_bits_nwords(m)))) {
+                atomic_fetch_add_explicit(&sh->total_dups, 1, memory_order_relaxed);
+                if (kc) kc[SHARD_SKIPPED]++;
+                connected = 0;
+            }
+        } else if (!connected) {
+            atomic_fetch_add_explicit(&sh->total_pruned, 1, memory_order_relaxed);
+            if (kc) kc[SHARD_PRUNED]++;
+        }
+
+        if (connected) {
+            int len = maze_length(m, scratch, sh->use_bfs);
+            if (len < 0) len = 0;
+            atomic_fetch_add_explicit(&sh->total_solved, 1, memory_order_relaxed);
+            if (kc) {
+                kc[SHARD_SOLVED]++;
+                w->k_hist[k * SHARD_HIST_LEN +
+                          (len < SHARD_HIST_LEN ? len : SHARD_HIST_LEN - 1)]++;
+            }
+            random_offer_best(sh, m, len, k, w->id);
+        }
+
+        uint64_t evaluated =
+            atomic_fetch_add_explicit(&sh->total_evaluated, 1, memory_order_relaxed) + 1;
+
+        /* Progress reporting every 10000 iterations (across all workers) */
+        if (evaluated % 10000 == 0) {
+            random_progress(sh, evaluated);
+            fprintf(stderr, "\n");
+        }
+    }
+
+    free(bits);
+    free(pos);
+    free(indices);
+    maze_destroy(scratch);
+    maze_destroy(m);
+    return NULL;
+}
+
+/* --- Pipelined random search --- */
+
+/*
+ * The pipelined sampler splits each iteration of random_worker over three
+ * thread pools connected by queues of batches:
+ *
+ *   generators -- draw samples and emit them bit-packed, as raw port sets
+ *   filters    -- add reverse ports (undirected mode), drop samples without
+ *                 an abstract start->goal path and, with a duplicate
+ *                 filter, canonicalize and drop repeats; survivors are
+ *                 compacted in place
+ *   solvers    -- solve the survivors and update the best maze
+ *
+ * Batches come from a fixed pool and go back to it through free_q once
+ * solved or emptied, so a stage that falls behind stalls the stages in
+ * front of it instead of growing a queue. Each stage records how long it
+ * waited for input and how full its input queue was.
+ */
+#define PIPE_BATCH 64               /* samples per batch, <= SOLVE_BATCH_MAX */
+#define PIPE_POOL_PER_THREAD 4      /* batches in the pool per thread */
+#define PIPE_SPIN 64                /* yields before a consumer blocks */
+#define PIPE_SLEEP_MS 10            /* longest block between stop checks */
+
+typedef struct {
+    int n;
+    int k[PIPE_BATCH];
+    uint8_t connected[PIPE_BATCH];  /* connected by construction */
+    uint64_t bits[];                /* n * nwords */
+} PipeBatch;
+
+/*
+ * PipeQueue -- bounded lock-free MPMC queue of batch pointers (Vyukov):
+ * each cell carries a sequence number that tells producers and consumers
+ * whether it is free for the lap they are on.
+ *
+ * A consumer that finds the queue empty for a while blocks on `nonempty`
+ * (see pipe_sleep). It counts itself in `sleepers` before its last look
+ * at the queue, and a producer checks `sleepers` after its push, with a
+ * full fence on both sides, so a push never goes unnoticed by a sleeper.
+ */
+typedef struct {
+    atomic_size_t seq;
+    PipeBatch *batch;
+} PipeCell;
+
+typedef struct {
+    PipeCell *cells;
+    size_t mask;
+    _Alignas(64) atomic_size_t head;    /* next push */
+    _Alignas(64) atomic_size_t tail;    /* next pop */
+    _Alignas(64) atomic_int sleepers;   /* consumers blocked in pipe_sleep */
+    pthread_mutex_t lock;               /* guards sleeping, not the queue */
+    pthread_cond_t nonempty;
+} PipeQueue;
+
+static void pipe_queue_init(PipeQueue *q, size_t cap) {
+    size_t n = 2;
+    while (n < cap) n *= 2;
+    q->cells = malloc(n * sizeof(PipeCell));
+    q->mask = n - 1;
+    for (size_t i = 0; i < n; i++)
+        atomic_init(&q->cells[i].seq, i);
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->sleepers, 0);
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->nonempty, NULL);
+}
+
+static void pipe_queue_free(PipeQueue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->nonempty);
+    free(q->cells);
+}
+
+/* pipe_wake -- wake one (or all) consumers blocked on q. */
+static void pipe_wake(PipeQueue *q, int all) {
+    pthread_mutex_lock(&q->lock);
+    if (all) pthread_cond_broadcast(&q->nonempty);
+    else pthread_cond_signal(&q->nonempty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int pipe_push(PipeQueue *q, PipeBatch *b) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;) {
+        PipeCell *c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                c->batch = b;
+                atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+                atomic_thread_fence(memory_order_seq_cst);
+                if (atomic_load_explicit(&q->sleepers, memory_order_relaxed) > 0)
+                    pipe_wake(q, 0);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;                   /* full */
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+}
+
+static PipeBatch *pipe_pop(PipeQueue *q) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;) {
+        PipeCell *c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                PipeBatch *b = c->batch;
+                atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release);
+                return b;
+            }
+        } else if (dif < 0) {
+            return NULL;                /* empty */
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+}
+
+/* pipe_queue_size -- approximate number of queued batches. */
+static size_t pipe_queue_size(PipeQueue *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    return head > tail ? head - tail : 0;
+}
+
+/* PipeStage -- counters of one pipeline stage, summed over its threads. */
+typedef struct {
+    const char *name;
+    int nthreads;
+    atomic_ullong batches;      /* input batches taken */
+    atomic_ullong items;        /* samples handled */
+    atomic_ullong wait_ns;      /* time spent waiting for input */
+    atomic_ullong occ_sum;      /* input queue size, summed at each take */
+} PipeStage;
+
+enum { PIPE_GEN, PIPE_FILTER, PIPE_SOLVE, PIPE_NSTAGES };
+
+typedef struct {
+    RandomShared *sh;
+    int nwords;
+    PipeQueue free_q;           /* empty batches, input of generators */
+    PipeQueue filter_q;         /* generated batches */
+    PipeQueue solve_q;          /* filtered batches */
+    PipeStage stage[PIPE_NSTAGES];
+    atomic_int live[PIPE_NSTAGES];  /* threads of each stage still running */
+} PipeShared;
+
+typedef struct {
+    RandomWorker w;             /* rng (generators) and shard counters */
+    PipeShared *p;
+    int stage;
+} PipeWorker;
+
+static uint64_t pipe_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int pipe_stopping(const PipeShared *p) {
+    return interrupted || atomic_load_explicit(&p->sh->stop, memory_order_relaxed);
+}
+
+/* pipe_upstream_done -- whether the stage feeding a queue has finished. */
+static int pipe_upstream_done(PipeShared *p, int upstream) {
+    return upstream >= 0 && atomic_load(&p->live[upstream]) == 0;
+}
+
+/*
+ * pipe_sleep -- block until q may have a batch. A push or the end of the
+ * upstream stage wakes the sleeper; stop requests and SIGINT only set a
+ * flag, so the wait also gives up after PIPE_SLEEP_MS.
+ */
+static void pipe_sleep(PipeShared *p, PipeQueue *q, int upstream) {
+    pthread_mutex_lock(&q->lock);
+    atomic_fetch_add(&q->sleepers, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (pipe_queue_size(q) == 0 && !pipe_stopping(p) &&
+        !pipe_upstream_done(p, upstream)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += PIPE_SLEEP_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&q->nonempty, &q->lock, &ts);
+    }
+    atomic_fetch_sub(&q->sleepers, 1);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * pipe_take -- pop a batch from q for stage st. While q is empty, yields
+ * PIPE_SPIN times and then blocks in pipe_sleep. Returns NULL when the
+ * search stops, or when q is empty and the stage feeding it (upstream,
+ * -1 = none) has finished.
+ */
+static PipeBatch *pipe_take(PipeShared *p, PipeQueue *q, int st, int upstream) {
+    PipeStage *s = &p->stage[st];
+    uint64_t start = 0;
+    int spins = 0;
+    PipeBatch *b;
+    for (;;) {
+        size_t occ = pipe_queue_size(q);
+        if ((b = pipe_pop(q)) != NULL) {
+            atomic_fetch_add_explicit(&s->occ_sum, occ, memory_order_relaxed);
+            break;
+        }
+        if (pipe_stopping(p)) break;
+        if (pipe_upstream_done(p, upstream)) {
+            b = pipe_pop(q);
+            break;
+        }
+        if (!start) start = pipe_now_ns();
+        if (spins < PIPE_SPIN) {
+            spins++;
+            sched_yield();
+        } else {
+            pipe_sleep(p, q, upstream);
+        }
+    }
+    if (start)
+        atomic_fetch_add_explicit(&s->wait_ns, pipe_now_ns() - start,
+                                  memory_order_relaxed);
+    if (b) atomic_fetch_add_explicit(&s->batches, 1, memory_order_relaxed);
+    return b;
+}
+
+/* pipe_generator -- fill empty batches with raw samples. */
+static void pipe_generator(PipeWorker *pw) {
+    PipeShared *p = pw->p;
+    RandomShared *sh = p->sh;
+    Maze *m = maze_create(sh->nterm);
+    m->directed = sh->directed;
+    int ncand = sh->ncand > 0 ? sh->ncand : 1;
+    int *indices = malloc(ncand * sizeof(int));
+    int *pos = malloc(ncand * sizeof(int));
+    PipeBatch *b;
+
+    while ((b = pipe_take(p, &p->free_q, PIPE_GEN, -1)) != NULL) {
+        for (int i = 0; i < PIPE_BATCH; i++) {
+            b->connected[i] = (uint8_t)random_draw(&pw->w, m, indices, pos, &b->k[i]);
+            random_fill_raw(sh, m, indices, b->k[i]);
+            maze_to_bits(m, b->bits + (size_t)i * p->nwords);
+        }
+        b->n = PIPE_BATCH;
+        atomic_fetch_add_explicit(&p->stage[PIPE_GEN].items, PIPE_BATCH,
+                                  memory_order_relaxed);
+        pipe_push(&p->filter_q, b);
+    }
+
+    free(pos);
+    free(indices);
+    maze_destroy(m);
+}
+
+/*
+ * pipe_filter -- run the abstract checks of a batch and pass the
+ * survivors on as complete (undirected, canonical if deduplicating) mazes.
+ */
+static void pipe_filter(PipeWorker *pw) {
+    PipeShared *p = pw->p;
+    RandomShared *sh = p->sh;
+    Maze *m = maze_create(sh->nterm);
+    m->directed = sh->directed;
+    int nwords = p->nwords;
+    PipeBatch *b;
+
+    while ((b = pipe_take(p, &p->filter_q, PIPE_FILTER, PIPE_GEN)) != NULL) {
+        int n = 0;
+        uint64_t pruned = 0, dups = 0;
+        for (int i = 0; i < b->n; i++) {
+            int k = b->k[i];
+            uint64_t *kc = pw->w.k_counts ? pw->w.k_counts + k * SHARD_NCOUNTS : NULL;
+            if (kc) kc[SHARD_EVALUATED]++;
+
+            maze_from_bits(m, b->bits + (size_t)i * nwords);
+            if (!sh->directed)
+                maze_make_undirected(m);
+            if (!b->connected[i] && !has_abstract_path(m)) {
+                pruned++;
+                if (kc) kc[SHARD_PRUNED]++;
+                continue;
+            }
+            if (sh->dups.nblocks) {
+                maze_canonicalize(m, NULL);
+                maze_to_bits(m, b->bits + (size_t)n * nwords);
+                if (dup_filter_test_and_set(&sh->dups,
+                        maze_bits_hash(b->bits + (size_t)n * nwords, nwords))) {
+                    dups++;
+                    if (kc) kc[SHARD_SKIPPED]++;
+                    continue;
+                }
+            } else {
+                maze_to_bits(m, b->bits + (size_t)n * nwords);
+            }
+            b->k[n++] = k;
+        }
+        int total = b->n;
+        b->n = n;
+        pipe_push(n > 0 ? &p->solve_q : &p->free_q, b);
+
+        atomic_fetch_add_explicit(&p->stage[PIPE_FILTER].items, total,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&sh->total_pruned, pruned, memory_order_relaxed);
+        atomic_fetch_add_explicit(&sh->total_dups, dups, memory_order_relaxed);
+        uint64_t evaluated =
+            atomic_fetch_add_explicit(&sh->total_evaluated, total, memory_order_relaxed) + total;
+
+        /* Progress reporting every 10000 iterations, with queue fill */
+        if (evaluated / 10000 != (evaluated - total) / 10000) {
+            random_progress(sh, evaluated / 10000 * 10000);
+            fprintf(stderr, " queued=%zu/%zu\n",
+                    pipe_queue_size(&p->filter_q), pipe_queue_size(&p->solve_q));
+        }
+    }
+
+    maze_destroy(m);
+}
+
+/*
+ * pipe_solver -- solve filtered mazes and update the best maze. In BFS
+ * mode a whole batch goes through maze_length_batch at once.
+ */
+static void pipe_solver(PipeWorker *pw) {
+    PipeShared *p = pw->p;
+    RandomShared *sh = p->sh;
+    Maze *ms[PIPE_BATCH];
+    int lens[PIPE_BATCH];
+    for (int i = 0; i < PIPE_BATCH; i++) {
+        ms[i] = maze_create(sh->nterm);
+        ms[i]->directed = sh->directed;
+    }
+    Maze *scratch = maze_create(sh->nterm);
+    PipeBatch *b;
+
+    while ((b = pipe_take(p, &p->solve_q, PIPE_SOLVE, PIPE_FILTER)) != NULL) {
+        for (int i = 0; i < b->n; i++)
+            maze_from_bits(ms[i], b->bits + (size_t)i * p->nwords);
+        if (sh->use_bfs)
+            maze_length_batch(ms, b->n, scratch, 1, lens);
+        for (int i = 0; i < b->n && !pipe_stopping(p); i++) {
+            int k = b->k[i];
+            int len = sh->use_bfs ? lens[i] : maze_length(ms[i], scratch, 0);
+            if (len < 0) len = 0;
+            atomic_fetch_add_explicit(&sh->total_solved, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&p->stage[PIPE_SOLVE].items, 1,
+                                      memory_order_relaxed);
+            if (pw->w.k_counts) {
+                pw->w.k_counts[k * SHARD_NCOUNTS + SHARD_SOLVED]++;
+                pw->w.k_hist[k * SHARD_HIST_LEN +
+                             (len < SHARD_HIST_LEN ? len : SHARD_HIST_LEN - 1)]++;
+            }
+            random_offer_best(sh, ms[i], len, k, pw->w.id);
+        }
+        pipe_push(&p->free_q, b);
+    }
+
+    for (int i = 0; i < PIPE_BATCH; i++)
+        maze_destroy(ms[i]);
+    maze_destroy(scratch);
+}
+
+static void *pipe_worker(void *arg) {
+    PipeWorker *pw = arg;
+    if (pw->stage == PIPE_GEN) pipe_generator(pw);
+    else if (pw->stage == PIPE_FILTER) pipe_filter(pw);
+    else pipe_solver(pw);
+    /* The last thread of a stage wakes the consumers of its output */
+    if (atomic_fetch_sub(&pw->p->live[pw->stage], 1) == 1) {
+        if (pw->stage == PIPE_GEN) pipe_wake(&pw->p->filter_q, 1);
+        else if (pw->stage == PIPE_FILTER) pipe_wake(&pw->p->solve_q, 1);
+    }
+    return NULL;
+}
+
+/*
+ * random_pipeline_run -- run the sampler as a pipeline of nstage[PIPE_GEN]
+ * generator, nstage[PIPE_FILTER] filter and nstage[PIPE_SOLVE] solver
+ * threads. Generator g uses random stream g * nshards + shard. Shard
+ * counters of all threads are added to res (if non-NULL). Prints the
+ * per-stage report at the end.
+ */
+static void random_pipeline_run(RandomShared *sh, const int *nstage,
+                                unsigned int seed, int shard, int nshards,
+                                ShardResult *res) {
+    PipeShared p;
+    memset(&p, 0, sizeof(p));
+    p.sh = sh;
+    Maze *tmp = maze_create(sh->nterm);
+    p.nwords = maze_bits_nwords(tmp);
+    maze_destroy(tmp);
+
+    static const char *names[PIPE_NSTAGES] = { "generate", "filter", "solve" };
+    int nthreads = 0;
+    for (int s = 0; s < PIPE_NSTAGES; s++) {
+        p.stage[s].name = names[s];
+        p.stage[s].nthreads = nstage[s];
+        atomic_init(&p.live[s], nstage[s]);
+        nthreads += nstage[s];
+    }
+
+    int npool = PIPE_POOL_PER_THREAD * nthreads;
+    size_t batch_bytes = sizeof(PipeBatch) + (size_t)PIPE_BATCH * p.nwords * sizeof(uint64_t);
+    char *pool = malloc((size_t)npool * batch_bytes);
+    pipe_queue_init(&p.free_q, npool);
+    pipe_queue_init(&p.filter_q, npool);
+    pipe_queue_init(&p.solve_q, npool);
+    for (int i = 0; i < npool; i++)
+        pipe_push(&p.free_q, (PipeBatch *)(pool + (size_t)i * batch_bytes));
+
+    int ks = res ? (sh->max_aport + 1) : 0;
+    PipeWorker *workers = calloc(nthreads, sizeof(PipeWorker));
+    pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
+    int t = 0;
+    for (int s = 0; s < PIPE_NSTAGES; s++)
+        for (int i = 0; i < nstage[s]; i++, t++) {
+            workers[t].p = &p;
+            workers[t].stage = s;
+            workers[t].w.sh = sh;
+            workers[t].w.id = t;
+            if (s == PIPE_GEN)
+                workers[t].w.rng = rng_split(seed, i * nshards + shard);
+            if (res) {
+                workers[t].w.k_counts = calloc((size_t)ks * SHARD_NCOUNTS, sizeof(uint64_t));
+                workers[t].w.k_hist = calloc((size_t)ks * SHARD_HIST_LEN, sizeof(uint64_t));
+            }
+        }
+
+    uint64_t start = pipe_now_ns();
+    for (t = 0; t < nthreads; t++)
+        pthread_create(&tids[t], NULL, pipe_worker, &workers[t]);
+    for (t = 0; t < nthreads; t++)
+        pthread_join(tids[t], NULL);
+    double elapsed = (double)(pipe_now_ns() - start);
+
+    fprintf(stderr, "Pipeline (batch %d, pool %d):\n", PIPE_BATCH, npool);
+    for (int s = 0; s < PIPE_NSTAGES; s++) {
+        PipeStage *st = &p.stage[s];
+        uint64_t batches = atomic_load(&st->batches);
+        double wait = (double)atomic_load(&st->wait_ns) / (elapsed * st->nthreads);
+        fprintf(stderr, "  %-8s %2d thread%s  %12llu samples  busy %5.1f%%  %s %.1f batches\n",
+                st->name, st->nthreads, st->nthreads > 1 ? "s" : " ",
+                (unsigned long long)atomic_load(&st->items),
+                100.0 * (wait < 1.0 ? 1.0 - wait : 0.0),
+                s == PIPE_GEN ? "free" : "queued",
+                batches ? (double)atomic_load(&st->occ_sum) / (double)batches : 0.0);
+    }
+
+    for (t = 0; t < nthreads; t++) {
+        if (res) {
+            for (int i = 0; i < ks * SHARD_NCOUNTS; i++)
+                res->counts[i] += workers[t].w.k_counts[i];
+            for (int i = 0; i < ks * SHARD_HIST_LEN; i++)
+                res->hist[i] += workers[t].w.k_hist[i];
+        }
+        free(workers[t].w.k_counts);
+        free(workers[t].w.k_hist);
+    }
+    free(tids);
+    free(workers);
+    pipe_queue_free(&p.free_q);
+    pipe_queue_free(&p.filter_q);
+    pipe_queue_free(&p.solve_q);
+    free(pool);
+}
+
+/*
+ * quizmaster_random_search -- parallel random sampling search with SIGINT
+ * handling.
+ *
+ * Runs nthreads workers until SIGINT or max_len is reached. Worker i draws
+ * from its own xorshift64 stream seeded with rng_split(seed, i), so a run
+ * with the same seed and thread count samples the same mazes per worker.
+ * Shard s of N uses streams i * N + s instead, which no other shard uses
+ * whatever its thread count. With opts->pipeline, the generator threads
+ * take the place of the workers (see random_pipeline_run).
+ */
+QMResult quizmaster_random_search(int nterm, int min_aport, int max_aport,
+                                  int max_len, unsigned int seed, int use_bfs,
+                                  int directed, const QMRandomOptions *opts) {
+    QMResult result = {NULL, 0, NULL, 0};
+    if (nterm < 2) return result;
+    int nthreads = opts && opts->nthreads > 1 ? opts->nthreads : 1;
+    int constructive = opts ? opts->constructive : 0;
+    size_t dedupe_mem = opts ? opts->dedupe_mem : 0;
+    int pipelined = opts && opts->pipeline[PIPE_GEN] > 0 &&
+                    opts->pipeline[PIPE_FILTER] > 0 && opts->pipeline[PIPE_SOLVE] > 0;
+    int nshards = opts && opts->shard.count > 1 ? opts->shard.count : 1;
+    int shard = nshards > 1 ? opts->shard.index : 0;
+    const char *result_file = opts ? opts->shard.result_file : NULL;
+
+    interrupted = 0;
+
+    /* Install SIGINT handler */
+    struct sigaction sa, old_sa;
+    sa.sa_handler = sigint_handler;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_sa);
+
+    Maze *m = maze_create(nterm);
+    int total = m->total_nports;
+
+    /* Build candidate list (exclude self-loop ports) */
+    int *candidates = malloc(total * sizeof(int));
+    int ncand = 0;
+    for (int i = 0; i < total; i++) {
+        if (!is_self_loop_port(m, i))
+            candidates[ncand++] = i;
+    }
+
+    if (pipelined)
+        fprintf(stderr, "Random search (seed=%u, pipeline %d:%d:%d%s): %d candidates (excluding %d self-loops)\n",
+                seed, opts->pipeline[PIPE_GEN], opts->pipeline[PIPE_FILTER],
+                opts->pipeline[PIPE_SOLVE], constructive ? ", constructive" : "",
+                ncand, total - ncand);
+    else
+        fprintf(stderr, "Random search (seed=%u, threads=%d%s): %d candidates (excluding %d self-loops)\n",
+                seed, nthreads, constructive ? ", constructive" : "", ncand, total - ncand);
+    if (nshards > 1)
+        fprintf(stderr, "Shard %d/%d: random streams %d + %d*i\n",
+                shard, nshards, shard, nshards);
+
+    /* Clamp range to candidate count */
+    if (min_aport < 0) min_aport = 0;
+    if (max_aport > ncand) max_aport = ncand;
+    if (min_aport > max_aport) min_aport = max_aport;
+
+    /* Group candidates by abstract edge for the constructive sampler */
+    int na = 2 * nterm;
+    int *edge_off = calloc(na * na + 1, sizeof(int));
+    int *edge_cand = malloc((ncand > 0 ? ncand : 1) * sizeof(int));
+    for (int c = 0; c < ncand; c++) {
+        int a, b;
+        port_abstract_edge(m, candidates[c], &a, &b);
+        edge_off[a * na + b + 1]++;
+    }
+    for (int e = 0; e < na * na; e++)
+        edge_off[e + 1] += edge_off[e];
+    int *edge_fill = malloc(na * na * sizeof(int));
+    memcpy(edge_fill, edge_off, na * na * sizeof(int));
+    for (int c = 0; c < ncand; c++) {
+        int a, b;
+        port_abstract_edge(m, candidates[c], &a, &b);
+        edge_cand[edge_fill[a * na + b]++] = c;
+    }
+    free(edge_fill);
+
+    atomic_ullong *k_stats = malloc(3 * (max_aport + 1) * sizeof(atomic_ullong));
+    for (int i = 0; i < 3 * (max_aport + 1); i++)
+        atomic_init(&k_stats[i], 0);
+
+    RandomShared sh;
+    memset(&sh, 0, sizeof(sh));
+    sh.nterm = nterm;
+    sh.min_aport = min_aport;
+    sh.max_aport = max_aport;
+    sh.max_len = max_len;
+    sh.use_bfs = use_bfs;
+    sh.directed = directed;
+    sh.candidates = candidates;
+    sh.ncand = ncand;
+    sh.constructive = constructive;
+    dup_filter_init(&sh.dups, dedupe_mem);
+    if (dedupe_mem && !sh.dups.nblocks)
+        fprintf(stderr, "Warning: cannot allocate duplicate filter, running without it\n");
+    sh.edge_off = edge_off;
+    sh.edge_cand = edge_cand;
+    sh.k_samples = k_stats;
+    sh.k_probes = k_stats + (max_aport + 1);
+    sh.k_probe_hits = k_stats + 2 * (max_aport + 1);
+    atomic_init(&sh.stop, 0);
+    atomic_init(&sh.best_len, 0);
+    atomic_init(&sh.total_evaluated, 0);
+    atomic_init(&sh.total_solved, 0);
+    atomic_init(&sh.total_pruned, 0);
+    atomic_init(&sh.total_dups, 0);
+    pthread_mutex_init(&sh.best_lock, NULL);
+
+    ShardResult *res = NULL;
+    if (result_file)
+        res = shard_result_create(SHARD_RANDOM, nterm, directed, min_aport,
+                                  max_aport, max_len, use_bfs, seed, shard, nshards);
+
+    if (pipelined) nthreads = 0;
+    RandomWorker *workers = calloc(nthreads > 0 ? nthreads : 1, sizeof(RandomWorker));
+    for (int t = 0; t < nthreads; t++) {
+        workers[t].sh = &sh;
+        workers[t].id = t;
+        workers[t].rng = rng_split(seed, t * nshards + shard);
+        if (result_file) {
+            workers[t].k_counts = calloc((size_t)(max_aport + 1) * SHARD_NCOUNTS,
+                                         sizeof(uint64_t));
+            workers[t].k_hist = calloc((size_t)(max_aport + 1) * SHARD_HIST_LEN,
+                                       sizeof(uint64_t));
+        }
+    }
+
+    if (pipelined) {
+        random_pipeline_run(&sh, opts->pipeline, seed, shard, nshards, res);
+    } else if (nthreads == 1) {
+        random_worker(&workers[0]);
+    } else {
+        pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
+        for (int t = 0; t < nthreads; t++)
+            pthread_create(&tids[t], NULL, random_worker, &workers[t]);
+        for (int t = 0; t < nthreads; t++)
+            pthread_join(tids[t], NULL);
+        free(tids);
+    }
+
+    if (res) {
+        for (int t = 0; t < nthreads; t++) {
+            for (int i = 0; i < (max_aport + 1) * SHARD_NCOUNTS; i++)
+                res->counts[i] += workers[t].k_counts[i];
+            for (int i = 0; i < (max_aport + 1) * SHARD_HIST_LEN; i++)
+                res->hist[i] += workers[t].k_hist[i];
+        }
+        if (sh.best) shard_result_set_best(res, sh.best, atomic_load(&sh.best_len));
+        if (shard_result_write(res, result_file) == 0)
+            fprintf(stderr, "Shard result written to %s\n", result_file);
+        shard_result_free(res);
+    }
+    for (int t = 0; t < nthreads; t++) {
+        free(workers[t].k_counts);
+        free(workers[t].k_hist);
+    }
+    free(workers);
+    free(candidates);
+    free(edge_off);
+    free(edge_cand);
+    dup_filter_free(&sh.dups);
+    pthread_mutex_destroy(&sh.best_lock);
+
+    if (interrupted)
+        fprintf(stderr, "\nInterrupted by SIGINT.\n");
+
+    fprintf(stderr, "Random search complete: %llu evaluated, %llu solved, %llu pruned, best length = %d\n",
+            (unsigned long long)atomic_load(&sh.total_evaluated),
+            (unsigned long long)atomic_load(&sh.total_solved),
+            (unsigned long long)atomic_load(&sh.total_pruned),
+            atomic_load(&sh.best_len));
+    if (dedupe_mem)
+        fprintf(stderr, "  %llu duplicates skipped\n",
+                (unsigned long long)atomic_load(&sh.total_dups));
+
+    if (constructive) {
+        /* Importance weights: uniform acceptance rate per k */
+        for (int k = min_aport; k <= max_aport; k++) {
+            uint64_t n = atomic_load(&sh.k_samples[k]);
+            uint64_t probes = atomic_load(&sh.k_probes[k]);
+            uint64_t hits = atomic_load(&sh.k_probe_hits[k]);
+            if (!n) continue;
+            fprintf(stderr, "  k=%d: %llu samples, p_k=%.6f (%llu/%llu uniform probes connected)\n",
+                    k, (unsigned long long)n,
+                    probes ? (double)hits / (double)probes : 0.0,
+                    (unsigned long long)hits, (unsigned long long)probes);
+        }
+        fprintf(stderr, "  uniform-equivalent iterations = %.0f\n", random_uniform_equiv(&sh));
+    }
+    free(k_stats);
+
+    if (sh.best) {
+        result.best_maze     = sh.best;
+        result.best_length   = atomic_load(&sh.best_len);
+        result.best_path     = sh.best_path;
+        result.best_path_len = sh.best_path_len;
+    }
+
+    maze_destroy(m);
+
+    /* Restore previous SIGINT handler */
+    sigaction(SIGINT, &old_sa, NULL);
+
+    return result;
+}
+
+/* ================================================================
+ * Top-down search: start from fully-connected, remove ports one at a time.
+ * ================================================================ */
+
+/* --- Bucket priority queue of bit-packed items --- */
+
+/*
+ * Items of a fixed number of words are kept in one LIFO bucket per
+ * priority. A bucket is a chain of fixed-size chunks; emptied chunks go to
+ * a free list shared by all buckets and are reused, so pushes and pops do
+ * not touch the allocator in steady state and everything is freed in bulk.
+ * The queue tracks the highest bucket that may be non-empty, so a pop does
+ * not scan the buckets above it. Priorities are unbounded.
+ *
+ * With a spill directory, a queue holding more than mem_limit items in
+ * memory writes its non-empty buckets, lowest first, to sorted run files
+ * <dir>/td-<prio>-<seq>.run. The top bucket spills too, except for its
+ * newest chunk, so a search that only ever pushes into the top bucket
+ * stays within the limit. A bucket whose in-memory items are used up
+ * pages its newest run back in one chunk at a time, from the end of the
+ * file; a run's count is the number of items still unread at the front.
+ * A run file is done when its count reaches 0. With keep_retired set,
+ * done run files are only unlinked by bq_delete_retired(), so a
+ * checkpoint that still names them stays resumable until the next one is
+ * written (a run's unread prefix never changes on disk).
+ */
+#define BQ_CHUNK_ITEMS 1024
+
+typedef struct BQChunk {
+    struct BQChunk *prev;       /* next chunk down the bucket / free list */
+    int count;
+    uint64_t data[];
+} BQChunk;
+
+typedef struct BQRun {
+    struct BQRun *next;
+    int prio;
+    uint64_t seq;
+    uint64_t count;
+} BQRun;
+
+typedef struct {
+    BQChunk *top;
+    uint64_t count;             /* in memory and on disk */
+    uint64_t mem;               /* in memory */
+    BQRun *runs;                /* spilled runs, newest first */
+} BQBucket;
+
+typedef struct {
+    BQBucket *buckets;
+    int nbuckets;
+    int max;                    /* no bucket above this index is non-empty */
+    int item_words;
+    uint64_t count;
+    uint64_t mem;
+    BQChunk *free_chunks;
+
+    const char *spill_dir;      /* NULL = never spill */
+    uint64_t mem_limit;         /* items kept in memory before spilling */
+    uint64_t spill_seq;
+    uint64_t spilled_runs;
+    int keep_retired;           /* defer unlinking paged-in runs */
+    BQRun *retired;             /* paged-in runs whose files still exist */
+} BucketQueue;
+
+static void bq_init(BucketQueue *q, int item_words) {
+    memset(q, 0, sizeof(*q));
+    q->nbuckets = 64;
+    q->buckets = calloc(q->nbuckets, sizeof(BQBucket));
+    q->max = -1;
+    q->item_words = item_words;
+}
+
+static void bq_run_path(const BucketQueue *q, int prio, uint64_t seq,
+                        char *buf, size_t size) {
+    snprintf(buf, size, "%s/td-%d-%llu.run", q->spill_dir, prio,
+             (unsigned long long)seq);
+}
+
+/* bq_mem_push -- append an item to the in-memory part of a bucket. */
+static void bq_mem_push(BucketQueue *q, BQBucket *b, const uint64_t *item) {
+    if (!b->top || b->top->count == BQ_CHUNK_ITEMS) {
+        BQChunk *c = q->free_chunks;
+        if (c) q->free_chunks = c->prev;
+        else c = malloc(sizeof(BQChunk) + (size_t)BQ_CHUNK_ITEMS * q->item_words * sizeof(uint64_t));
+        c->prev = b->top;
+        c->count = 0;
+        b->top = c;
+    }
+    memcpy(b->top->data + (size_t)b->top->count++ * q->item_words, item,
+           q->item_words * sizeof(uint64_t));
+    b->mem++;
+    q->mem++;
+}
+
+static int bq_sort_words;
+
+static int bq_item_cmp(const void *a, const void *b) {
+    return maze_bits_cmp(a, b, bq_sort_words);
+}
+
+/*
+ * bq_spill_bucket -- write the in-memory items of bucket prio to a sorted
+ * run file and release their chunks. With keep_newest the newest chunk
+ * stays in memory. Returns 0 if there was nothing to spill or on I/O
+ * failure (the items then stay in memory).
+ */
+static int bq_spill_bucket(BucketQueue *q, int prio, int keep_newest) {
+    BQBucket *b = &q->buckets[prio];
+    BQChunk *keep = keep_newest ? b->top : NULL;
+    BQChunk *first = keep ? keep->prev : b->top;
+    if (!first) return 0;
+    size_t iw = q->item_words;
+    uint64_t *items = malloc((b->mem - (keep ? keep->count : 0)) * iw * sizeof(uint64_t));
+    uint64_t n = 0;
+    for (BQChunk *c = first; c; c = c->prev) {
+        memcpy(items + n * iw, c->data, (size_t)c->count * iw * sizeof(uint64_t));
+        n += c->count;
+    }
+    bq_sort_words = (int)iw;
+    qsort(items, n, iw * sizeof(uint64_t), bq_item_cmp);
+
+    char path[4096];
+    bq_run_path(q, prio, q->spill_seq, path, sizeof(path));
+    FILE *fp = fopen(path, "wb");
+    int ok = fp && fwrite(items, iw * sizeof(uint64_t), n, fp) == n;
+    if (fp && fclose(fp) != 0) ok = 0;
+    free(items);
+    if (!ok) {
+        fprintf(stderr, "Warning: cannot write spill run %s\n", path);
+        remove(path);
+        return 0;
+    }
+
+    BQRun *r = malloc(sizeof(BQRun));
+    r->prio = prio;
+    r->seq = q->spill_seq++;
+    r->count = n;
+    r->next = b->runs;
+    b->runs = r;
+    q->spilled_runs++;
+
+    while (first) {
+        BQChunk *c = first;
+        first = c->prev;
+        c->prev = q->free_chunks;
+        q->free_chunks = c;
+    }
+    if (keep) keep->prev = NULL;
+    b->top = keep;
+    q->mem -= n;
+    b->mem -= n;
+    return 1;
+}
+
+/*
+ * bq_page_in -- load the last chunk's worth of unread items of the newest
+ * run of bucket prio back into memory, and retire the run once all of it
+ * is read. Items are pushed in file order, so the largest key pops first
+ * and a run is consumed from its largest key down.
+ */
+static void bq_page_in(BucketQueue *q, int prio) {
+    BQBucket *b = &q->buckets[prio];
+    BQRun *r = b->runs;
+    size_t isize = q->item_words * sizeof(uint64_t);
+    uint64_t k = r->count < BQ_CHUNK_ITEMS ? r->count : BQ_CHUNK_ITEMS;
+    r->count -= k;
+
+    char path[4096];
+    bq_run_path(q, prio, r->seq, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    uint64_t *items = malloc(k * isize);
+    uint64_t got = 0;
+    if (fp && fseeko(fp, (off_t)(r->count * isize), SEEK_SET) == 0)
+        got = fread(items, isize, k, fp);
+    if (fp) fclose(fp);
+    for (uint64_t i = 0; i < got; i++)
+        bq_mem_push(q, b, items + i * q->item_words);
+    free(items);
+    if (got < k) {
+        fprintf(stderr, "Warning: spill run %s lost %llu items\n", path,
+                (unsigned long long)(k - got));
+        b->count -= k - got;
+        q->count -= k - got;
+    }
+    if (r->count > 0) return;
+
+    b->runs = r->next;
+    if (q->keep_retired) {
+        r->next = q->retired;
+        q->retired = r;
+    } else {
+        remove(path);
+        free(r);
+    }
+}
+
+/* bq_delete_retired -- unlink the files of all paged-in runs. */
+static void bq_delete_retired(BucketQueue *q) {
+    while (q->retired) {
+        BQRun *r = q->retired;
+        char path[4096];
+        bq_run_path(q, r->prio, r->seq, path, sizeof(path));
+        remove(path);
+        q->retired = r->next;
+        free(r);
+    }
+}
+
+/* bq_reserve -- make sure bucket prio exists. */
+static void bq_reserve(BucketQueue *q, int prio) {
+    if (prio < q->nbuckets) return;
+    int n = q->nbuckets;
+    while (n <= prio) n *= 2;
+    q->buckets = realloc(q->buckets, n * sizeof(BQBucket));
+    memset(q->buckets + q->nbuckets, 0, (n - q->nbuckets) * sizeof(BQBucket));
+    q->nbuckets = n;
+}
+
+static void bq_push(BucketQueue *q, int prio, const uint64_t *item) {
+    bq_reserve(q, prio);
+    bq_mem_push(q, &q->buckets[prio], item);
+    q->buckets[prio].count++;
+    q->count++;
+    if (prio > q->max) q->max = prio;
+
+    /* Spill the lowest in-memory buckets; the top one keeps its newest chunk */
+    for (int i = 0; q->spill_dir && q->mem > q->mem_limit && i <= q->max; i++)
+        if (q->buckets[i].mem > 0 && !bq_spill_bucket(q, i, i == q->max))
+            break;
+}
+
+/*
+ * bq_pop -- copy the most recently pushed item of the highest non-empty
+ * bucket into out and return its priority, or -1 if the queue is empty.
+ */
+static int bq_pop(BucketQueue *q, uint64_t *out) {
+    while (q->max >= 0 && q->buckets[q->max].count == 0)
+        q->max--;
+    if (q->max < 0) return -1;
+    BQBucket *b = &q->buckets[q->max];
+    if (b->mem == 0) {
+        bq_page_in(q, q->max);
+        return bq_pop(q, out);
+    }
+    BQChunk *c = b->top;
+    memcpy(out, c->data + (size_t)--c->count * q->item_words,
+           q->item_words * sizeof(uint64_t));
+    if (c->count == 0) {
+        b->top = c->prev;
+        c->prev = q->free_chunks;
+        q->free_chunks = c;
+    }
+    b->mem--;
+    b->count--;
+    q->mem--;
+    q->count--;
+    return q->max;
+}
+
+static void bq_free(BucketQueue *q) {
+    for (int i = 0; i < q->nbuckets; i++) {
+        BQChunk *c = q->buckets[i].top;
+        while (c) {
+            BQChunk *prev = c->prev;
+            free(c);
+            c = prev;
+        }
+        BQRun *r = q->buckets[i].runs;
+        while (r) {
+            BQRun *next = r->next;
+            if (!q->keep_retired) {
+                /* Nobody can resume from these runs */
+                char path[4096];
+                bq_run_path(q, r->prio, r->seq, path, sizeof(path));
+                remove(path);
+            }
+            free(r);
+            r = next;
+        }
+    }
+    while (q->free_chunks) {
+        BQChunk *prev = q->free_chunks->prev;
+        free(q->free_chunks);
+        q->free_chunks = prev;
+    }
+    while (q->retired) {
+        BQRun *next = q->retired->next;
+        free(q->retired);
+        q->retired = next;
+    }
+    free(q->buckets);
+}
+
+/* --- Seen set (fingerprint-tagged hash table of bit-packed mazes) --- */
+
+/*
+ * The table is split into groups of SEEN_GROUP slots. Each slot has a
+ * control byte: SEEN_EMPTY, or the top 7 bits of the key's hash. A lookup
+ * compares the 16 control bytes of a group at once (SSE2 when available)
+ * and only touches keys whose fingerprint matches, so almost every probe
+ * stays inside one cache line of control bytes.
+ *
+ * Lossless mode stores each key once, bit-packed, in a chunked arena that
+ * is freed in bulk; slots hold 32-bit key ids. Lossy mode keeps only the
+ * 64-bit hash per slot: two distinct mazes collide with probability about
+ * count / 2^64 per lookup, in exchange for a fixed 9 bytes per slot.
+ */
+#define SEEN_GROUP       16
+#define SEEN_EMPTY       0x80
+#define SEEN_CHUNK_SHIFT 16     /* keys per arena chunk = 1 << shift */
+
+typedef struct {
+    uint8_t  *ctrl;             /* one control byte per slot */
+    uint32_t *ids;              /* lossless: key id per slot */
+    uint64_t *hashes;           /* lossy: full hash per slot */
+    uint64_t **chunks;          /* lossless key arena */
+    int nchunks;
+    int ngroups;                /* power of 2 */
+    int count;
+    int nwords;                 /* key length in words */
+    int lossy;
+} SeenSet;
+
+static void seen_alloc_table(SeenSet *s, int ngroups) {
+    size_t nslots = (size_t)ngroups * SEEN_GROUP;
+    s->ngroups = ngroups;
+    s->ctrl = malloc(nslots);
+    memset(s->ctrl, SEEN_EMPTY, nslots);
+    if (s->lossy)
+        s->hashes = malloc(nslots * sizeof(uint64_t));
+    else
+        s->ids = malloc(nslots * sizeof(uint32_t));
+}
+
+static void seen_init(SeenSet *s, int nwords, int lossy) {
+    memset(s, 0, sizeof(*s));
+    s->nwords = nwords;
+    s->lossy = lossy;
+    seen_alloc_table(s, 4096);
+}
+
+/* seen_key -- arena address of key `id` (lossless mode). */
+static inline uint64_t *seen_key(const SeenSet *s, uint32_t id) {
+    return s->chunks[id >> SEEN_CHUNK_SHIFT] +
+           (size_t)(id & ((1u << SEEN_CHUNK_SHIFT) - 1)) * s->nwords;
+}
+
+/*
+ * seen_group_match -- bitmask of slots in the group at ctrl whose control
+ * byte equals c.
+ */
+static inline unsigned seen_group_match(const uint8_t *ctrl, uint8_t c) {
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)c)));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < SEEN_GROUP; i++)
+        if (ctrl[i] == c) mask |= 1u << i;
+    return mask;
+#endif
+}
+
+/*
+ * seen_home -- first group probed for a hash. It is taken from the low
+ * bits, which are independent of the fingerprint (bits 57..63) and, since
+ * maze_bits_hash no longer forces bit 0, uniform over all groups.
+ */
+static inline size_t seen_home(const SeenSet *s, uint64_t hash) {
+    return (size_t)hash & ((size_t)s->ngroups - 1);
+}
+
+/*
+ * seen_find_slot -- slot holding the key (returns 1), or the first empty
+ * slot of its probe sequence (returns 0). Groups are probed linearly.
+ */
+static int seen_find_slot(const SeenSet *s, const uint64_t *data, uint64_t hash,
+                          size_t *slot) {
+    uint8_t fp = (uint8_t)(hash >> 57);
+    size_t gmask = (size_t)s->ngroups - 1;
+    for (size_t g = seen_home(s, hash); ; g = (g + 1) & gmask) {
+        const uint8_t *ctrl = s->ctrl + g * SEEN_GROUP;
+        unsigned match = seen_group_match(ctrl, fp);
+        while (match) {
+            size_t i = g * SEEN_GROUP + __builtin_ctz(match);
+            match &= match - 1;
+            if (s->lossy ? s->hashes[i] == hash
+                         : maze_bits_cmp(seen_key(s, s->ids[i]), data, s->nwords) == 0) {
+                *slot = i;
+                return 1;
+            }
+        }
+        unsigned empty = seen_group_match(ctrl, SEEN_EMPTY);
+        if (empty) {
+            *slot = g * SEEN_GROUP + __builtin_ctz(empty);
+            return 0;
+        }
+    }
+}
+
+/* seen_empty_slot -- first empty slot of the probe sequence of hash. */
+static size_t seen_empty_slot(const SeenSet *s, uint64_t hash) {
+    size_t gmask = (size_t)s->ngroups - 1;
+    for (size_t g = seen_home(s, hash); ; g = (g + 1) & gmask) {
+        unsigned empty = seen_group_match(s->ctrl + g * SEEN_GROUP, SEEN_EMPTY);
+        if (empty) return g * SEEN_GROUP + __builtin_ctz(empty);
+    }
+}
+
+/* seen_rebuild -- double the number of groups and re-insert every slot. */
+static void seen_rebuild(SeenSet *s) {
+    SeenSet old = *s;
+    seen_alloc_table(s, old.ngroups * 2);
+    size_t nslots = (size_t)old.ngroups * SEEN_GROUP;
+    for (size_t i = 0; i < nslots; i++) {
+        if (old.ctrl[i] == SEEN_EMPTY) continue;
+        uint64_t hash = s->lossy ? old.hashes[i]
+                                 : maze_bits_hash(seen_key(s, old.ids[i]), s->nwords);
+        size_t slot = seen_empty_slot(s, hash);
+        s->ctrl[slot] = old.ctrl[i];
+        if (s->lossy) s->hashes[slot] = hash;
+        else s->ids[slot] = old.ids[i];
+    }
+    free(old.ctrl);
+    free(old.ids);
+    free(old.hashes);
+}
+
+static int seen_contains(const SeenSet *s, const uint64_t *data) {
+    size_t slot;
+    return seen_find_slot(s, data, maze_bits_hash(data, s->nwords), &slot);
+}
+
+/*
+ * seen_insert_hash -- insert a bare hash (lossy mode), as read back from a
+ * checkpoint.
+ */
+static void seen_insert_hash(SeenSet *s, uint64_t hash) {
+    if ((size_t)(s->count + 1) * 8 > (size_t)s->ngroups * SEEN_GROUP * 7)
+        seen_rebuild(s);
+    size_t slot;
+    if (seen_find_slot(s, NULL, hash, &slot)) return;
+    s->ctrl[slot] = (uint8_t)(hash >> 57);
+    s->hashes[slot] = hash;
+    s->count++;
+}
+
+static void seen_insert(SeenSet *s, const uint64_t *data) {
+    /* Keep the load below 7/8 so every probe sequence reaches an empty slot */
+    if ((size_t)(s->count + 1) * 8 > (size_t)s->ngroups * SEEN_GROUP * 7)
+        seen_rebuild(s);
+    uint64_t hash = maze_bits_hash(data, s->nwords);
+    size_t slot;
+    if (seen_find_slot(s, data, hash, &slot)) return;
+
+    s->ctrl[slot] = (uint8_t)(hash >> 57);
+    if (s->lossy) {
+        s->hashes[slot] = hash;
+    } else {
+        uint32_t id = (uint32_t)s->count;
+        if ((id >> SEEN_CHUNK_SHIFT) == (uint32_t)s->nchunks) {
+            s->chunks = realloc(s->chunks, (s->nchunks + 1) * sizeof(uint64_t *));
+            s->chunks[s->nchunks++] =
+                malloc(((size_t)1 << SEEN_CHUNK_SHIFT) * s->nwords * sizeof(uint64_t));
+        }
+        memcpy(seen_key(s, id), data, s->nwords * sizeof(uint64_t));
+        s->ids[slot] = id;
+    }
+    s->count++;
+}
+
+/* seen_bytes -- memory held by the set (table plus key arena). */
+static size_t seen_bytes(const SeenSet *s) {
+    size_t nslots = (size_t)s->ngroups * SEEN_GROUP;
+    size_t bytes = nslots * (1 + (s->lossy ? sizeof(uint64_t) : sizeof(uint32_t)));
+    bytes += (size_t)s->nchunks * ((size_t)1 << SEEN_CHUNK_SHIFT) * s->nwords * sizeof(uint64_t);
+    return bytes;
+}
+
+static void seen_free(SeenSet *s) {
+    for (int i = 0; i < s->nchunks; i++)
+        free(s->chunks[i]);
+    free(s->chunks);
+    free(s->ctrl);
+    free(s->ids);
+    free(s->hashes);
+}
+
+/* --- Top-down search --- */
+
+#define TD_LEN_UNKNOWN  UINT64_MAX
+
+/*
+ * Checkpoint file layout (native-endian 64-bit words):
+ *   magic "RMTDCKP2"
+ *   nterm, directed, lossy, nwords, item_words, spill_seq, seen count,
+ *   nbuckets, best_len, popped, solved, inherited, pruned
+ *   best maze (nwords, zero if none)
+ *   seen keys: packed mazes in id order, or bare hashes when lossy
+ *   per bucket: mem, nruns, mem items bottom to top, (seq, count) per run
+ *                oldest first
+ *   magic again, so a truncated file is rejected
+ * The file is written to <path>.tmp and renamed over the old one.
+ */
+#define TD_CKPT_MAGIC  0x32504b4354444d52ULL   /* "RMTDCKP2" */
+#define TD_CKPT_HEADER 13
+
+enum { TD_POPPED, TD_SOLVED, TD_INHERITED, TD_PRUNED, TD_NCOUNTERS };
+
+static int ckpt_put(FILE *fp, const uint64_t *w, size_t n) {
+    return fwrite(w, sizeof(uint64_t), n, fp) == n;
+}
+
+static int ckpt_get(FILE *fp, uint64_t *w, size_t n) {
+    return fread(w, sizeof(uint64_t), n, fp) == n;
+}
+
+/*
+ * td_checkpoint_write -- snapshot the seen set, the queue (in-memory items
+ * and the names of spilled runs), the counters and the best maze.
+ * Returns 1 on success.
+ */
+static int td_checkpoint_write(const char *path, int nterm, int directed,
+                               const SeenSet *seen, const BucketQueue *q,
+                               const uint64_t *counters, int best_len,
+                               const uint64_t *best_bits) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return 0;
+
+    int nwords = seen->nwords;
+    uint64_t magic = TD_CKPT_MAGIC;
+    uint64_t hdr[TD_CKPT_HEADER] = {
+        (uint64_t)nterm, (uint64_t)directed, (uint64_t)seen->lossy,
+        (uint64_t)nwords, (uint64_t)q->item_words, q->spill_seq,
+        (uint64_t)seen->count, (uint64_t)(q->max + 1), (uint64_t)best_len,
+        counters[TD_POPPED], counters[TD_SOLVED], counters[TD_INHERITED],
+        counters[TD_PRUNED],
+    };
+    int ok = ckpt_put(fp, &magic, 1) && ckpt_put(fp, hdr, TD_CKPT_HEADER) &&
+             ckpt_put(fp, best_bits, nwords);
+
+    if (seen->lossy) {
+        size_t nslots = (size_t)seen->ngroups * SEEN_GROUP;
+        for (size_t i = 0; ok && i < nslots; i++)
+            if (seen->ctrl[i] != SEEN_EMPTY)
+                ok = ckpt_put(fp, &seen->hashes[i], 1);
+    } else {
+        for (int id = 0; ok && id < seen->count; id++)
+            ok = ckpt_put(fp, seen_key(seen, (uint32_t)id), nwords);
+    }
+
+    for (int p = 0; ok && p <= q->max; p++) {
+        const BQBucket *b = &q->buckets[p];
+        uint64_t nruns = 0;
+        for (const BQRun *r = b->runs; r; r = r->next) nruns++;
+        uint64_t bh[2] = {b->mem, nruns};
+        ok = ckpt_put(fp, bh, 2);
+
+        /* Chunks are linked top-down; write them bottom-up */
+        size_t nchunks = 0;
+        for (const BQChunk *c = b->top; c; c = c->prev) nchunks++;
+        const BQChunk **chunks = malloc((nchunks + 1) * sizeof(*chunks));
+        size_t ci = nchunks;
+        for (const BQChunk *c = b->top; c; c = c->prev) chunks[--ci] = c;
+        for (ci = 0; ok && ci < nchunks; ci++)
+            ok = ckpt_put(fp, chunks[ci]->data,
+                          (size_t)chunks[ci]->count * q->item_words);
+        free(chunks);
+
+        const BQRun **runs = malloc((nruns + 1) * sizeof(*runs));
+        size_t ri = nruns;
+        for (const BQRun *r = b->runs; r; r = r->next) runs[--ri] = r;
+        for (ri = 0; ok && ri < nruns; ri++) {
+            uint64_t rw[2] = {runs[ri]->seq, runs[ri]->count};
+            ok = ckpt_put(fp, rw, 2);
+        }
+        free(runs);
+    }
+    ok = ok && ckpt_put(fp, &magic, 1);
+    if (fclose(fp) != 0) ok = 0;
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    if (!ok) remove(tmp);
+    return ok;
+}
+
+/*
+ * td_checkpoint_read -- restore a snapshot written by td_checkpoint_write
+ * into an empty seen set and queue. Returns 1 on success, 0 if the file
+ * does not exist, -1 if it is unreadable or belongs to another search.
+ */
+static int td_checkpoint_read(const char *path, int nterm, int directed,
+                              SeenSet *seen, BucketQueue *q, uint64_t *counters,
+                              int *best_len, uint64_t *best_bits) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+
+    int nwords = seen->nwords;
+    uint64_t magic, hdr[TD_CKPT_HEADER];
+    int ok = ckpt_get(fp, &magic, 1) && magic == TD_CKPT_MAGIC &&
+             ckpt_get(fp, hdr, TD_CKPT_HEADER) &&
+             hdr[0] == (uint64_t)nterm && hdr[1] == (uint64_t)directed &&
+             hdr[2] == (uint64_t)seen->lossy && hdr[3] == (uint64_t)nwords &&
+             hdr[4] == (uint64_t)q->item_words &&
+             ckpt_get(fp, best_bits, nwords);
+    if (!ok) {
+        fclose(fp);
+        return -1;
+    }
+    q->spill_seq = hdr[5];
+    *best_len = (int)hdr[8];
+    counters[TD_POPPED]    = hdr[9];
+    counters[TD_SOLVED]    = hdr[10];
+    counters[TD_INHERITED] = hdr[11];
+    counters[TD_PRUNED]    = hdr[12];
+
+    uint64_t *item = malloc(q->item_words * sizeof(uint64_t));
+    for (uint64_t i = 0; ok && i < hdr[6]; i++) {
+        ok = ckpt_get(fp, item, seen->lossy ? 1 : nwords);
+        if (!ok) break;
+        if (seen->lossy) seen_insert_hash(seen, item[0]);
+        else seen_insert(seen, item);
+    }
+
+    for (int p = 0; ok && (uint64_t)p < hdr[7]; p++) {
+        uint64_t bh[2];
+        if (!(ok = ckpt_get(fp, bh, 2))) break;
+        if (bh[1] > 0 && !q->spill_dir) {
+            fprintf(stderr, "Error: checkpoint %s has spilled runs; --spill-dir is required\n", path);
+            ok = 0;
+            break;
+        }
+        /* Items first (pushing them may spill), runs go below them */
+        BQRun *runs = NULL;
+        uint64_t nitems = bh[0];
+        for (uint64_t i = 0; ok && i < nitems; i++)
+            if ((ok = ckpt_get(fp, item, q->item_words)))
+                bq_push(q, p, item);
+        for (uint64_t ri = 0; ok && ri < bh[1]; ri++) {
+            uint64_t rw[2];
+            if (!(ok = ckpt_get(fp, rw, 2))) break;
+            BQRun *r = malloc(sizeof(BQRun));
+            r->prio = p;
+            r->seq = rw[0];
+            r->count = rw[1];
+            r->next = runs;
+            runs = r;
+        }
+        if (!ok) {
+            while (runs) {
+                BQRun *next = runs->next;
+                free(runs);
+                runs = next;
+            }
+            break;
+        }
+        if (runs) {
+            /* Append the restored (older) runs below any runs just spilled */
+            bq_reserve(q, p);
+            BQBucket *b = &q->buckets[p];
+            BQRun **tail = &b->runs;
+            while (*tail) tail = &(*tail)->next;
+            *tail = runs;
+            for (BQRun *r = runs; r; r = r->next) {
+                b->count += r->count;
+                q->count += r->count;
+                q->spilled_runs++;
+            }
+            if (p > q->max) q->max = p;
+        }
+    }
+    free(item);
+    ok = ok && ckpt_get(fp, &magic, 1) && magic == TD_CKPT_MAGIC;
+    fclose(fp);
+    return ok ? 1 : -1;
+}
+
+#define TD_BATCH_PER_THREAD 8
+
+/* td_beam_admit() verdicts */
+enum { TD_ADMIT, TD_DROP_FULL, TD_DROP_SIMILAR };
+
+#define TD_BEAM_RING       32   /* recently admitted keys kept per level */
+#define TD_BEAM_DROPS_MIN  16   /* drop cache entries >= 1 << bits ... */
+#define TD_BEAM_DROPS_MAX  22   /* ... and <= 1 << bits */
+
+/*
+ * TDBeam -- admission state of beam mode.
+ *
+ * A level is the path length of the parents whose children it collects
+ * (the bucket the children are pushed into); a level holds at most width
+ * queued mazes. The diversity test compares a child with the last
+ * TD_BEAM_RING mazes admitted at its level (siblings, the typical
+ * near-duplicates, are generated together), so admission costs
+ * O(TD_BEAM_RING) instead of a scan of the bucket.
+ *
+ * Admitted children go into the seen set as usual; dropped ones go into
+ * drops, a direct-mapped table of their hashes sized from the width when
+ * the search starts. Workers skip a child found there right after
+ * canonicalization, so a dropped child that other parents generate again
+ * is not offered again. A child whose entry was overwritten is simply
+ * judged again.
+ */
+typedef struct {
+    int nwords;
+    int width;
+    int diversity;
+    int nlevels;
+    uint64_t *admitted;         /* per level, for the ring position */
+    uint64_t **ring;            /* per level: TD_BEAM_RING keys, or NULL */
+    uint64_t *drops;            /* drops_mask + 1 hashes, 0 = empty */
+    uint64_t drops_mask;
+} TDBeam;
+
+static void td_beam_init(TDBeam *bm, int nwords, int width, int diversity) {
+    memset(bm, 0, sizeof(*bm));
+    bm->nwords = nwords;
+    bm->width = width;
+    bm->diversity = diversity;
+    int bits = TD_BEAM_DROPS_MIN;
+    while (bits < TD_BEAM_DROPS_MAX && ((uint64_t)1 << bits) < (uint64_t)width * 64)
+        bits++;
+    bm->drops_mask = ((uint64_t)1 << bits) - 1;
+    bm->drops = calloc(bm->drops_mask + 1, sizeof(uint64_t));
+}
+
+static void td_beam_free(TDBeam *bm) {
+    for (int i = 0; i < bm->nlevels; i++)
+        free(bm->ring[i]);
+    free(bm->ring);
+    free(bm->admitted);
+    free(bm->drops);
+}
+
+/* td_beam_hash -- drop cache value of a key (never 0). */
+static uint64_t td_beam_hash(const TDBeam *bm, const uint64_t *key) {
+    uint64_t h = maze_bits_hash(key, bm->nwords);
+    return h ? h : 1;
+}
+
+/* td_beam_dropped -- 1 if key is in the drop cache. */
+static int td_beam_dropped(const TDBeam *bm, const uint64_t *key) {
+    uint64_t h = td_beam_hash(bm, key);
+    return bm->drops[h & bm->drops_mask] == h;
+}
+
+/*
+ * td_beam_admit -- beam admission of a child into level: dropped if the
+ * level's bucket already holds width mazes, or if a recently admitted
+ * maze of the level is within Hamming distance < diversity of its packed
+ * key. A dropped child goes into the drop cache, an admitted one into the
+ * level's ring.
+ */
+static int td_beam_admit(TDBeam *bm, const BucketQueue *q, int level,
+                         const uint64_t *key) {
+    int nwords = bm->nwords;
+    int verdict = TD_ADMIT;
+    if (level < q->nbuckets && q->buckets[level].count >= (uint64_t)bm->width) {
+        verdict = TD_DROP_FULL;
+    } else if (bm->diversity > 0) {
+        if (level >= bm->nlevels) {
+            int n = bm->nlevels ? bm->nlevels : 16;
+            while (n <= level) n *= 2;
+            bm->admitted = realloc(bm->admitted, n * sizeof(uint64_t));
+            bm->ring = realloc(bm->ring, n * sizeof(uint64_t *));
+            memset(bm->admitted + bm->nlevels, 0, (n - bm->nlevels) * sizeof(uint64_t));
+            memset(bm->ring + bm->nlevels, 0, (n - bm->nlevels) * sizeof(uint64_t *));
+            bm->nlevels = n;
+        }
+        uint64_t n = bm->admitted[level] < TD_BEAM_RING ? bm->admitted[level] : TD_BEAM_RING;
+        for (uint64_t k = 0; k < n && verdict == TD_ADMIT; k++) {
+            const uint64_t *other = bm->ring[level] + k * nwords;
+            int dist = 0;
+            for (int w = 0; w < nwords && dist < bm->diversity; w++)
+                dist += __builtin_popcountll(key[w] ^ other[w]);
+            if (dist < bm->diversity) verdict = TD_DROP_SIMILAR;
+        }
+        if (verdict == TD_ADMIT) {
+            if (!bm->ring[level])
+                bm->ring[level] = malloc((size_t)TD_BEAM_RING * nwords * sizeof(uint64_t));
+            memcpy(bm->ring[level] + (bm->admitted[level] % TD_BEAM_RING) * nwords,
+                   key, nwords * sizeof(uint64_t));
+            bm->admitted[level]++;
+        }
+    }
+    if (verdict != TD_ADMIT) {
+        uint64_t h = td_beam_hash(bm, key);
+        bm->drops[h & bm->drops_mask] = h;
+    }
+    return verdict;
+}
+
+#define TD_RAW_CACHE_BITS   16  /* raw-hash cache entries per worker = 1 << bits */
+
+/*
+ * TDSlot -- one popped maze of a top-down batch and the result of
+ * expanding it: its length (item[2*nwords] and the critical set are filled
+ * in) and the children that survived deduplication against the seen set
+ * and abstract pruning, in generation order.
+ */
+typedef struct {
+    uint64_t *item;             /* item_words words */
+    int prio;
+    int len;                    /* -1 if unsolvable */
+    int solved;                 /* length computed here, not inherited */
+    uint64_t pruned;            /* unsolvable self or pruned children */
+    uint64_t raw_hits;          /* children skipped by the raw-hash cache */
+    uint64_t drop_hits;         /* children skipped by the beam drop cache */
+    uint64_t *db_key;           /* result database key (with result_db) */
+    int db_keyed;               /* db_key is set: store the length */
+    uint64_t *children;         /* nchildren * item_words words */
+    int nchildren;
+    int cap;
+} TDSlot;
+
+/*
+ * TDWorker -- per-thread scratch kept across batches.
+ *
+ * raw_cache is a direct-mapped set of Zobrist hashes of raw (not yet
+ * canonicalized) children this worker has generated. Parents are stored
+ * canonical, so equal raw children are equal canonical children, and one
+ * generated before was already deduplicated, pruned or queued; a cache hit
+ * skips canonicalization entirely. A 64-bit hash collision can skip an
+ * unseen child, with probability about 2^-64 per lookup.
+ */
+typedef struct {
+    Maze *m;
+    Maze *crit_maze;
+    uint64_t *raw_cache;
+    AbstractCounts ac;          /* abstract edges of the maze being expanded */
+} TDWorker;
+
+/*
+ * TDShared -- a batch being expanded. Workers claim slots through the
+ * atomic `next` counter; the seen set is only read while they run.
+ */
+typedef struct {
+    int nterm;
+    int directed;
+    int nwords;
+    int item_words;
+    int total;
+    const SeenSet *seen;
+    const uint64_t *zobrist;    /* one random key per port */
+    const uint16_t *port_aedge; /* abstract edge of each port */
+    int nanodes;                /* abstract nodes (2 * nterm) */
+    const TDBeam *beam;         /* NULL unless in beam mode */
+    TDSlot *slots;
+    int nslots;
+    atomic_int next;
+    TDWorker *workers;
+    atomic_int next_worker;
+} TDShared;
+
+/*
+ * td_expand -- solve a popped maze unless its length was inherited, then
+ * generate its children: remove one active port at a time (a port and its
+ * reverse together in the undirected case) and canonicalize. A child whose
+ * removed port was not critical in its parent inherits the parent's length
+ * and critical set, relabelled by the canonicalizing permutation.
+ */
+static void td_expand(const TDShared *t, TDSlot *sl, TDWorker *w) {
+    int nwords = t->nwords, iw = t->item_words;
+    Maze *m = w->m, *crit_maze = w->crit_maze;
+    uint64_t *data = sl->item;
+    uint64_t *crit = data + nwords;
+    sl->nchildren = 0;
+    sl->pruned = 0;
+    sl->raw_hits = 0;
+    sl->drop_hits = 0;
+    sl->solved = 0;
+    sl->db_keyed = 0;
+
+    /* Load into maze (stored mazes are already symmetric) */
+    maze_from_bits(m, data);
+
+    /*
+     * The shortest-path DAG needs BFS distances, so lengths always come
+     * from BFS; IDDFS (without --bfs) only produces the reported path.
+     */
+    if (data[2 * nwords] != TD_LEN_UNKNOWN) {
+        sl->len = (int)data[2 * nwords];
+    } else {
+        sl->len = solve_bfs_critical(m, crit);
+        if (!t->directed)
+            maze_bits_make_undirected(m, crit);
+        /* Key by canonical core, like every other strategy's lookups */
+        if (sl->db_key)
+            sl->db_keyed = maze_db_key(m, crit_maze, sl->db_key);
+        if (sl->len < 0) {
+            /* Unreachable: discard */
+            sl->pruned = 1;
+            return;
+        }
+        sl->solved = 1;
+        data[2 * nwords] = (uint64_t)sl->len;
+    }
+
+    /* Zobrist hash of the parent; a child's is one or two XORs away */
+    uint64_t parent_hash = 0;
+    for (int wi = 0; wi < nwords; wi++)
+        for (uint64_t bits = data[wi]; bits; bits &= bits - 1)
+            parent_hash ^= t->zobrist[wi * 64 + __builtin_ctzll(bits)];
+    uint64_t cache_mask = ((uint64_t)1 << TD_RAW_CACHE_BITS) - 1;
+
+    abstract_counts_build(&w->ac, data, nwords, t->port_aedge, t->nanodes);
+
+    for (int i = 0; i < t->total; i++) {
+        if (!maze_bits_get(data, i)) continue;
+        int ri = t->directed ? i : maze_reverse_port(m, i);
+        if (ri < i) continue;
+        int inherit = !maze_bits_get(crit, i) && !maze_bits_get(crit, ri);
+
+        /* Raw-hash cache: skip children generated before */
+        uint64_t raw = parent_hash ^ t->zobrist[i];
+        if (ri != i) raw ^= t->zobrist[ri];
+        raw |= 1;               /* 0 marks an empty entry */
+        uint64_t *entry = &w->raw_cache[(raw >> 1) & cache_mask];
+        if (*entry == raw) {
+            sl->raw_hits++;
+            continue;
+        }
+        *entry = raw;
+
+        /*
+         * Abstract reachability pruning, decided on the raw child from
+         * the parent's edge counts (an inherited child is solvable).
+         */
+        if (!inherit &&
+            !abstract_counts_connected_without(&w->ac, t->port_aedge[i],
+                                               ri != i ? t->port_aedge[ri] : -1)) {
+            sl->pruned++;
+            continue;
+        }
+
+        if (sl->nchildren == sl->cap) {
+            sl->cap = sl->cap ? sl->cap * 2 : 64;
+            sl->children = realloc(sl->children, (size_t)sl->cap * iw * sizeof(uint64_t));
+        }
+        uint64_t *child = sl->children + (size_t)sl->nchildren * iw;
+
+        /* Create child: remove port i (and its reverse) */
+        memcpy(child, data, nwords * sizeof(uint64_t));
+        maze_bits_clear(child, i);
+        maze_bits_clear(child, ri);
+
+        /* Canonicalize child */
+        MazePerm perm;
+        maze_from_bits(m, child);
+        maze_canonicalize(m, &perm);
+        maze_to_bits(m, child);
+
+        /* Dedup */
+        if (seen_contains(t->seen, child)) continue;
+        if (t->beam && td_beam_dropped(t->beam, child)) {
+            sl->drop_hits++;
+            continue;
+        }
+
+        if (inherit) {
+            /* Same shortest paths: relabel the parent's critical set */
+            maze_from_bits(crit_maze, crit);
+            maze_permute(crit_maze, &perm);
+            maze_to_bits(crit_maze, child + nwords);
+            child[2 * nwords] = (uint64_t)sl->len;
+        } else {
+            memset(child + nwords, 0, nwords * sizeof(uint64_t));
+            child[2 * nwords] = TD_LEN_UNKNOWN;
+        }
+        sl->nchildren++;
+    }
+}
+
+static void *td_worker(void *arg) {
+    TDShared *t = arg;
+    TDWorker *w = &t->workers[atomic_fetch_add(&t->next_worker, 1)];
+    for (;;) {
+        int i = atomic_fetch_add(&t->next, 1);
+        if (i >= t->nslots) break;
+        td_expand(t, &t->slots[i], w);
+    }
+    return NULL;
+}
+
+/* td_expand_batch -- expand slots[0..nslots) with up to nthreads workers. */
+static void td_expand_batch(TDShared *t, int nthreads) {
+    atomic_store(&t->next, 0);
+    atomic_store(&t->next_worker, 0);
+    if (nthreads > t->nslots) nthreads = t->nslots;
+    if (nthreads <= 1) {
+        td_worker(t);
+        return;
+    }
+    pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
+    for (int i = 0; i < nthreads; i++)
+        pthread_create(&tids[i], NULL, td_worker, t);
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    free(tids);
+}
+
+QMResult quizmaster_topdown_search(int nterm, int max_len, int use_bfs, int directed,
+                                   const QMTopdownOptions *opts) {
+    QMResult result = {NULL, 0, NULL, 0};
+    if (nterm < 2) return result;
+    int lossy_seen = opts ? opts->lossy_seen : 0;
+    const char *spill_dir = opts ? opts->spill_dir : NULL;
+    const char *checkpoint = opts ? opts->checkpoint : NULL;
+    size_t spill_mem = opts && opts->spill_mem ? opts->spill_mem : (size_t)1 << 30;
+    int checkpoint_interval = opts && opts->checkpoint_interval > 0
+                                  ? opts->checkpoint_interval : 600;
+    int nthreads = opts && opts->nthreads > 1 ? opts->nthreads : 1;
+    int beam = opts && opts->beam > 0 ? opts->beam : 0;
+    int diversity = opts ? opts->diversity : 0;
+    if (beam && spill_dir) {
+        fprintf(stderr, "Warning: --spill-dir is ignored in beam mode\n");
+        spill_dir = NULL;
+    }
+
+    interrupted = 0;
+    struct sigaction sa, old_sa;
+    sa.sa_handler = sigint_handler;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_sa);
+
+    Maze *m = maze_create(nterm);
+    m->directed = directed;
+    int total = m->total_nports;
+
+    /* Build candidate list (exclude self-loop ports) */
+    int *candidates = malloc(total * sizeof(int));
+    int ncand = 0;
+    for (int i = 0; i < total; i++)
+        if (!is_self_loop_port(m, i))
+            candidates[ncand++] = i;
+
+    fprintf(stderr, "Top-down search: %d candidates (excluding %d self-loops), %d thread%s%s\n",
+            ncand, total - ncand, nthreads, nthreads > 1 ? "s" : "",
+            lossy_seen ? ", lossy seen set" : "");
+    if (beam)
+        fprintf(stderr, "Beam mode: at most %d queued mazes per length, min Hamming distance %d\n",
+                beam, diversity);
+
+    /* Start: fully-connected maze (all candidates active) */
+    maze_clear(m);
+    for (int i = 0; i < ncand; i++)
+        maze_set_port(m, candidates[i], 1);
+    if (!directed)
+        maze_make_undirected(m);
+
+    free(candidates);
+
+    /* Seen set */
+    int nwords = maze_bits_nwords(m);
+    SeenSet seen;
+    seen_init(&seen, nwords, lossy_seen);
+
+    /*
+     * Stack items hold [maze | critical ports | length] in 2*nwords+1 words.
+     * The length is TD_LEN_UNKNOWN until solved; a child whose removed port
+     * was not critical in its parent inherits the parent's length and
+     * critical set (the set of shortest paths is unchanged).
+     */
+    int item_words = 2 * nwords + 1;
+    BucketQueue queue;
+    bq_init(&queue, item_words);
+    if (spill_dir) {
+        mkdir(spill_dir, 0777);
+        queue.spill_dir = spill_dir;
+        queue.mem_limit = spill_mem / (item_words * sizeof(uint64_t));
+        if (queue.mem_limit == 0) queue.mem_limit = 1;
+        fprintf(stderr, "Spilling to %s above %zu MB (%llu items)\n", spill_dir,
+                spill_mem >> 20, (unsigned long long)queue.mem_limit);
+    }
+    queue.keep_retired = checkpoint != NULL;
+    uint64_t *flat = calloc(item_words, sizeof(uint64_t));
+
+    Maze *best = NULL;
+    int best_len = 0;
+    State *best_path = NULL;
+    int best_path_len = 0;
+    uint64_t counters[TD_NCOUNTERS] = {0};
+    uint64_t *best_bits = calloc(nwords, sizeof(uint64_t));
+
+    int resumed = checkpoint ? td_checkpoint_read(checkpoint, nterm, directed, &seen,
+                                                  &queue, counters, &best_len, best_bits)
+                             : 0;
+    if (resumed < 0) {
+        fprintf(stderr, "Error: cannot resume from checkpoint %s\n", checkpoint);
+        free(flat);
+        free(best_bits);
+        bq_free(&queue);
+        seen_free(&seen);
+        maze_destroy(m);
+        sigaction(SIGINT, &old_sa, NULL);
+        return result;
+    }
+    if (resumed) {
+        fprintf(stderr, "Resumed from %s: popped=%llu seen=%d queued=%llu best=%d\n",
+                checkpoint, (unsigned long long)counters[TD_POPPED], seen.count,
+                (unsigned long long)queue.count, best_len);
+        if (best_len > 0) {
+            best = maze_create(nterm);
+            best->directed = directed;
+            maze_from_bits(best, best_bits);
+            if (use_bfs) solve_bfs(best, &best_path, &best_path_len);
+            else solve_from(best, best_len, &best_path, &best_path_len);
+        }
+    } else {
+        maze_to_bits(m, flat);
+        flat[2 * nwords] = TD_LEN_UNKNOWN;
+        bq_push(&queue, 1, flat);
+        seen_insert(&seen, flat);
+    }
+    uint64_t total_popped = counters[TD_POPPED];
+    uint64_t total_solved = counters[TD_SOLVED];
+    uint64_t total_pruned = counters[TD_PRUNED];
+    uint64_t total_inherited = counters[TD_INHERITED];
+    time_t last_checkpoint = time(NULL);
+
+    /*
+     * Mazes are popped in batches, expanded in parallel against the seen
+     * set as it stood before the batch, and merged back in pop order, so
+     * the result depends on the thread count but not on scheduling. A
+     * single thread uses batches of one, i.e. plain best-first order.
+     */
+    int batch = nthreads > 1 ? nthreads * TD_BATCH_PER_THREAD : 1;
+    TDSlot *slots = calloc(batch, sizeof(TDSlot));
+    for (int b = 0; b < batch; b++) {
+        slots[b].item = malloc(item_words * sizeof(uint64_t));
+        if (result_db)
+            slots[b].db_key = malloc(nwords * sizeof(uint64_t));
+    }
+    uint64_t *zobrist = malloc((size_t)nwords * 64 * sizeof(uint64_t));
+    uint64_t zrng = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < nwords * 64; i++)
+        zobrist[i] = rng_next(&zrng);
+    int nanodes = 2 * nterm;
+    uint16_t *port_aedge = calloc((size_t)nwords * 64, sizeof(uint16_t));
+    for (int i = 0; i < total; i++) {
+        int asrc, adst;
+        port_abstract_edge(m, i, &asrc, &adst);
+        port_aedge[i] = (uint16_t)(asrc * nanodes + adst);
+    }
+    TDWorker *workers = calloc(nthreads, sizeof(TDWorker));
+    for (int i = 0; i < nthreads; i++) {
+        workers[i].m = maze_create(nterm);
+        workers[i].m->directed = directed;
+        workers[i].crit_maze = maze_create(nterm);
+        workers[i].crit_maze->directed = directed;
+        workers[i].raw_cache = calloc((size_t)1 << TD_RAW_CACHE_BITS, sizeof(uint64_t));
+    }
+    TDBeam bm;
+    if (beam) td_beam_init(&bm, nwords, beam, diversity);
+    TDShared shared = {nterm, directed, nwords, item_words, total, &seen, zobrist,
+                       port_aedge, nanodes, beam ? &bm : NULL, slots, 0, 0, workers, 0};
+    uint64_t total_raw_hits = 0;
+    uint64_t dropped_full = 0, dropped_similar = 0, drop_hits = 0;
+    uint64_t *dropped_by_len = NULL;    /* beam drops per bucket */
+    int dropped_nlen = 0;
+    uint64_t last_report = total_popped;
+
+    while (!interrupted) {
+        /* Pop up to `batch` mazes, highest buckets first */
+        int nb = 0;
+        while (nb < batch && (slots[nb].prio = bq_pop(&queue, slots[nb].item)) >= 0)
+            nb++;
+        if (nb == 0) break;
+        shared.nslots = nb;
+        td_expand_batch(&shared, nthreads);
+
+        int stop = 0;
+        for (int b = 0; b < nb && !stop; b++) {
+            TDSlot *sl = &slots[b];
+            total_popped++;
+            total_pruned += sl->pruned;
+            total_raw_hits += sl->raw_hits;
+            drop_hits += sl->drop_hits;
+            if (sl->db_keyed)
+                resultdb_insert(result_db, sl->db_key, sl->len);
+            if (sl->len < 0) continue;
+            if (sl->solved) total_solved++;
+
+            /* Update best */
+            if (sl->len > best_len) {
+                maze_from_bits(m, sl->item);
+                State *tmp_path = NULL;
+                int tmp_path_len = 0;
+                if (use_bfs)
+                    solve_bfs(m, &tmp_path, &tmp_path_len);
+                else
+                    solve_from(m, sl->len, &tmp_path, &tmp_path_len);
+                best_len = sl->len;
+                if (best) maze_copy(best, m);
+                else best = maze_clone(m);
+                memcpy(best_bits, sl->item, nwords * sizeof(uint64_t));
+                free(best_path);
+                best_path = tmp_path;
+                best_path_len = tmp_path_len;
+                fprintf(stderr, "[pop %llu, stack %d] new best: length %d\n",
+                        (unsigned long long)total_popped, sl->prio, best_len);
+                fprintf(stderr, "  ");
+                maze_fprint(stderr, best);
+                fprintf(stderr, "  ");
+                path_fprint(stderr, best_path, best_path_len);
+                if (max_len > 0 && best_len >= max_len) {
+                    /*
+                     * Put this maze and the rest of the batch back
+                     * unexpanded (last first, so they pop in the same
+                     * order) so a resumed run sees them.
+                     */
+                    for (int r = nb - 1; r >= b; r--)
+                        bq_push(&queue, slots[r].prio, slots[r].item);
+                    total_popped--;
+                    stop = 1;
+                    break;
+                }
+            }
+
+            /* Merge children; the batch may have produced duplicates */
+            for (int c = 0; c < sl->nchildren; c++) {
+                const uint64_t *child = sl->children + (size_t)c * item_words;
+                if (seen_contains(&seen, child)) continue;
+                if (beam) {
+                    if (td_beam_dropped(&bm, child)) {
+                        drop_hits++;
+                        continue;
+                    }
+                    int verdict = td_beam_admit(&bm, &queue, sl->len, child);
+                    if (verdict != TD_ADMIT) {
+                        if (verdict == TD_DROP_FULL) dropped_full++;
+                        else dropped_similar++;
+                        if (sl->len >= dropped_nlen) {
+                            int n = dropped_nlen ? dropped_nlen : 16;
+                            while (n <= sl->len) n *= 2;
+                            dropped_by_len = realloc(dropped_by_len, n * sizeof(uint64_t));
+                            memset(dropped_by_len + dropped_nlen, 0,
+                                   (n - dropped_nlen) * sizeof(uint64_t));
+                            dropped_nlen = n;
+                        }
+                        dropped_by_len[sl->len]++;
+                        continue;
+                    }
+                }
+                if (child[2 * nwords] != TD_LEN_UNKNOWN)
+                    total_inherited++;
+                seen_insert(&seen, child);
+                bq_push(&queue, sl->len, child);
+            }
+        }
+        if (stop) break;
+
+        if (total_popped / 10000 != last_report / 10000) {
+            /* Build stack size summary string */
+            char stackinfo[1024];
+            int pos = 0;
+            int first = 1;
+            for (int i = 0; i <= queue.max && pos < 900; i++) {
+                if (queue.buckets[i].count > 0) {
+                    pos += snprintf(stackinfo + pos, sizeof(stackinfo) - pos,
+                                    "%s%d:%llu", first ? "" : ",", i,
+                                    (unsigned long long)queue.buckets[i].count);
+                    first = 0;
+                }
+            }
+            if (first) snprintf(stackinfo, sizeof(stackinfo), "(empty)");
+            fprintf(stderr, "[topdown] popped=%llu solved=%llu inherited=%llu pruned=%llu raw_hits=%llu seen=%d (%.1f MB) best=%d stack={%s}\n",
+                    (unsigned long long)total_popped,
+                    (unsigned long long)total_solved,
+                    (unsigned long long)total_inherited,
+                    (unsigned long long)total_pruned,
+                    (unsigned long long)total_raw_hits,
+                    seen.count, (double)seen_bytes(&seen) / 1048576.0,
+                    best_len, stackinfo);
+            if (spill_dir)
+                fprintf(stderr, "[topdown] in-memory=%llu spilled runs=%llu\n",
+                        (unsigned long long)queue.mem,
+                        (unsigned long long)queue.spilled_runs);
+            if (beam)
+                fprintf(stderr, "[topdown] beam dropped: full=%llu similar=%llu repeats=%llu\n",
+                        (unsigned long long)dropped_full,
+                        (unsigned long long)dropped_similar,
+                        (unsigned long long)drop_hits);
+        }
+        if (checkpoint && total_popped / 1024 != last_report / 1024 &&
+            time(NULL) - last_checkpoint >= checkpoint_interval) {
+            counters[TD_POPPED] = total_popped;
+            counters[TD_SOLVED] = total_solved;
+            counters[TD_INHERITED] = total_inherited;
+            counters[TD_PRUNED] = total_pruned;
+            if (td_checkpoint_write(checkpoint, nterm, directed, &seen, &queue,
+                                    counters, best_len, best_bits)) {
+                bq_delete_retired(&queue);
+                fprintf(stderr, "[topdown] checkpoint written to %s\n", checkpoint);
+            } else {
+                fprintf(stderr, "Warning: cannot write checkpoint %s\n", checkpoint);
+            }
+            last_checkpoint = time(NULL);
+        }
+        last_report = total_popped;
+    }
+
+    for (int b = 0; b < batch; b++) {
+        free(slots[b].item);
+        free(slots[b].db_key);
+        free(slots[b].children);
+    }
+    free(slots);
+    for (int i = 0; i < nthreads; i++) {
+        maze_destroy(workers[i].m);
+        maze_destroy(workers[i].crit_maze);
+        free(workers[i].raw_cache);
+    }
+    free(workers);
+    free(zobrist);
+    free(port_aedge);
+
+    if (beam) {
+        /* Report what the beam discarded, by the length of the parent */
+        fprintf(stderr, "Beam dropped %llu children (%llu over width, %llu too similar)",
+                (unsigned long long)(dropped_full + dropped_similar),
+                (unsigned long long)dropped_full,
+                (unsigned long long)dropped_similar);
+        const char *sep = ": ";
+        for (int i = 0; i < dropped_nlen; i++)
+            if (dropped_by_len[i] > 0) {
+                fprintf(stderr, "%slen %d: %llu", sep, i,
+                        (unsigned long long)dropped_by_len[i]);
+                sep = ", ";
+            }
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Beam drop cache: %llu entries, %llu repeated children skipped\n",
+                (unsigned long long)(bm.drops_mask + 1), (unsigned long long)drop_hits);
+        free(dropped_by_len);
+        td_beam_free(&bm);
+    }
+
+    if (checkpoint) {
+        counters[TD_POPPED] = total_popped;
+        counters[TD_SOLVED] = total_solved;
+        counters[TD_INHERITED] = total_inherited;
+        counters[TD_PRUNED] = total_pruned;
+        if (td_checkpoint_write(checkpoint, nterm, directed, &seen, &queue,
+                                counters, best_len, best_bits)) {
+            bq_delete_retired(&queue);
+            fprintf(stderr, "Checkpoint written to %s (%llu queued)\n", checkpoint,
+                    (unsigned long long)queue.count);
+        } else {
+            fprintf(stderr, "Warning: cannot write checkpoint %s\n", checkpoint);
+        }
+    }
+
+    free(flat);
+    free(best_bits);
+    bq_free(&queue);
+    seen_free(&seen);
+
+    if (interrupted)
+        fprintf(stderr, "\nInterrupted by SIGINT.\n");
+
+    fprintf(stderr, "Top-down complete: %llu popped, %llu solved, %llu inherited, %llu pruned, %llu raw-cache hits, seen=%d, best=%d\n",
+            (unsigned long long)total_popped,
+            (unsigned long long)total_solved,
+            (unsigned long long)total_inherited,
+            (unsigned long long)total_pruned,
+            (unsigned long long)total_raw_hits,
+            seen.count, best_len);
+
+    if (best) {
+        result.best_maze     = best;
+        result.best_length   = best_len;
+        result.best_path     = best_path;
+        result.best_path_len = best_path_len;
+    }
+
+    maze_destroy(m);
+    sigaction(SIGINT, &old_sa, NULL);
+    return result;
+}
+
+/* ================================================================
+ * Simulated annealing: local search over port sets.
+ * ================================================================ */
+
+/*
+ * maze_fitness -- shortest path length of m, or 0 if it has no path.
+ * Abstractly disconnected mazes are rejected before the solver runs.
+ */
+static int maze_fitness(const Maze *m, Maze *scratch, int use_bfs) {
+    int len = maze_length(m, scratch, use_bfs);
+    return len < 0 ? 0 : len;
+}
+
+/*
+ * port_move_endpoint -- flat index of the port that differs from idx in one
+ * endpoint (source if `which` is 0, destination otherwise), with the new
+ * terminal drawn at random. nx/ny ports stay in their block. Returns -1 if
+ * the block has no alternative terminal (nx/ny with nterm = 2).
+ */
+static int port_move_endpoint(const Maze *m, int idx, int which, uint64_t *rng) {
+    int n = m->nterm;
+    if (idx < m->normal_nports) {
+        int n4 = 4 * n;
+        int s = idx / n4, d = idx % n4;
+        /* n4 - 2 choices: anything but the current and the other endpoint */
+        int t = (int)(rng_next(rng) % (uint64_t)(n4 - 2));
+        int lo = s < d ? s : d, hi = s < d ? d : s;
+        if (t >= lo) t++;
+        if (t >= hi) t++;
+        return which ? s * n4 + t : t * n4 + d;
+    }
+    if (n < 3) return -1;
+    int base = m->normal_nports;
+    int e = idx - base;
+    if (e >= m->nx_nports) {
+        base += m->nx_nports;
+        e -= m->nx_nports;
+    }
+    int si = e / (n - 1);
+    int adj = e % (n - 1);
+    int di = adj < si ? adj : adj + 1;
+    int t = (int)(rng_next(rng) % (uint64_t)(n - 2));
+    int lo = si < di ? si : di, hi = si < di ? di : si;
+    if (t >= lo) t++;
+    if (t >= hi) t++;
+    if (which) di = t;
+    else si = t;
+    return base + si * (n - 1) + (di < si ? di : di - 1);
+}
+
+/*
+ * AnnealMove -- the port units toggled by one move, kept for undo.
+ */
+typedef struct {
+    int idx[2];
+    int n;
+} AnnealMove;
+
+/*
+ * anneal_toggle -- flip one port unit: the port and, for undirected mazes,
+ * its reverse.
+ */
+static void anneal_toggle(Maze *m, int idx) {
+    maze_flip_port(m, idx);
+    if (!m->directed) {
+        int r = maze_reverse_port(m, idx);
+        if (r != idx) maze_flip_port(m, r);
+    }
+}
+
+/*
+ * anneal_unit -- representative of the port unit containing idx: the port
+ * itself when directed, the smaller of idx and its reverse otherwise.
+ */
+static int anneal_unit(const Maze *m, int idx) {
+    if (m->directed) return idx;
+    int r = maze_reverse_port(m, idx);
+    return r < idx ? r : idx;
+}
+
+/*
+ * anneal_propose -- apply one random move to m and record it in mv.
+ *
+ * units[] lists the port units (one index per unit). Moves:
+ *   flip     -- toggle a random unit (an active one when at max_aport)
+ *   swap     -- turn one active unit off and one inactive unit on
+ *   endpoint -- replace an active port by one sharing all but one endpoint
+ * A move that cannot apply falls back to flip. Returns 0 if nothing moved.
+ */
+static int anneal_propose(Maze *m, const int *units, int nunits, int max_aport,
+                          int moves, int *act, int *inact, uint64_t *rng,
+                          AnnealMove *mv) {
+    int nact = 0, ninact = 0;
+    for (int i = 0; i < nunits; i++) {
+        if (maze_get_port(m, units[i])) act[nact++] = units[i];
+        else inact[ninact++] = units[i];
+    }
+
+    int kinds[3], nkinds = 0;
+    if (moves & QM_MOVE_FLIP) kinds[nkinds++] = QM_MOVE_FLIP;
+    if (moves & QM_MOVE_SWAP) kinds[nkinds++] = QM_MOVE_SWAP;
+    if (moves & QM_MOVE_ENDPOINT) kinds[nkinds++] = QM_MOVE_ENDPOINT;
+    int kind = nkinds ? kinds[rng_next(rng) % (uint64_t)nkinds] : QM_MOVE_FLIP;
+
+    mv->n = 0;
+    if (kind == QM_MOVE_SWAP && nact > 0 && ninact > 0) {
+        mv->idx[mv->n++] = act[rng_next(rng) % (uint64_t)nact];
+        mv->idx[mv->n++] = inact[rng_next(rng) % (uint64_t)ninact];
+    } else if (kind == QM_MOVE_ENDPOINT && nact > 0) {
+        int a = act[rng_next(rng) % (uint64_t)nact];
+        int b = port_move_endpoint(m, a, (int)(rng_next(rng) & 1), rng);
+        if (b >= 0 && !maze_get_port(m, b)) {
+            mv->idx[mv->n++] = a;
+            mv->idx[mv->n++] = anneal_unit(m, b);
+        }
+    }
+    if (mv->n == 0) {
+        if (nact >= max_aport && nact > 0)
+            mv->idx[mv->n++] = act[rng_next(rng) % (uint64_t)nact];
+        else if (nunits > 0)
+            mv->idx[mv->n++] = units[rng_next(rng) % (uint64_t)nunits];
+    }
+    for (int i = 0; i < mv->n; i++)
+        anneal_toggle(m, mv->idx[i]);
+    return mv->n;
+}
+
+/*
+ * random_connected_start -- load a random abstractly connected maze with k
+ * port units (best effort after 1000 draws). scratch holds nunits ints.
+ */
+static void random_connected_start(Maze *m, const int *units, int nunits,
+                                   int k, int *scratch, uint64_t *rng) {
+    if (k > nunits) k = nunits;
+    for (int tries = 0; tries < 1000; tries++) {
+        for (int i = 0; i < nunits; i++)
+            scratch[i] = units[i];
+        maze_clear(m);
+        for (int i = 0; i < k; i++) {
+            int j = i + (int)(rng_next(rng) % (uint64_t)(nunits - i));
+            int tmp = scratch[i];
+            scratch[i] = scratch[j];
+            scratch[j] = tmp;
+            anneal_toggle(m, scratch[i]);
+        }
+        if (has_abstract_path(m)) return;
+    }
+}
+
+QMResult quizmaster_anneal_search(int nterm, int max_aport, int max_len,
+                                  unsigned int seed, int use_bfs, int directed,
+                                  const QMAnnealOptions *opts) {
+    QMResult result = {NULL, 0, NULL, 0};
+    if (nterm < 2) return result;
+
+    QMAnnealOptions o = {2.0, 0.05, 20000, 0, QM_MOVE_ALL, NULL};
+    if (opts) o = *opts;
+    if (o.steps == 0) o.steps = 1;
+    if (o.t_start <= 0) o.t_start = 1e-9;
+    if (o.t_end <= 0 || o.t_end > o.t_start) o.t_end = o.t_start;
+
+    interrupted = 0;
+    struct sigaction sa, old_sa;
+    sa.sa_handler = sigint_handler;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_sa);
+
+    Maze *m = maze_create(nterm);
+    m->directed = directed;
+    Maze *scratch = maze_create(nterm);
+    int total = m->total_nports;
+
+    /* Port units: non-self-loop ports, one per reverse pair if undirected */
+    int *units = malloc(total * sizeof(int));
+    int nunits = 0;
+    for (int i = 0; i < total; i++)
+        if (!is_self_loop_port(m, i) && anneal_unit(m, i) == i)
+            units[nunits++] = i;
+    if (max_aport <= 0 || max_aport > nunits) max_aport = nunits;
+    int *act = malloc((nunits > 0 ? nunits : 1) * sizeof(int));
+    int *inact = malloc((nunits > 0 ? nunits : 1) * sizeof(int));
+
+    fprintf(stderr, "Anneal search (seed=%u): %d port units, max_aport=%d, T=%g->%g over %llu steps, restarts=%d\n",
+            seed, nunits, max_aport, o.t_start, o.t_end,
+            (unsigned long long)o.steps, o.restarts);
+
+    uint64_t rng = rng_split(seed, 0);
+    double cool = pow(o.t_end / o.t_start, 1.0 / (double)o.steps);
+
+    Maze *best = NULL;
+    int best_len = 0;
+    State *best_path = NULL;
+    int best_path_len = 0;
+    uint64_t total_evals = 0;
+    uint64_t total_accepted = 0;
+
+    for (int r = 0; !interrupted && (o.restarts == 0 || r < o.restarts); r++) {
+        /* Warm start: the seed maze first, then the best maze so far */
+        if (r == 0 && o.seed_maze) {
+            maze_copy(m, o.seed_maze);
+            m->directed = directed;
+            if (!directed) maze_make_undirected(m);
+        } else if (best) {
+            maze_copy(m, best);
+        } else {
+            random_connected_start(m, units, nunits,
+                                   max_aport < 2 * nterm ? max_aport : 2 * nterm,
+                                   act, &rng);
+        }
+
+        int cur = maze_fitness(m, scratch, use_bfs);
+        total_evals++;
+        double temp = o.t_start;
+
+        for (uint64_t step = 0; ; step++) {
+            if (cur > best_len) {
+                best_len = cur;
+                if (best) maze_copy(best, m);
+                else best = maze_clone(m);
+                free(best_path);
+                best_path = NULL;
+                if (use_bfs) solve_bfs(m, &best_path, &best_path_len);
+                else solve(m, &best_path, &best_path_len);
+                fprintf(stderr, "[restart %d, step %llu] new best: length %d\n",
+                        r, (unsigned long long)step, best_len);
+                fprintf(stderr, "  ");
+                maze_fprint(stderr, best);
+                fprintf(stderr, "  ");
+                path_fprint(stderr, best_path, best_path_len);
+                if (max_len > 0 && best_len >= max_len) break;
+            }
+            if (step >= o.steps || interrupted) break;
+
+            AnnealMove mv;
+            if (!anneal_propose(m, units, nunits, max_aport, o.moves,
+                                act, inact, &rng, &mv))
+                break;
+            int next = maze_fitness(m, scratch, use_bfs);
+            total_evals++;
+
+            int delta = next - cur;
+            double u = (double)(rng_next(&rng) >> 11) * (1.0 / 9007199254740992.0);
+            if (delta >= 0 || u < exp((double)delta / temp)) {
+                cur = next;
+                total_accepted++;
+            } else {
+                for (int i = mv.n - 1; i >= 0; i--)
+                    anneal_toggle(m, mv.idx[i]);
+            }
+
+            if ((step + 1) % 1000 == 0)
+                fprintf(stderr, "[anneal] restart=%d step=%llu T=%.4f cur=%d best=%d evals=%llu accepted=%llu\n",
+                        r, (unsigned long long)(step + 1), temp, cur, best_len,
+                        (unsigned long long)total_evals,
+                        (unsigned long long)total_accepted);
+            temp *= cool;
+        }
+        if (max_len > 0 && best_len >= max_len) break;
+    }
+
+    if (interrupted)
+        fprintf(stderr, "\nInterrupted by SIGINT.\n");
+
+    fprintf(stderr, "Anneal search complete: %llu evaluated, %llu accepted, best length = %d\n",
+            (unsigned long long)total_evals, (unsigned long long)total_accepted, best_len);
 
     if (best) {
         result.best_maze     = best;
@@ -296,27 +3743,146 @@ search_done:
         result.best_path_len = best_path_len;
     }
 
+    free(act);
+    free(inact);
+    free(units);
+    maze_destroy(scratch);
+    maze_destroy(m);
+    sigaction(SIGINT, &old_sa, NULL);
+    return result;
+}
+
+/* ================================================================
+ * Genetic search: evolve a population of bit-packed port sets.
+ * ================================================================ */
+
+/*
+ * GAShared -- fitness-evaluation job shared by the worker threads of one
+ * generation. Workers claim individuals through the atomic `next` counter.
+ */
+typedef struct {
+    int nterm;
+    int directed;
+    int use_bfs;
+    int nwords;
+    const uint64_t *pop;        /* npop * nwords words */
+    int *fitness;
+    int npop;
+    atomic_int next;
+} GAShared;
+
+static void *ga_eval_worker(void *arg) {
+    GAShared *g = arg;
+    Maze *m = maze_create(g->nterm);
+    m->directed = g->directed;
+    Maze *scratch = maze_create(g->nterm);
+    for (;;) {
+        int i = atomic_fetch_add(&g->next, 1);
+        if (i >= g->npop || interrupted) break;
+        maze_from_bits(m, g->pop + (size_t)i * g->nwords);
+        g->fitness[i] = maze_fitness(m, scratch, g->use_bfs);
+    }
+    maze_destroy(scratch);
     maze_destroy(m);
-    return result;
+    return NULL;
+}
+
+/*
+ * ga_evaluate -- compute fitness[from..npop) with nthreads workers.
+ */
+static void ga_evaluate(GAShared *g, int from, int nthreads) {
+    atomic_store(&g->next, from);
+    if (nthreads <= 1) {
+        ga_eval_worker(g);
+        return;
+    }
+    pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
+    for (int t = 0; t < nthreads; t++)
+        pthread_create(&tids[t], NULL, ga_eval_worker, g);
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(tids[t], NULL);
+    free(tids);
+}
+
+/*
+ * ga_tournament -- index of the fittest of `size` random individuals.
+ */
+static int ga_tournament(const int *fitness, int npop, int size, uint64_t *rng) {
+    int best = (int)(rng_next(rng) % (uint64_t)npop);
+    for (int i = 1; i < size; i++) {
+        int c = (int)(rng_next(rng) % (uint64_t)npop);
+        if (fitness[c] > fitness[best]) best = c;
+    }
+    return best;
 }
 
 /*
- * quizmaster_random_search -- random sampling search with SIGINT handling.
+ * ga_crossover -- block-structured two-point crossover.
  *
- * Each iteration randomly picks k in [min_aport, max_aport] and selects
- * k random ports from the candidate set. Runs until SIGINT or max_len
- * is reached.
+ * The normal, nx and ny blocks are recombined independently: within each
+ * block a random contiguous range of port indices is taken from parent b
+ * and the rest from parent a. Normal ports are ordered by source terminal,
+ * so a range carries whole groups of ports leaving the same terminals.
  */
-QMResult quizmaster_random_search(int nterm, int min_aport, int max_aport,
-                                  int max_len, unsigned int seed, int use_bfs,
-                                  int directed) {
+static void ga_crossover(const Maze *m, const uint64_t *a, const uint64_t *b,
+                         uint64_t *child, int nwords, uint64_t *rng) {
+    memcpy(child, a, nwords * sizeof(uint64_t));
+    int start[3] = {0, m->normal_nports, m->normal_nports + m->nx_nports};
+    int len[3] = {m->normal_nports, m->nx_nports, m->ny_nports};
+    for (int blk = 0; blk < 3; blk++) {
+        if (len[blk] == 0) continue;
+        int lo = (int)(rng_next(rng) % (uint64_t)len[blk]);
+        int hi = (int)(rng_next(rng) % (uint64_t)len[blk]);
+        if (lo > hi) { int t = lo; lo = hi; hi = t; }
+        for (int i = start[blk] + lo; i <= start[blk] + hi; i++) {
+            if (maze_bits_get(b, i)) maze_bits_set(child, i);
+            else maze_bits_clear(child, i);
+        }
+    }
+}
+
+/*
+ * ga_repair -- make a child consistent: every unit's reverse port mirrors
+ * the unit (undirected), then random active units are dropped until at
+ * most max_aport remain. act is scratch space for nunits ints.
+ */
+static void ga_repair(uint64_t *child, const int *units, const int *rev,
+                      int nunits, int directed, int max_aport, int *act,
+                      uint64_t *rng) {
+    int nact = 0;
+    for (int i = 0; i < nunits; i++) {
+        int u = units[i];
+        int on = maze_bits_get(child, u);
+        if (!directed && rev[u] != u) {
+            if (on) maze_bits_set(child, rev[u]);
+            else maze_bits_clear(child, rev[u]);
+        }
+        if (on) act[nact++] = u;
+    }
+    while (nact > max_aport) {
+        int j = (int)(rng_next(rng) % (uint64_t)nact);
+        int u = act[j];
+        act[j] = act[--nact];
+        maze_bits_clear(child, u);
+        if (!directed) maze_bits_clear(child, rev[u]);
+    }
+}
+
+QMResult quizmaster_genetic_search(int nterm, int max_aport, int max_len,
+                                   unsigned int seed, int use_bfs, int directed,
+                                   const QMGeneticOptions *opts) {
     QMResult result = {NULL, 0, NULL, 0};
     if (nterm < 2) return result;
 
-    srand(seed);
-    interrupted = 0;
+    QMGeneticOptions o = {64, 0, 3, 2, 0.0, 1};
+    if (opts) o = *opts;
+    if (o.pop_size < 2) o.pop_size = 2;
+    if (o.tournament < 1) o.tournament = 1;
+    if (o.elite < 0) o.elite = 0;
+    if (o.elite >= o.pop_size) o.elite = o.pop_size - 1;
+    if (o.nthreads < 1) o.nthreads = 1;
 
-    /* Install SIGINT handler */
+    interrupted = 0;
     struct sigaction sa, old_sa;
     sa.sa_handler = sigint_handler;
     sa.sa_flags = 0;
@@ -324,118 +3890,133 @@ QMResult quizmaster_random_search(int nterm, int min_aport, int max_aport,
     sigaction(SIGINT, &sa, &old_sa);
 
     Maze *m = maze_create(nterm);
+    m->directed = directed;
     int total = m->total_nports;
+    int nwords = maze_bits_nwords(m);
 
-    /* Build candidate list (exclude self-loop ports) */
-    int *candidates = malloc(total * sizeof(int));
-    int ncand = 0;
+    int *units = malloc(total * sizeof(int));
+    int *rev = malloc(total * sizeof(int));
+    int nunits = 0;
     for (int i = 0; i < total; i++) {
-        if (!is_self_loop_port(m, i))
-            candidates[ncand++] = i;
+        rev[i] = maze_reverse_port(m, i);
+        if (!is_self_loop_port(m, i) && anneal_unit(m, i) == i)
+            units[nunits++] = i;
     }
+    if (max_aport <= 0 || max_aport > nunits) max_aport = nunits;
+    double mutation = o.mutation > 0 ? o.mutation : 1.0 / (nunits > 0 ? nunits : 1);
+    int *scratch = malloc((nunits > 0 ? nunits : 1) * sizeof(int));
 
-    fprintf(stderr, "Random search (seed=%u): %d candidates (excluding %d self-loops)\n",
-            seed, ncand, total - ncand);
+    fprintf(stderr, "Genetic search (seed=%u, threads=%d): %d port units, max_aport=%d, "
+            "population=%d, tournament=%d, elite=%d, mutation=%g\n",
+            seed, o.nthreads, nunits, max_aport, o.pop_size, o.tournament,
+            o.elite, mutation);
 
-    /* Clamp range to candidate count */
-    if (min_aport < 0) min_aport = 0;
-    if (max_aport > ncand) max_aport = ncand;
+    uint64_t rng = rng_split(seed, 0);
+    size_t pop_words = (size_t)o.pop_size * nwords;
+    uint64_t *pop = malloc(pop_words * sizeof(uint64_t));
+    uint64_t *next = malloc(pop_words * sizeof(uint64_t));
+    int *fitness = malloc(o.pop_size * sizeof(int));
+    int *order = malloc(o.pop_size * sizeof(int));
+    int *elite_fit = malloc((o.elite > 0 ? o.elite : 1) * sizeof(int));
+
+    /* Initial population: random connected mazes with 1..min(max_aport, 4n) units */
+    int kmax = max_aport < 4 * nterm ? max_aport : 4 * nterm;
+    if (kmax < 1) kmax = 1;
+    for (int i = 0; i < o.pop_size; i++) {
+        int k = 1 + (int)(rng_next(&rng) % (uint64_t)kmax);
+        random_connected_start(m, units, nunits, k, scratch, &rng);
+        maze_to_bits(m, pop + (size_t)i * nwords);
+    }
 
-    int k_range = max_aport - min_aport + 1;
+    GAShared g;
+    g.nterm = nterm;
+    g.directed = directed;
+    g.use_bfs = use_bfs;
+    g.nwords = nwords;
+    g.fitness = fitness;
+    g.npop = o.pop_size;
 
     Maze *best = NULL;
     int best_len = 0;
     State *best_path = NULL;
     int best_path_len = 0;
-    uint64_t total_evaluated = 0;
-    uint64_t total_solved = 0;
-    uint64_t total_pruned = 0;
+    uint64_t total_evals = 0;
+    int evaluated_from = 0;     /* elites keep their fitness */
 
-    /* Index array for Fisher-Yates shuffle */
-    int *indices = malloc(ncand * sizeof(int));
-
-    while (!interrupted) {
-        /* Pick random k */
-        int k = min_aport + rand() % k_range;
+    for (int gen = 0; !interrupted && (o.generations == 0 || gen < o.generations); gen++) {
+        g.pop = pop;
+        ga_evaluate(&g, evaluated_from, o.nthreads);
+        if (interrupted) break;
+        total_evals += o.pop_size - evaluated_from;
 
-        /* Select k random candidates via partial Fisher-Yates */
-        for (int i = 0; i < ncand; i++)
-            indices[i] = i;
-        for (int i = 0; i < k; i++) {
-            int j = i + rand() % (ncand - i);
-            int tmp = indices[i];
-            indices[i] = indices[j];
-            indices[j] = tmp;
+        /* Rank by fitness (insertion sort; populations are small) */
+        long sum = 0;
+        for (int i = 0; i < o.pop_size; i++) {
+            int f = fitness[i], j = i;
+            sum += f;
+            while (j > 0 && fitness[order[j - 1]] < f) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
         }
 
-        /* Set up the maze */
-        maze_clear(m);
-        for (int i = 0; i < k; i++)
-            maze_set_port(m, candidates[indices[i]], 1);
-        if (!directed)
-            maze_make_undirected(m);
-
-        /* Pruning: abstract terminal reachability */
-        if (has_abstract_path(m)) {
-            int len;
-            State *tmp_path = NULL;
-            int tmp_path_len = 0;
-            if (use_bfs) {
-                len = solve_bfs_len(m);
-            } else {
-                len = solve(m, &tmp_path, &tmp_path_len);
-            }
-            if (len < 0) len = 0;
-            total_solved++;
+        int top = order[0];
+        if (fitness[top] > best_len) {
+            best_len = fitness[top];
+            if (!best) best = maze_create(nterm);
+            maze_from_bits(best, pop + (size_t)top * nwords);
+            best->directed = directed;
+            free(best_path);
+            best_path = NULL;
+            if (use_bfs) solve_bfs(best, &best_path, &best_path_len);
+            else solve(best, &best_path, &best_path_len);
+            fprintf(stderr, "[gen %d] new best: length %d\n", gen, best_len);
+            fprintf(stderr, "  ");
+            maze_fprint(stderr, best);
+            fprintf(stderr, "  ");
+            path_fprint(stderr, best_path, best_path_len);
+        }
+        fprintf(stderr, "[genetic] gen=%d best=%d gen_best=%d mean=%.2f evals=%llu\n",
+                gen, best_len, fitness[top], (double)sum / o.pop_size,
+                (unsigned long long)total_evals);
+        if (max_len > 0 && best_len >= max_len) break;
 
-            if (len > best_len) {
-                if (use_bfs)
-                    solve_bfs(m, &tmp_path, &tmp_path_len);
-                best_len = len;
-                if (best) maze_destroy(best);
-                best = maze_clone(m);
-                free(best_path);
-                best_path = tmp_path;
-                best_path_len = tmp_path_len;
-                tmp_path = NULL;
-                fprintf(stderr, "[iter %llu, k=%d] new best: length %d\n",
-                        (unsigned long long)total_evaluated, k, best_len);
-                fprintf(stderr, "  ");
-                maze_fprint(stderr, best);
-                fprintf(stderr, "  ");
-                path_fprint(stderr, best_path, best_path_len);
-                if (max_len > 0 && best_len >= max_len)
-                    break;
-            } else {
-                free(tmp_path);
+        /* Elites survive unchanged, in rank order, with their fitness */
+        int nelite = o.elite;
+        for (int i = 0; i < nelite; i++) {
+            memcpy(next + (size_t)i * nwords, pop + (size_t)order[i] * nwords,
+                   nwords * sizeof(uint64_t));
+            elite_fit[i] = fitness[order[i]];
+        }
+        for (int i = nelite; i < o.pop_size; i++) {
+            int a = ga_tournament(fitness, o.pop_size, o.tournament, &rng);
+            int b = ga_tournament(fitness, o.pop_size, o.tournament, &rng);
+            uint64_t *child = next + (size_t)i * nwords;
+            ga_crossover(m, pop + (size_t)a * nwords, pop + (size_t)b * nwords,
+                         child, nwords, &rng);
+            for (int u = 0; u < nunits; u++) {
+                double r = (double)(rng_next(&rng) >> 11) * (1.0 / 9007199254740992.0);
+                if (r < mutation) maze_bits_flip(child, units[u]);
             }
-        } else {
-            total_pruned++;
         }
+        for (int i = nelite; i < o.pop_size; i++)
+            ga_repair(next + (size_t)i * nwords, units, rev, nunits, directed,
+                      max_aport, scratch, &rng);
+        for (int i = 0; i < nelite; i++)
+            fitness[i] = elite_fit[i];
+        evaluated_from = nelite;
 
-        total_evaluated++;
-
-        /* Progress reporting every 10000 iterations */
-        if (total_evaluated % 10000 == 0) {
-            fprintf(stderr, "[random] iter=%llu best=%d solved=%llu pruned=%llu\n",
-                    (unsigned long long)total_evaluated,
-                    best_len,
-                    (unsigned long long)total_solved,
-                    (unsigned long long)total_pruned);
-        }
+        uint64_t *tmp = pop;
+        pop = next;
+        next = tmp;
     }
 
-    free(indices);
-    free(candidates);
-
     if (interrupted)
         fprintf(stderr, "\nInterrupted by SIGINT.\n");
 
-    fprintf(stderr, "Random search complete: %llu evaluated, %llu solved, %llu pruned, best length = %d\n",
-            (unsigned long long)total_evaluated,
-            (unsigned long long)total_solved,
-            (unsigned long long)total_pruned,
-            best_len);
+    fprintf(stderr, "Genetic search complete: %llu evaluated, best length = %d\n",
+            (unsigned long long)total_evals, best_len);
 
     if (best) {
         result.best_maze     = best;
@@ -444,162 +4025,376 @@ QMResult quizmaster_random_search(int nterm, int min_aport, int max_aport,
         result.best_path_len = best_path_len;
     }
 
+    free(elite_fit);
+    free(order);
+    free(fitness);
+    free(next);
+    free(pop);
+    free(scratch);
+    free(rev);
+    free(units);
     maze_destroy(m);
-
-    /* Restore previous SIGINT handler */
     sigaction(SIGINT, &old_sa, NULL);
-
     return result;
 }
 
 /* ================================================================
- * Top-down search: start from fully-connected, remove ports one at a time.
+ * Monte Carlo tree search over incremental port additions.
  * ================================================================ */
 
-/* --- Dynamic stack of flat port arrays --- */
-
+/*
+ * KeySet -- insertion-ordered set of packed mazes. Keys live in one
+ * contiguous array (id i at keys + i*nwords) and an open-addressing table
+ * of ids finds them by hash.
+ */
 typedef struct {
-    uint8_t **items;
-    int count;
-    int cap;
-} PortStack;
+    uint64_t *keys;
+    int n, cap;
+    int nwords;
+    int *table;                 /* -1 = empty */
+    int table_size;             /* power of 2, kept above 2*n */
+} KeySet;
 
-static void ps_init(PortStack *s) {
-    s->cap = 64;
-    s->count = 0;
-    s->items = malloc(s->cap * sizeof(uint8_t *));
+static void keyset_init(KeySet *ks, int nwords) {
+    ks->nwords = nwords;
+    ks->n = 0;
+    ks->cap = 1024;
+    ks->keys = malloc((size_t)ks->cap * nwords * sizeof(uint64_t));
+    ks->table_size = 4096;
+    ks->table = malloc(ks->table_size * sizeof(int));
+    memset(ks->table, -1, ks->table_size * sizeof(int));
 }
 
-static void ps_push(PortStack *s, const uint8_t *data, int len) {
-    if (s->count >= s->cap) {
-        s->cap *= 2;
-        s->items = realloc(s->items, s->cap * sizeof(uint8_t *));
-    }
-    uint8_t *copy = malloc(len);
-    memcpy(copy, data, len);
-    s->items[s->count++] = copy;
+static void keyset_free(KeySet *ks) {
+    free(ks->keys);
+    free(ks->table);
+}
+
+static void keyset_table_insert(KeySet *ks, int id) {
+    uint64_t h = maze_bits_hash(ks->keys + (size_t)id * ks->nwords, ks->nwords);
+    int mask = ks->table_size - 1;
+    int i = (int)(h & (uint64_t)mask);
+    while (ks->table[i] >= 0)
+        i = (i + 1) & mask;
+    ks->table[i] = id;
 }
 
-static uint8_t *ps_pop(PortStack *s) {
-    if (s->count == 0) return NULL;
-    return s->items[--s->count];
+/*
+ * keyset_add -- id of `key`, inserting it if absent. *added (may be NULL)
+ * is set to 1 when the key was new.
+ */
+static int keyset_add(KeySet *ks, const uint64_t *key, int *added) {
+    uint64_t h = maze_bits_hash(key, ks->nwords);
+    int mask = ks->table_size - 1;
+    for (int i = (int)(h & (uint64_t)mask); ks->table[i] >= 0; i = (i + 1) & mask) {
+        int id = ks->table[i];
+        if (maze_bits_cmp(ks->keys + (size_t)id * ks->nwords, key, ks->nwords) == 0) {
+            if (added) *added = 0;
+            return id;
+        }
+    }
+
+    if (ks->n == ks->cap) {
+        ks->cap *= 2;
+        ks->keys = realloc(ks->keys, (size_t)ks->cap * ks->nwords * sizeof(uint64_t));
+    }
+    int id = ks->n++;
+    memcpy(ks->keys + (size_t)id * ks->nwords, key, ks->nwords * sizeof(uint64_t));
+    if (2 * ks->n > ks->table_size) {
+        ks->table_size *= 2;
+        free(ks->table);
+        ks->table = malloc(ks->table_size * sizeof(int));
+        memset(ks->table, -1, ks->table_size * sizeof(int));
+        for (int i = 0; i < ks->n; i++)
+            keyset_table_insert(ks, i);
+    } else {
+        keyset_table_insert(ks, id);
+    }
+    if (added) *added = 1;
+    return id;
 }
 
-static void ps_free(PortStack *s) {
-    for (int i = 0; i < s->count; i++)
-        free(s->items[i]);
-    free(s->items);
+/* keyset_key -- packed maze with the given id. */
+static inline uint64_t *keyset_key(const KeySet *ks, int id) {
+    return ks->keys + (size_t)id * ks->nwords;
 }
 
-/* --- Seen set (open-addressing hash table of flat port arrays) --- */
+/*
+ * MctsNode -- one canonical port set. Nodes are shared between all parents
+ * whose child has the same canonical form (transpositions), so the tree is
+ * a DAG ordered by depth (number of port units).
+ */
+typedef struct {
+    uint64_t visits;
+    double   value;             /* sum of rollout rewards */
+    int      depth;
+    int      next_unit;         /* units[] index of the next expansion try */
+    int      first_edge;        /* head of the child list in edges[], -1 = none */
+} MctsNode;
 
 typedef struct {
-    uint8_t  **keys;
-    uint64_t  *hashes;   /* precomputed hash per slot (0 = empty) */
-    int size;
-    int count;
-    int key_len;
-} SeenSet;
+    int node;
+    int next;
+} MctsEdge;
 
 /*
- * seen_hash -- hash flat port data (8 bytes at a time for speed).
- * Uses a multiply-xorshift scheme with golden-ratio constant.
+ * MctsTree -- node pool (indexed like the transposition table `ids`, which
+ * maps the packed canonical form of a port set to its node) and child lists.
  */
-static uint64_t seen_hash(const uint8_t *data, int len) {
-    uint64_t h = 0x517cc1b727220a95ULL;
-    int i = 0;
-    for (; i + 7 < len; i += 8) {
-        uint64_t chunk;
-        memcpy(&chunk, data + i, 8);
-        h ^= chunk;
-        h *= 0x9e3779b97f4a7c15ULL;
-        h ^= h >> 32;
-    }
-    for (; i < len; i++) {
-        h ^= data[i];
-        h *= 0x9e3779b97f4a7c15ULL;
+typedef struct {
+    KeySet ids;
+    MctsNode *nodes;
+    int cap;
+    MctsEdge *edges;
+    int nedges, edge_cap;
+} MctsTree;
+
+/*
+ * mcts_get_node -- node id of the canonical port set `key`, creating it
+ * at the given depth if it is new.
+ */
+static int mcts_get_node(MctsTree *t, const uint64_t *key, int depth) {
+    int added;
+    int id = keyset_add(&t->ids, key, &added);
+    if (!added) return id;
+    if (id == t->cap) {
+        t->cap *= 2;
+        t->nodes = realloc(t->nodes, t->cap * sizeof(MctsNode));
     }
-    /* Ensure hash is never 0 (0 = empty sentinel) */
-    return h | 1;
+    MctsNode *n = &t->nodes[id];
+    n->visits = 0;
+    n->value = 0;
+    n->depth = depth;
+    n->next_unit = 0;
+    n->first_edge = -1;
+    return id;
 }
 
-static void seen_init(SeenSet *s, int key_len) {
-    s->size = 65536;
-    s->count = 0;
-    s->key_len = key_len;
-    s->keys = calloc(s->size, sizeof(uint8_t *));
-    s->hashes = calloc(s->size, sizeof(uint64_t));
+/*
+ * mcts_add_child -- link child under parent unless it is already linked
+ * (two units can lead to the same canonical set). Returns 1 if added.
+ */
+static int mcts_add_child(MctsTree *t, int parent, int child) {
+    for (int e = t->nodes[parent].first_edge; e >= 0; e = t->edges[e].next)
+        if (t->edges[e].node == child) return 0;
+    if (t->nedges == t->edge_cap) {
+        t->edge_cap *= 2;
+        t->edges = realloc(t->edges, t->edge_cap * sizeof(MctsEdge));
+    }
+    t->edges[t->nedges].node = child;
+    t->edges[t->nedges].next = t->nodes[parent].first_edge;
+    t->nodes[parent].first_edge = t->nedges++;
+    return 1;
 }
 
-static void seen_rebuild(SeenSet *s) {
-    int new_size = s->size * 2;
-    uint8_t **new_keys = calloc(new_size, sizeof(uint8_t *));
-    uint64_t *new_hashes = calloc(new_size, sizeof(uint64_t));
-    uint64_t mask = (uint64_t)(new_size - 1);
-    for (int i = 0; i < s->size; i++) {
-        if (!s->hashes[i]) continue;
-        uint64_t h = s->hashes[i] & mask;
-        while (new_hashes[h])
-            h = (h + 1) & mask;
-        new_keys[h] = s->keys[i];
-        new_hashes[h] = s->hashes[i];
-    }
-    free(s->keys);
-    free(s->hashes);
-    s->keys = new_keys;
-    s->hashes = new_hashes;
-    s->size = new_size;
-}
-
-static int seen_contains(const SeenSet *s, const uint8_t *data) {
-    uint64_t hash = seen_hash(data, s->key_len);
-    uint64_t mask = (uint64_t)(s->size - 1);
-    uint64_t h = hash & mask;
-    while (s->hashes[h]) {
-        if (s->hashes[h] == hash &&
-            memcmp(s->keys[h], data, s->key_len) == 0)
-            return 1;
-        h = (h + 1) & mask;
+/*
+ * mcts_select_child -- child maximizing the UCT score
+ * mean + c * sqrt(ln N_parent / N_child); unvisited children go first.
+ */
+static int mcts_select_child(const MctsTree *t, int parent, double c) {
+    double logn = log((double)(t->nodes[parent].visits + 1));
+    int best = -1;
+    double best_score = -1;
+    for (int e = t->nodes[parent].first_edge; e >= 0; e = t->edges[e].next) {
+        const MctsNode *ch = &t->nodes[t->edges[e].node];
+        if (ch->visits == 0) return t->edges[e].node;
+        double score = ch->value / (double)ch->visits +
+                       c * sqrt(logn / (double)ch->visits);
+        if (score > best_score) {
+            best_score = score;
+            best = t->edges[e].node;
+        }
     }
-    return 0;
+    return best;
 }
 
-static void seen_insert(SeenSet *s, const uint8_t *data) {
-    if (s->count * 2 >= s->size) seen_rebuild(s);
-    uint64_t hash = seen_hash(data, s->key_len);
-    uint64_t mask = (uint64_t)(s->size - 1);
-    uint8_t *copy = malloc(s->key_len);
-    memcpy(copy, data, s->key_len);
-    uint64_t h = hash & mask;
-    while (s->hashes[h])
-        h = (h + 1) & mask;
-    s->keys[h] = copy;
-    s->hashes[h] = hash;
-    s->count++;
-}
+QMResult quizmaster_mcts_search(int nterm, int max_aport, int max_len,
+                                unsigned int seed, int use_bfs, int directed,
+                                const QMMctsOptions *opts) {
+    QMResult result = {NULL, 0, NULL, 0};
+    if (nterm < 2 || max_aport < 1) return result;
 
-static void seen_free(SeenSet *s) {
-    for (int i = 0; i < s->size; i++)
-        free(s->keys[i]);
-    free(s->keys);
-    free(s->hashes);
-}
+    QMMctsOptions o = {0, 0.7};
+    if (opts) o = *opts;
+
+    interrupted = 0;
+    struct sigaction sa, old_sa;
+    sa.sa_handler = sigint_handler;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_sa);
+
+    Maze *m = maze_create(nterm);
+    m->directed = directed;
+    Maze *len_scratch = maze_create(nterm);
+    int total = m->total_nports;
+    int nwords = maze_bits_nwords(m);
+
+    int *units = malloc(total * sizeof(int));
+    int nunits = 0;
+    for (int i = 0; i < total; i++)
+        if (!is_self_loop_port(m, i) && anneal_unit(m, i) == i)
+            units[nunits++] = i;
+    if (max_aport > nunits) max_aport = nunits;
+    int *scratch = malloc((nunits > 0 ? nunits : 1) * sizeof(int));
+
+    fprintf(stderr, "MCTS search (seed=%u): %d port units, depth=%d, c=%g\n",
+            seed, nunits, max_aport, o.uct_c);
+
+    MctsTree t;
+    keyset_init(&t.ids, nwords);
+    t.cap = 1024;
+    t.nodes = malloc(t.cap * sizeof(MctsNode));
+    t.edge_cap = 4096;
+    t.edges = malloc(t.edge_cap * sizeof(MctsEdge));
+    t.nedges = 0;
+
+    uint64_t *key = malloc(nwords * sizeof(uint64_t));
+    maze_clear(m);
+    maze_to_bits(m, key);
+    int root = mcts_get_node(&t, key, 0);
+
+    int *path = malloc((max_aport + 2) * sizeof(int));
+    uint64_t rng = rng_split(seed, 0);
+
+    Maze *best = NULL;
+    int best_len = 0;
+    State *best_path = NULL;
+    int best_path_len = 0;
+    uint64_t iter;
+
+    for (iter = 0; !interrupted && (o.iterations == 0 || iter < o.iterations); iter++) {
+        /* Selection and expansion */
+        int plen = 0;
+        int node = root;
+        path[plen++] = node;
+        while (t.nodes[node].depth < max_aport) {
+            MctsNode *n = &t.nodes[node];
+            int child = -1;
+            while (n->next_unit < nunits && child < 0) {
+                int u = units[n->next_unit++];
+                maze_from_bits(m, keyset_key(&t.ids, node));
+                if (maze_get_port(m, u)) continue;
+                anneal_toggle(m, u);
+                maze_canonicalize(m, NULL);
+                maze_to_bits(m, key);
+                int id = mcts_get_node(&t, key, t.nodes[node].depth + 1);
+                n = &t.nodes[node];     /* pool may have moved */
+                if (mcts_add_child(&t, node, id)) child = id;
+            }
+            if (child >= 0) {
+                node = child;
+                path[plen++] = node;
+                break;
+            }
+            child = mcts_select_child(&t, node, o.uct_c);
+            if (child < 0) break;
+            node = child;
+            path[plen++] = node;
+        }
+
+        /* Rollout: random completion to max_aport units */
+        maze_from_bits(m, keyset_key(&t.ids, node));
+        int nfree = 0;
+        for (int i = 0; i < nunits; i++)
+            if (!maze_get_port(m, units[i])) scratch[nfree++] = units[i];
+        for (int d = t.nodes[node].depth; d < max_aport && nfree > 0; d++) {
+            int j = (int)(rng_next(&rng) % (uint64_t)nfree);
+            anneal_toggle(m, scratch[j]);
+            scratch[j] = scratch[--nfree];
+        }
+        int len = maze_fitness(m, len_scratch, use_bfs);
+
+        if (len > best_len) {
+            best_len = len;
+            if (best) maze_copy(best, m);
+            else best = maze_clone(m);
+            free(best_path);
+            best_path = NULL;
+            if (use_bfs) solve_bfs(m, &best_path, &best_path_len);
+            else solve(m, &best_path, &best_path_len);
+            fprintf(stderr, "[iter %llu, depth %d] new best: length %d\n",
+                    (unsigned long long)iter, t.nodes[node].depth, best_len);
+            fprintf(stderr, "  ");
+            maze_fprint(stderr, best);
+            fprintf(stderr, "  ");
+            path_fprint(stderr, best_path, best_path_len);
+        }
+
+        /* Backpropagation of the reward normalized by the record length */
+        double reward = best_len > 0 ? (double)len / (double)best_len : 0.0;
+        for (int i = 0; i < plen; i++) {
+            t.nodes[path[i]].visits++;
+            t.nodes[path[i]].value += reward;
+        }
+
+        if ((iter + 1) % 1000 == 0)
+            fprintf(stderr, "[mcts] iter=%llu nodes=%d best=%d root_mean=%.3f\n",
+                    (unsigned long long)(iter + 1), t.ids.n, best_len,
+                    t.nodes[root].value / (double)t.nodes[root].visits);
+        if (max_len > 0 && best_len >= max_len) { iter++; break; }
+    }
+
+    if (interrupted)
+        fprintf(stderr, "\nInterrupted by SIGINT.\n");
 
-/* --- Helper: extract flat port data from maze --- */
+    fprintf(stderr, "MCTS search complete: %llu iterations, %d nodes, best length = %d\n",
+            (unsigned long long)iter, t.ids.n, best_len);
+
+    if (best) {
+        result.best_maze     = best;
+        result.best_length   = best_len;
+        result.best_path     = best_path;
+        result.best_path_len = best_path_len;
+    }
 
-static void maze_to_flat(const Maze *m, uint8_t *data) {
-    memcpy(data, m->normal_ports, m->normal_nports);
-    memcpy(data + m->normal_nports, m->nx_ports, m->nx_nports);
-    memcpy(data + m->normal_nports + m->nx_nports, m->ny_ports, m->ny_nports);
+    free(path);
+    free(key);
+    keyset_free(&t.ids);
+    free(t.edges);
+    free(t.nodes);
+    free(scratch);
+    free(units);
+    maze_destroy(len_scratch);
+    maze_destroy(m);
+    sigaction(SIGINT, &old_sa, NULL);
+    return result;
 }
 
-/* --- Top-down search --- */
+/* ================================================================
+ * Bottom-up beam search: grow mazes from minimal start->goal chains.
+ * ================================================================ */
+
+/* BeamItem -- ranking record of one child of the current level. */
+typedef struct {
+    int id;
+    int score;                  /* best path length among its parents' children */
+    uint64_t hash;              /* deterministic tie-break */
+} BeamItem;
+
+static int beam_item_cmp(const void *pa, const void *pb) {
+    const BeamItem *a = pa, *b = pb;
+    if (a->score != b->score) return a->score > b->score ? -1 : 1;
+    if (a->hash != b->hash) return a->hash < b->hash ? -1 : 1;
+    return 0;
+}
 
-#define TD_MAX_PRIORITY 1000
+/*
+ * beam_add -- canonicalize m and add it to the level set; returns its id.
+ */
+static int beam_add(KeySet *level, Maze *m, uint64_t *key) {
+    maze_canonicalize(m, NULL);
+    maze_to_bits(m, key);
+    return keyset_add(level, key, NULL);
+}
 
-QMResult quizmaster_topdown_search(int nterm, int max_len, int use_bfs, int directed) {
+QMResult quizmaster_bottomup_search(int nterm, int max_aport, int max_len,
+                                    int beam, int use_bfs, int directed,
+                                    int nthreads) {
     QMResult result = {NULL, 0, NULL, 0};
     if (nterm < 2) return result;
+    if (beam < 1) beam = 1;
+    if (nthreads < 1) nthreads = 1;
 
     interrupted = 0;
     struct sigaction sa, old_sa;
@@ -611,180 +4406,166 @@ QMResult quizmaster_topdown_search(int nterm, int max_len, int use_bfs, int dire
     Maze *m = maze_create(nterm);
     m->directed = directed;
     int total = m->total_nports;
+    int nwords = maze_bits_nwords(m);
 
-    /* Build candidate list (exclude self-loop ports) */
-    int *candidates = malloc(total * sizeof(int));
-    int ncand = 0;
+    int *units = malloc(total * sizeof(int));
+    int nunits = 0;
     for (int i = 0; i < total; i++)
-        if (!is_self_loop_port(m, i))
-            candidates[ncand++] = i;
-
-    fprintf(stderr, "Top-down search: %d candidates (excluding %d self-loops)\n",
-            ncand, total - ncand);
-
-    /* Start: fully-connected maze (all candidates active) */
-    maze_clear(m);
-    for (int i = 0; i < ncand; i++)
-        maze_set_port(m, candidates[i], 1);
-    if (!directed)
-        maze_make_undirected(m);
+        if (!is_self_loop_port(m, i) && anneal_unit(m, i) == i)
+            units[nunits++] = i;
+    if (max_aport <= 0 || max_aport > nunits) max_aport = nunits;
 
-    free(candidates);
+    /* Abstract edge of every port, for building the start chains */
+    int *asrc = malloc(total * sizeof(int));
+    int *adst = malloc(total * sizeof(int));
+    for (int i = 0; i < total; i++)
+        port_abstract_edge(m, i, &asrc[i], &adst[i]);
 
-    /* Initialize priority stacks */
-    PortStack *stacks = malloc(TD_MAX_PRIORITY * sizeof(PortStack));
-    for (int i = 0; i < TD_MAX_PRIORITY; i++)
-        ps_init(&stacks[i]);
+    fprintf(stderr, "Bottom-up beam search (threads=%d): %d port units, beam=%d, max_aport=%d\n",
+            nthreads, nunits, beam, max_aport);
 
-    /* Seen set */
-    SeenSet seen;
-    seen_init(&seen, total);
+    uint64_t *key = malloc(nwords * sizeof(uint64_t));
+    KeySet level;
+    keyset_init(&level, nwords);
 
-    /* Push fully-connected maze into stack[1] */
-    uint8_t *flat = malloc(total);
-    maze_to_flat(m, flat);
-    ps_push(&stacks[1], flat, total);
-    seen_insert(&seen, flat);
+    /* Level 0: every chain 0 -> 1 and 0 -> v -> 1 of the abstract graph */
+    for (int p = 0; p < total; p++) {
+        if (is_self_loop_port(m, p) || asrc[p] != 0) continue;
+        if (adst[p] == 1) {
+            maze_clear(m);
+            anneal_toggle(m, p);
+            beam_add(&level, m, key);
+            continue;
+        }
+        if (adst[p] < 2) continue;
+        for (int q = 0; q < total; q++) {
+            if (is_self_loop_port(m, q) || asrc[q] != adst[p] || adst[q] != 1) continue;
+            maze_clear(m);
+            anneal_toggle(m, p);
+            anneal_toggle(m, q);
+            beam_add(&level, m, key);
+        }
+    }
 
     Maze *best = NULL;
     int best_len = 0;
     State *best_path = NULL;
     int best_path_len = 0;
-    uint64_t total_popped = 0;
     uint64_t total_solved = 0;
-    uint64_t total_pruned = 0;
-
-    uint8_t *child_flat = malloc(total);
 
-    while (!interrupted) {
-        /* Find highest non-empty stack */
-        int hi = -1;
-        for (int i = TD_MAX_PRIORITY - 1; i >= 0; i--) {
-            if (stacks[i].count > 0) { hi = i; break; }
-        }
-        if (hi < 0) break;
-
-        /* Pop maze from highest stack */
-        uint8_t *data = ps_pop(&stacks[hi]);
-        total_popped++;
-
-        /* Load into maze and solve */
-        maze_set_from_array(m, data);
-        if (!directed)
-            maze_make_undirected(m);
+    /* Parent links of the current level: (beam index, child id) pairs */
+    int *link_parent = NULL, *link_child = NULL;
+    int nlinks = 0, link_cap = 0;
+    uint64_t *beam_keys = malloc((size_t)beam * nwords * sizeof(uint64_t));
+    int nbeam = 0;
+    int *potential = malloc(beam * sizeof(int));
 
-        int len;
-        State *tmp_path = NULL;
-        int tmp_path_len = 0;
-        if (use_bfs) {
-            len = solve_bfs_len(m);
-        } else {
-            /* Start IDDFS from depth hi: parent had path length hi,
-             * removing a port can only increase it */
-            len = solve_from(m, hi, &tmp_path, &tmp_path_len);
-        }
+    for (int depth = 0; level.n > 0 && !interrupted; depth++) {
+        /* Solve every child of the level in parallel */
+        int *fitness = malloc(level.n * sizeof(int));
+        GAShared g;
+        g.nterm = nterm;
+        g.directed = directed;
+        g.use_bfs = use_bfs;
+        g.nwords = nwords;
+        g.pop = level.keys;
+        g.fitness = fitness;
+        g.npop = level.n;
+        ga_evaluate(&g, 0, nthreads);
+        if (interrupted) { free(fitness); break; }
+        total_solved += level.n;
 
-        if (len < 0) {
-            /* Unreachable: discard */
-            free(data);
-            free(tmp_path);
-            total_pruned++;
-            goto td_progress;
+        int level_best = 0, level_best_id = -1, nsolvable = 0;
+        for (int i = 0; i < level.n; i++) {
+            if (fitness[i] > 0) nsolvable++;
+            if (fitness[i] > level_best) {
+                level_best = fitness[i];
+                level_best_id = i;
+            }
         }
-
-        total_solved++;
-
-        /* Update best */
-        if (len > best_len) {
-            if (use_bfs)
-                solve_bfs(m, &tmp_path, &tmp_path_len);
-            best_len = len;
-            if (best) maze_destroy(best);
-            best = maze_clone(m);
+        if (level_best > best_len) {
+            best_len = level_best;
+            if (!best) best = maze_create(nterm);
+            maze_from_bits(best, keyset_key(&level, level_best_id));
+            best->directed = directed;
             free(best_path);
-            best_path = tmp_path;
-            best_path_len = tmp_path_len;
-            tmp_path = NULL;
-            fprintf(stderr, "[pop %llu, stack %d] new best: length %d\n",
-                    (unsigned long long)total_popped, hi, best_len);
+            best_path = NULL;
+            if (use_bfs) solve_bfs(best, &best_path, &best_path_len);
+            else solve(best, &best_path, &best_path_len);
+            fprintf(stderr, "[level %d] new best: length %d\n", depth, best_len);
             fprintf(stderr, "  ");
             maze_fprint(stderr, best);
             fprintf(stderr, "  ");
             path_fprint(stderr, best_path, best_path_len);
-            if (max_len > 0 && best_len >= max_len) {
-                free(data);
-                free(tmp_path);
-                break;
-            }
         }
-        free(tmp_path);
 
-        /* Generate children: remove one active port at a time */
-        int stack_idx = len < TD_MAX_PRIORITY ? len : TD_MAX_PRIORITY - 1;
-        for (int i = 0; i < total; i++) {
-            if (!data[i]) continue;
-
-            /* Create child: remove port i */
-            memcpy(child_flat, data, total);
-            child_flat[i] = 0;
-
-            /* Normalize child */
-            maze_set_from_array(m, child_flat);
-            maze_normalize(m);
-            maze_to_flat(m, child_flat);
-
-            /* Dedup */
-            if (seen_contains(&seen, child_flat)) continue;
-
-            /* Abstract reachability pruning */
-            if (!has_abstract_path(m)) {
-                total_pruned++;
-                continue;
-            }
+        /*
+         * Rank the unsolvable children. Solvable ones are never expanded:
+         * adding ports cannot lengthen a shortest path, so none of their
+         * descendants can beat them. A parent's potential is the longest
+         * path among its children; a child inherits its best parent's.
+         */
+        for (int b = 0; b < nbeam; b++)
+            potential[b] = 0;
+        for (int l = 0; l < nlinks; l++)
+            if (fitness[link_child[l]] > potential[link_parent[l]])
+                potential[link_parent[l]] = fitness[link_child[l]];
+        BeamItem *items = malloc((level.n > 0 ? level.n : 1) * sizeof(BeamItem));
+        for (int i = 0; i < level.n; i++) {
+            items[i].id = i;
+            items[i].score = -1;
+            items[i].hash = maze_bits_hash(keyset_key(&level, i), nwords);
+        }
+        for (int l = 0; l < nlinks; l++)
+            if (potential[link_parent[l]] > items[link_child[l]].score)
+                items[link_child[l]].score = potential[link_parent[l]];
+        int ncand = 0;
+        for (int i = 0; i < level.n; i++)
+            if (fitness[i] == 0) items[ncand++] = items[i];
+        qsort(items, ncand, sizeof(BeamItem), beam_item_cmp);
 
-            seen_insert(&seen, child_flat);
-            ps_push(&stacks[stack_idx], child_flat, total);
+        nbeam = ncand < beam ? ncand : beam;
+        for (int b = 0; b < nbeam; b++) {
+            memcpy(beam_keys + (size_t)b * nwords, keyset_key(&level, items[b].id),
+                   nwords * sizeof(uint64_t));
         }
 
-        free(data);
+        fprintf(stderr, "[bottomup] level=%d children=%d solvable=%d level_best=%d best=%d beam=%d\n",
+                depth, level.n, nsolvable, level_best, best_len, nbeam);
+        free(items);
+        free(fitness);
+        if (max_len > 0 && best_len >= max_len) break;
 
-    td_progress:
-        if (total_popped % 10000 == 0) {
-            /* Build stack size summary string */
-            char stackinfo[1024];
-            int pos = 0;
-            int first = 1;
-            for (int i = 0; i < TD_MAX_PRIORITY && pos < 900; i++) {
-                if (stacks[i].count > 0) {
-                    pos += snprintf(stackinfo + pos, sizeof(stackinfo) - pos,
-                                    "%s%d:%d", first ? "" : ",", i, stacks[i].count);
-                    first = 0;
+        /* Expand the beam by one port unit into the next level */
+        keyset_free(&level);
+        keyset_init(&level, nwords);
+        nlinks = 0;
+        for (int b = 0; b < nbeam; b++) {
+            uint64_t *pk = beam_keys + (size_t)b * nwords;
+            int nact = maze_bits_count(pk, nwords) / (directed ? 1 : 2);
+            if (nact >= max_aport) continue;
+            for (int i = 0; i < nunits; i++) {
+                if (maze_bits_get(pk, units[i])) continue;
+                maze_from_bits(m, pk);
+                anneal_toggle(m, units[i]);
+                int id = beam_add(&level, m, key);
+                if (nlinks == link_cap) {
+                    link_cap = link_cap ? 2 * link_cap : 1024;
+                    link_parent = realloc(link_parent, link_cap * sizeof(int));
+                    link_child = realloc(link_child, link_cap * sizeof(int));
                 }
+                link_parent[nlinks] = b;
+                link_child[nlinks] = id;
+                nlinks++;
             }
-            if (first) snprintf(stackinfo, sizeof(stackinfo), "(empty)");
-            fprintf(stderr, "[topdown] popped=%llu solved=%llu pruned=%llu seen=%d best=%d stack={%s}\n",
-                    (unsigned long long)total_popped,
-                    (unsigned long long)total_solved,
-                    (unsigned long long)total_pruned,
-                    seen.count, best_len, stackinfo);
         }
     }
 
-    free(flat);
-    free(child_flat);
-    for (int i = 0; i < TD_MAX_PRIORITY; i++)
-        ps_free(&stacks[i]);
-    free(stacks);
-    seen_free(&seen);
-
     if (interrupted)
         fprintf(stderr, "\nInterrupted by SIGINT.\n");
 
-    fprintf(stderr, "Top-down complete: %llu popped, %llu solved, %llu pruned, seen=%d, best=%d\n",
-            (unsigned long long)total_popped,
-            (unsigned long long)total_solved,
-            (unsigned long long)total_pruned,
-            seen.count, best_len);
+    fprintf(stderr, "Bottom-up search complete: %llu solved, best length = %d\n",
+            (unsigned long long)total_solved, best_len);
 
     if (best) {
         result.best_maze     = best;
@@ -793,6 +4574,15 @@ QMResult quizmaster_topdown_search(int nterm, int max_len, int use_bfs, int dire
         result.best_path_len = best_path_len;
     }
 
+    free(potential);
+    free(beam_keys);
+    free(link_parent);
+    free(link_child);
+    keyset_free(&level);
+    free(key);
+    free(asrc);
+    free(adst);
+    free(units);
     maze_destroy(m);
     sigaction(SIGINT, &old_sa, NULL);
     return result;
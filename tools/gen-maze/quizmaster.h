@@ -2,14 +2,16 @@
  * quizmaster.h -- Search for the maze with the longest minimal path.
  *
  * The quizmaster performs an exhaustive search over all mazes with at most
- * max_aport active ports, enumerating all C(total_nports, k) combinations
- * for k = 0, 1, ..., max_aport.
+ * max_aport active ports, covering all C(total_nports, k) combinations
+ * for k = 0, 1, ..., max_aport as a branch-and-bound walk over port sets.
  */
 #ifndef QUIZMASTER_H
 #define QUIZMASTER_H
 
 #include "maze.h"
 #include "solver.h"
+#include "resultdb.h"
+#include "shard.h"
 
 /*
  * QMResult -- result of a quizmaster search.
@@ -27,20 +29,75 @@ typedef struct {
     int    best_path_len;
 } QMResult;
 
+/*
+ * QMShard -- the slice of a search covered by one run (see shard.h).
+ *
+ * Fields:
+ *   index, count -- this run covers shard index of count (count <= 1 =
+ *                   the whole search)
+ *   result_file  -- if non-NULL, per-k counters, length histograms and
+ *                   the best maze are written here when the search ends
+ */
+typedef struct {
+    int index;
+    int count;
+    const char *result_file;
+} QMShard;
+
 /*
  * quizmaster_search -- exhaustive search for the maze with the longest
  * minimal path.
  *
+ * Walks the combination tree depth-first (each node adds one port with a
+ * larger candidate index) and skips the subtree of any node that is already
+ * solvable with a length not exceeding the current best, since adding ports
+ * can never lengthen the shortest path. The best length found is exact.
+ * With use_bfs, sibling leaves (mazes of max_aport ports that differ in
+ * their last port) are solved 64 at a time by solve_bfs_batch().
+ *
  * Parameters:
  *   nterm      -- number of terminal indices per direction (must be >= 2)
  *   min_aport  -- minimum number of active ports per maze
  *   max_aport  -- maximum number of active ports per maze
  *   max_len    -- stop early when best path length >= max_len (0 = no limit)
+ *   shard      -- slice to search (NULL = all). The depth-2 subtrees of
+ *                 the combination tree are numbered in walk order and
+ *                 dealt round-robin to the shards; mazes with fewer than
+ *                 two ports belong to shard 0. Each shard prunes with its
+ *                 own best length, so the best over all shards is exact.
  *
  * Returns a QMResult with the best maze found. Use qmresult_free() to release.
  */
 QMResult quizmaster_search(int nterm, int min_aport, int max_aport,
-                           int max_len, int use_bfs, int directed);
+                           int max_len, int use_bfs, int directed,
+                           const QMShard *shard);
+
+/*
+ * QMRandomOptions -- tuning knobs of quizmaster_random_search().
+ *
+ * Fields:
+ *   nthreads     -- number of worker threads (>= 1)
+ *   constructive -- if nonzero, build each sample around a random abstract
+ *                   start->goal path so every sample reaches the solver
+ *   dedupe_mem   -- bytes for a Bloom filter of canonical forms; samples
+ *                   whose canonical form is (probably) already seen are
+ *                   not solved again (0 = no filter)
+ *   shard        -- worker t of shard i draws from random stream
+ *                   t * count + i, so shards never share a stream
+ *   pipeline     -- if all three are positive, run generator, filter and
+ *                   solver threads (in this order) connected by bounded
+ *                   lock-free queues of sample batches instead of
+ *                   nthreads self-contained workers, and report how busy
+ *                   each stage was; with use_bfs each batch of 64 is
+ *                   solved by one solve_bfs_batch() call
+ */
+typedef struct {
+    int nthreads;
+    int constructive;
+    size_t dedupe_mem;
+    QMShard shard;
+    int pipeline[3];
+} QMRandomOptions;
 
 /*
  * quizmaster_random_search -- random sampling search for the maze with the
@@ -48,21 +105,74 @@ QMResult quizmaster_search(int nterm, int min_aport, int max_aport,
  *
  * Runs in an infinite loop until SIGINT (Ctrl+C) or max_len is reached.
  * Each iteration randomly picks k in [min_aport, max_aport] and randomly
- * selects k ports from the candidate set.
+ * selects k ports from the candidate set. Work is spread over nthreads
+ * workers that share the best length and merge their counters.
+ *
+ * In constructive mode the first ports of a sample form a random simple
+ * path of abstract terminal nodes from start to goal and the rest are
+ * drawn uniformly. Each k then carries the importance weight p_k, the
+ * estimated fraction of uniform k-samples that are abstractly connected,
+ * and the run reports sum(n_k / p_k) as uniform-equivalent iterations.
+ *
+ * The duplicate filter can drop a never-seen maze on a false positive, so
+ * it trades a small chance of missing a sample for skipping repeat solves.
  *
  * Parameters:
  *   nterm      -- number of terminal indices per direction (must be >= 2)
  *   min_aport  -- minimum number of active ports per maze
  *   max_aport  -- maximum number of active ports per maze
  *   max_len    -- stop early when best path length >= max_len (0 = no limit)
- *   seed       -- random seed for srand()
+ *   seed       -- random seed; worker i uses the stream rng_split(seed, i)
+ *                 (shifted by opts->shard when sharded)
  *   use_bfs    -- if nonzero, use BFS instead of IDDFS for solving
+ *   opts       -- sampler options (NULL = one thread, uniform, no filter)
  *
  * Returns a QMResult with the best maze found. Use qmresult_free() to release.
  */
 QMResult quizmaster_random_search(int nterm, int min_aport, int max_aport,
                                   int max_len, unsigned int seed, int use_bfs,
-                                  int directed);
+                                  int directed, const QMRandomOptions *opts);
+
+/*
+ * QMTopdownOptions -- tuning knobs of quizmaster_topdown_search().
+ *
+ * Fields:
+ *   lossy_seen -- if nonzero, the seen set keeps only a 64-bit hash per
+ *                 maze instead of the packed maze (a hash collision can
+ *                 then skip an unseen maze, with probability about
+ *                 seen / 2^64 per lookup)
+ *   spill_dir  -- if non-NULL, queued mazes beyond spill_mem bytes are
+ *                 written to sorted run files in this directory, lowest
+ *                 path length first, and paged back in when needed
+ *   spill_mem  -- in-memory queue budget in bytes (0 = 1 GB)
+ *   checkpoint -- if non-NULL, the seen set, queue and best maze are saved
+ *                 to this file every checkpoint_interval seconds and on
+ *                 exit (including SIGINT); an existing file is resumed
+ *   checkpoint_interval -- seconds between checkpoints (0 = 600)
+ *   nthreads   -- worker threads; mazes are popped in batches of
+ *                 8 per thread, expanded in parallel and merged in pop
+ *                 order (deterministic for a given thread count)
+ *   beam       -- if positive, each path-length bucket holds at most
+ *                 this many queued mazes; children beyond it are dropped,
+ *                 reported and remembered in a fixed-size drop cache so
+ *                 they are not offered again (spill_dir is then ignored).
+ *                 The queue is bounded by beam per length; the seen set
+ *                 still grows by one key per admitted maze (9 bytes with
+ *                 lossy_seen), and dropped mazes are never added to it
+ *   diversity  -- in beam mode, a child is also dropped if one of the last
+ *                 32 mazes admitted at its level is within this Hamming
+ *                 distance of its bit-packed key
+ */
+typedef struct {
+    int lossy_seen;
+    const char *spill_dir;
+    size_t spill_mem;
+    const char *checkpoint;
+    int checkpoint_interval;
+    int nthreads;
+    int beam;
+    int diversity;
+} QMTopdownOptions;
 
 /*
  * quizmaster_topdown_search -- top-down search starting from fully-connected maze.
@@ -72,17 +182,205 @@ QMResult quizmaster_random_search(int nterm, int min_aport, int max_aport,
  * can only increase or maintain the shortest path length, the search naturally
  * converges toward the optimal maze without passing through unreachable states.
  *
- * Uses priority stacks (indexed by path length) for best-first expansion,
- * normalization for deduplication, and abstract reachability for pruning.
+ * Uses a bucket queue (one LIFO bucket per path length, unbounded) for
+ * best-first expansion, canonical forms for deduplication, and abstract
+ * reachability for pruning.
  *
  * Parameters:
  *   nterm   -- number of terminal indices per direction (must be >= 2)
  *   max_len -- stop early when best path length >= max_len (0 = no limit)
  *   use_bfs -- if nonzero, use BFS instead of IDDFS for solving
+ *   opts    -- options (NULL = defaults)
  *
  * Returns a QMResult with the best maze found. Use qmresult_free() to release.
  */
-QMResult quizmaster_topdown_search(int nterm, int max_len, int use_bfs, int directed);
+QMResult quizmaster_topdown_search(int nterm, int max_len, int use_bfs, int directed,
+                                   const QMTopdownOptions *opts);
+
+/* Move kinds for quizmaster_anneal_search() (bitmask). */
+#define QM_MOVE_FLIP     1  /* toggle one port */
+#define QM_MOVE_SWAP     2  /* turn one port off and another on */
+#define QM_MOVE_ENDPOINT 4  /* re-route one endpoint of an active port */
+#define QM_MOVE_ALL      (QM_MOVE_FLIP | QM_MOVE_SWAP | QM_MOVE_ENDPOINT)
+
+/*
+ * QMAnnealOptions -- schedule and move set of quizmaster_anneal_search().
+ *
+ * Fields:
+ *   t_start   -- initial temperature (in path-length units)
+ *   t_end     -- final temperature; cooling is geometric over `steps`
+ *   steps     -- moves per restart
+ *   restarts  -- number of restarts (0 = until SIGINT or max_len)
+ *   moves     -- QM_MOVE_* bitmask of allowed moves
+ *   seed_maze -- starting maze of the first restart (NULL = random)
+ */
+typedef struct {
+    double   t_start;
+    double   t_end;
+    uint64_t steps;
+    int      restarts;
+    int      moves;
+    const Maze *seed_maze;
+} QMAnnealOptions;
+
+/*
+ * quizmaster_anneal_search -- simulated annealing over port sets.
+ *
+ * Fitness is the shortest path length (0 when unsolvable). Each step applies
+ * one random move; improvements are always kept and a loss of d is kept
+ * with probability exp(-d / T). The first restart starts from seed_maze (or
+ * a random connected maze); later restarts warm-start from the best maze.
+ * With t_end close to 0 the tail of every restart is a hill climb.
+ *
+ * Parameters:
+ *   nterm      -- number of terminal indices per direction (must be >= 2)
+ *   max_aport  -- maximum number of active ports (0 = no limit); in
+ *                 undirected mode a port and its reverse count once
+ *   max_len    -- stop early when best path length >= max_len (0 = no limit)
+ *   seed       -- random seed
+ *   use_bfs    -- if nonzero, use BFS instead of IDDFS for solving
+ *   opts       -- schedule and moves (NULL = defaults: T 2.0 -> 0.05,
+ *                 20000 steps, unlimited restarts, all moves)
+ *
+ * Returns a QMResult with the best maze found. Use qmresult_free() to release.
+ */
+QMResult quizmaster_anneal_search(int nterm, int max_aport, int max_len,
+                                  unsigned int seed, int use_bfs, int directed,
+                                  const QMAnnealOptions *opts);
+
+/*
+ * QMGeneticOptions -- parameters of quizmaster_genetic_search().
+ *
+ * Fields:
+ *   pop_size    -- population size (>= 2)
+ *   generations -- number of generations (0 = until SIGINT or max_len)
+ *   tournament  -- tournament size for parent selection
+ *   elite       -- best individuals copied unchanged into the next generation
+ *   mutation    -- per-port-unit flip probability (0 = 1 / number of units)
+ *   nthreads    -- threads evaluating fitness (>= 1)
+ */
+typedef struct {
+    int    pop_size;
+    int    generations;
+    int    tournament;
+    int    elite;
+    double mutation;
+    int    nthreads;
+} QMGeneticOptions;
+
+/*
+ * quizmaster_genetic_search -- evolutionary search over port sets.
+ *
+ * Keeps a population of bit-packed mazes whose fitness is the shortest path
+ * length (0 when unsolvable). Parents are picked by tournament; children
+ * take the normal, nx and ny blocks from both parents via a separate
+ * two-point crossover per block, so partial gadgets of either parent can
+ * be combined, then get flip mutation and are trimmed to max_aport units.
+ * Fitness of each generation is evaluated by nthreads threads.
+ *
+ * Parameters:
+ *   nterm      -- number of terminal indices per direction (must be >= 2)
+ *   max_aport  -- maximum number of active ports (0 = no limit); in
+ *                 undirected mode a port and its reverse count once
+ *   max_len    -- stop early when best path length >= max_len (0 = no limit)
+ *   seed       -- random seed
+ *   use_bfs    -- if nonzero, use BFS instead of IDDFS for solving
+ *   opts       -- GA parameters (NULL = defaults: population 64, unlimited
+ *                 generations, tournament 3, elite 2, mutation 1/units,
+ *                 one thread)
+ *
+ * Returns a QMResult with the best maze found. Use qmresult_free() to release.
+ */
+QMResult quizmaster_genetic_search(int nterm, int max_aport, int max_len,
+                                   unsigned int seed, int use_bfs, int directed,
+                                   const QMGeneticOptions *opts);
+
+/*
+ * QMMctsOptions -- parameters of quizmaster_mcts_search().
+ *
+ * Fields:
+ *   iterations -- number of playouts (0 = until SIGINT or max_len)
+ *   uct_c      -- UCT exploration constant
+ */
+typedef struct {
+    uint64_t iterations;
+    double   uct_c;
+} QMMctsOptions;
+
+/*
+ * quizmaster_mcts_search -- Monte Carlo tree search over port additions.
+ *
+ * Tree nodes are canonical port sets; a child adds one port unit, and
+ * parents whose children share a canonical form share the child node and
+ * its statistics. Each playout descends by UCT, expands one new child,
+ * completes it with random units up to max_aport and scores the result by
+ * its path length divided by the record length so far. The statistics
+ * persist across playouts, concentrating the budget on promising prefixes.
+ *
+ * Parameters:
+ *   nterm      -- number of terminal indices per direction (must be >= 2)
+ *   max_aport  -- number of port units of each playout maze (>= 1); in
+ *                 undirected mode a port and its reverse count once
+ *   max_len    -- stop early when best path length >= max_len (0 = no limit)
+ *   seed       -- random seed
+ *   use_bfs    -- if nonzero, use BFS instead of IDDFS for solving
+ *   opts       -- MCTS parameters (NULL = unlimited playouts, c = 0.7)
+ *
+ * Returns a QMResult with the best maze found. Use qmresult_free() to release.
+ */
+QMResult quizmaster_mcts_search(int nterm, int max_aport, int max_len,
+                                unsigned int seed, int use_bfs, int directed,
+                                const QMMctsOptions *opts);
+
+/*
+ * quizmaster_bottomup_search -- beam search that grows mazes port by port.
+ *
+ * Level 0 holds every canonical maze made of one abstract start->goal
+ * chain of one or two ports (0 -> 1 or 0 -> v -> 1). Each level solves all
+ * its mazes in parallel, then keeps the `beam` best unsolvable ones and
+ * adds one port unit to each in every possible way to form the next level.
+ * Solvable mazes are recorded but not expanded, since adding ports never
+ * lengthens a shortest path. An unsolvable maze ranks by the longest path
+ * among the children of its parent, so the beam follows the families that
+ * turned solvable with long paths. Memory is bounded by beam * units.
+ *
+ * Parameters:
+ *   nterm      -- number of terminal indices per direction (must be >= 2)
+ *   max_aport  -- stop growing mazes at this many port units (0 = no limit)
+ *   max_len    -- stop early when best path length >= max_len (0 = no limit)
+ *   beam       -- beam width W (>= 1)
+ *   use_bfs    -- if nonzero, use BFS instead of IDDFS for solving
+ *   nthreads   -- threads solving each level (>= 1)
+ *
+ * Returns a QMResult with the best maze found. Use qmresult_free() to release.
+ */
+QMResult quizmaster_bottomup_search(int nterm, int max_aport, int max_len,
+                                    int beam, int use_bfs, int directed,
+                                    int nthreads);
+
+/*
+ * quizmaster_set_length_cache -- share a memo of shortest path lengths
+ * among all search strategies (except top-down, which needs the critical
+ * ports of every solve). Mazes are keyed by their reachable core: the
+ * ports whose abstract source is reachable from the start and whose
+ * abstract destination reaches the goal, which alone determine the path.
+ * The cache keeps about `bytes` bytes with CLOCK eviction; 0 disables it.
+ */
+void quizmaster_set_length_cache(size_t bytes);
+
+/*
+ * quizmaster_set_result_db -- consult and populate a persistent result
+ * database (NULL to stop). Strategies that use the length cache look up
+ * the canonical reachable core of every maze before solving it; top-down
+ * search stores every maze it solves.
+ */
+void quizmaster_set_result_db(ResultDB *db);
+
+/*
+ * quizmaster_length_cache_report -- print length cache and result
+ * database hit rates to stderr.
+ */
+void quizmaster_length_cache_report(void);
 
 /* qmresult_free -- free the maze and path stored in a QMResult. */
 void qmresult_free(QMResult *r);
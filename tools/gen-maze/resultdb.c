@@ -0,0 +1,403 @@
+/*
+ * resultdb.c -- persistent database of solved mazes.
+ *
+ * File layout:
+ *   [0, 512)      header copy 0
+ *   [512, 1024)   header copy 1
+ *   [4096, ...)   tables; the header names the live one (table_off,
+ *                 nslots). Superseded tables stay in place as dead space.
+ *
+ * A table entry is nwords key words followed by one meta word:
+ *   bits 0..31  -- path length (int32)
+ *   bits 32..63 -- check over key and length, never 0 (0 = empty slot)
+ *
+ * Slots are probed linearly from maze_bits_hash(key).
+ *
+ * Lookups take no lock. Inserts are serialized by a mutex and publish an
+ * entry by storing its meta word last (release); a lookup reads the meta
+ * word first (acquire), so a nonzero meta word means the key is complete.
+ * Growing maps the file anew and publishes the new table as an RDBView;
+ * superseded views and mappings are only released on close, so a lookup
+ * still probing an old table reads valid memory (and at worst misses an
+ * entry inserted meanwhile).
+ */
+#include "resultdb.h"
+#include "maze.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#define RDB_MAGIC       0x3230303042444d52ULL   /* "RMDB0002" */
+#define RDB_HEADER_SIZE 512
+#define RDB_DATA_OFF    4096
+#define RDB_MIN_SLOTS   4096
+
+typedef struct {
+    uint64_t magic;
+    uint64_t generation;
+    uint64_t nterm;
+    uint64_t nwords;
+    uint64_t table_off;
+    uint64_t nslots;
+    uint64_t count;
+    uint64_t clean;             /* 1 if count is exact (closed cleanly) */
+    uint64_t checksum;          /* over the words above */
+} RDBHeader;
+
+/* RDBView -- a table as lookups see it; replaced on growth, never changed. */
+typedef struct RDBView {
+    const uint64_t *table;
+    uint64_t nslots;
+    struct RDBView *prev;       /* superseded views, freed on close */
+} RDBView;
+
+/* RDBMapping -- a superseded mapping of the file, unmapped on close. */
+typedef struct RDBMapping {
+    uint8_t *map;
+    size_t bytes;
+    struct RDBMapping *prev;
+} RDBMapping;
+
+struct ResultDB {
+    int fd;
+    int writable;
+    uint8_t *map;
+    size_t map_bytes;
+    RDBMapping *old_maps;
+    RDBView *view;              /* published with release, read with acquire */
+    RDBHeader hdr;              /* live header */
+    int hdr_copy;               /* copy (0/1) that holds hdr on disk */
+    int nwords;
+    int entry_words;            /* nwords + 1 */
+    uint64_t *table;
+    pthread_mutex_t lock;
+};
+
+/* rdb_header_sum -- checksum of a header, excluding the checksum word. */
+static uint64_t rdb_header_sum(const RDBHeader *h) {
+    const uint64_t *w = (const uint64_t *)h;
+    uint64_t sum = 0x243f6a8885a308d3ULL;
+    for (size_t i = 0; i < offsetof(RDBHeader, checksum) / sizeof(uint64_t); i++) {
+        sum = (sum ^ w[i]) * 0x100000001b3ULL;
+        sum ^= sum >> 29;
+    }
+    return sum;
+}
+
+/* rdb_entry_meta -- meta word of a valid entry for key and len. */
+static uint64_t rdb_entry_meta(const uint64_t *key, int nwords, int len) {
+    uint32_t check = (uint32_t)(maze_bits_hash(key, nwords) >> 32) ^
+                     ((uint32_t)len * 0x9e3779b9u);
+    if (check == 0) check = 1;
+    return ((uint64_t)check << 32) | (uint32_t)len;
+}
+
+static int rdb_entry_valid(const uint64_t *e, int nwords) {
+    return e[nwords] != 0 &&
+           e[nwords] == rdb_entry_meta(e, nwords, (int32_t)(uint32_t)e[nwords]);
+}
+
+/*
+ * rdb_write_header -- store db->hdr with the next generation into the
+ * older header copy and flush it.
+ */
+static int rdb_write_header(ResultDB *db) {
+    db->hdr.generation++;
+    db->hdr.checksum = rdb_header_sum(&db->hdr);
+    int copy = 1 - db->hdr_copy;
+    memcpy(db->map + copy * RDB_HEADER_SIZE, &db->hdr, sizeof(RDBHeader));
+    if (msync(db->map, RDB_DATA_OFF, MS_SYNC) != 0) return 0;
+    db->hdr_copy = copy;
+    return 1;
+}
+
+/*
+ * rdb_map -- (re)map the first `bytes` bytes of the file. A previous
+ * mapping is kept until close: lookups may still be reading through it.
+ */
+static int rdb_map(ResultDB *db, size_t bytes) {
+    int prot = PROT_READ | (db->writable ? PROT_WRITE : 0);
+    uint8_t *map = mmap(NULL, bytes, prot, MAP_SHARED, db->fd, 0);
+    if (map == MAP_FAILED) return 0;
+    if (db->map) {
+        RDBMapping *old = malloc(sizeof(RDBMapping));
+        old->map = db->map;
+        old->bytes = db->map_bytes;
+        old->prev = db->old_maps;
+        db->old_maps = old;
+    }
+    db->map = map;
+    db->map_bytes = bytes;
+    db->table = (uint64_t *)(db->map + db->hdr.table_off);
+    return 1;
+}
+
+/* rdb_publish -- make db->table the table lookups probe. */
+static void rdb_publish(ResultDB *db) {
+    RDBView *v = malloc(sizeof(RDBView));
+    v->table = db->table;
+    v->nslots = db->hdr.nslots;
+    v->prev = db->view;
+    __atomic_store_n(&db->view, v, __ATOMIC_RELEASE);
+}
+
+/*
+ * rdb_probe -- slot of key in a table: returns 1 if a valid entry with
+ * that key is there, 0 if *slot is the empty slot ending its probe run.
+ */
+static int rdb_probe(const uint64_t *table, uint64_t nslots, int nwords,
+                     const uint64_t *key, uint64_t *slot) {
+    int ew = nwords + 1;
+    uint64_t mask = nslots - 1;
+    for (uint64_t i = maze_bits_hash(key, nwords) & mask; ; i = (i + 1) & mask) {
+        const uint64_t *e = table + i * ew;
+        uint64_t meta = __atomic_load_n(&e[nwords], __ATOMIC_ACQUIRE);
+        if (meta == 0) {
+            *slot = i;
+            return 0;
+        }
+        if (memcmp(e, key, nwords * sizeof(uint64_t)) == 0 &&
+            meta == rdb_entry_meta(key, nwords, (int32_t)(uint32_t)meta)) {
+            *slot = i;
+            return 1;
+        }
+    }
+}
+
+/*
+ * rdb_grow -- append a table twice the size, move every valid entry into
+ * it and switch the header over. The old table becomes dead space.
+ */
+static int rdb_grow(ResultDB *db) {
+    int ew = db->entry_words;
+    uint64_t old_slots = db->hdr.nslots;
+    uint64_t new_slots = old_slots * 2;
+    uint64_t old_off = db->hdr.table_off;
+    uint64_t new_off = old_off + old_slots * ew * sizeof(uint64_t);
+    new_off = (new_off + RDB_DATA_OFF - 1) / RDB_DATA_OFF * RDB_DATA_OFF;
+    size_t bytes = new_off + new_slots * ew * sizeof(uint64_t);
+    if (ftruncate(db->fd, bytes) != 0 || !rdb_map(db, bytes))
+        return 0;
+
+    const uint64_t *old = (const uint64_t *)(db->map + old_off);
+    uint64_t *table = (uint64_t *)(db->map + new_off);
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < old_slots; i++) {
+        const uint64_t *e = old + i * ew;
+        if (!rdb_entry_valid(e, db->nwords)) continue;
+        uint64_t slot;
+        if (rdb_probe(table, new_slots, db->nwords, e, &slot)) continue;
+        memcpy(table + slot * ew, e, ew * sizeof(uint64_t));
+        count++;
+    }
+    if (msync(db->map + new_off, bytes - new_off, MS_SYNC) != 0)
+        return 0;
+
+    db->hdr.table_off = new_off;
+    db->hdr.nslots = new_slots;
+    db->hdr.count = count;
+    db->table = table;
+    rdb_publish(db);
+    return rdb_write_header(db);
+}
+
+/* rdb_recount -- count valid entries after an unclean shutdown. */
+static uint64_t rdb_recount(const ResultDB *db) {
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < db->hdr.nslots; i++)
+        if (rdb_entry_valid(db->table + i * db->entry_words, db->nwords))
+            count++;
+    return count;
+}
+
+ResultDB *resultdb_open(const char *path, int nterm, int writable) {
+    int fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: cannot open database %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (flock(fd, (writable ? LOCK_EX : LOCK_SH) | LOCK_NB) != 0) {
+        fprintf(stderr, "Error: database %s is in use by another process\n", path);
+        close(fd);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    ResultDB *db = calloc(1, sizeof(ResultDB));
+    db->fd = fd;
+    db->writable = writable;
+    pthread_mutex_init(&db->lock, NULL);
+
+    if (st.st_size == 0) {
+        /* New database */
+        if (!writable || nterm < 2) {
+            fprintf(stderr, "Error: database %s is empty\n", path);
+            goto fail;
+        }
+        Maze *m = maze_create(nterm);
+        int nwords = maze_bits_nwords(m);
+        maze_destroy(m);
+        db->hdr.magic = RDB_MAGIC;
+        db->hdr.nterm = nterm;
+        db->hdr.nwords = nwords;
+        db->hdr.table_off = RDB_DATA_OFF;
+        db->hdr.nslots = RDB_MIN_SLOTS;
+        db->hdr.clean = 1;
+        size_t bytes = RDB_DATA_OFF + (size_t)RDB_MIN_SLOTS * (nwords + 1) * sizeof(uint64_t);
+        if (ftruncate(fd, bytes) != 0 || !rdb_map(db, bytes)) {
+            fprintf(stderr, "Error: cannot create database %s\n", path);
+            goto fail;
+        }
+        db->hdr_copy = 1;
+        if (!rdb_write_header(db) || !rdb_write_header(db)) goto fail;
+    } else {
+        if ((size_t)st.st_size < RDB_DATA_OFF || !rdb_map(db, st.st_size)) {
+            fprintf(stderr, "Error: %s is not a result database\n", path);
+            goto fail;
+        }
+        /* Pick the valid header copy with the highest generation */
+        int found = 0;
+        for (int c = 0; c < 2; c++) {
+            RDBHeader h;
+            memcpy(&h, db->map + c * RDB_HEADER_SIZE, sizeof(h));
+            if (h.magic != RDB_MAGIC || h.checksum != rdb_header_sum(&h)) continue;
+            if (found && h.generation <= db->hdr.generation) continue;
+            db->hdr = h;
+            db->hdr_copy = c;
+            found = 1;
+        }
+        if (!found || db->hdr.table_off + db->hdr.nslots * (db->hdr.nwords + 1) *
+                      sizeof(uint64_t) > (uint64_t)st.st_size) {
+            fprintf(stderr, "Error: %s has no valid header\n", path);
+            goto fail;
+        }
+        if (nterm > 0 && (uint64_t)nterm != db->hdr.nterm) {
+            fprintf(stderr, "Error: database %s holds nterm=%llu mazes, not nterm=%d\n",
+                    path, (unsigned long long)db->hdr.nterm, nterm);
+            goto fail;
+        }
+        db->table = (uint64_t *)(db->map + db->hdr.table_off);
+    }
+    db->nwords = (int)db->hdr.nwords;
+    db->entry_words = db->nwords + 1;
+
+    if (!db->hdr.clean) {
+        db->hdr.count = rdb_recount(db);
+        fprintf(stderr, "Database %s was not closed cleanly; recounted %llu entries\n",
+                path, (unsigned long long)db->hdr.count);
+    }
+    if (writable) {
+        db->hdr.clean = 0;
+        if (!rdb_write_header(db)) goto fail;
+    }
+    rdb_publish(db);
+    return db;
+
+fail:
+    if (db->map) munmap(db->map, db->map_bytes);
+    pthread_mutex_destroy(&db->lock);
+    free(db);
+    close(fd);
+    return NULL;
+}
+
+/* rdb_release -- unmap superseded mappings and free superseded views. */
+static void rdb_release(ResultDB *db) {
+    while (db->old_maps) {
+        RDBMapping *old = db->old_maps;
+        db->old_maps = old->prev;
+        munmap(old->map, old->bytes);
+        free(old);
+    }
+    while (db->view) {
+        RDBView *v = db->view;
+        db->view = v->prev;
+        free(v);
+    }
+}
+
+void resultdb_close(ResultDB *db) {
+    if (!db) return;
+    if (db->writable) {
+        msync(db->map, db->map_bytes, MS_SYNC);
+        db->hdr.clean = 1;
+        rdb_write_header(db);
+    }
+    rdb_release(db);
+    munmap(db->map, db->map_bytes);
+    close(db->fd);
+    pthread_mutex_destroy(&db->lock);
+    free(db);
+}
+
+int resultdb_nterm(const ResultDB *db) {
+    return (int)db->hdr.nterm;
+}
+
+int resultdb_lookup(ResultDB *db, const uint64_t *key, int *len) {
+    const RDBView *v = __atomic_load_n(&db->view, __ATOMIC_ACQUIRE);
+    uint64_t slot;
+    int found = rdb_probe(v->table, v->nslots, db->nwords, key, &slot);
+    if (found)
+        *len = (int32_t)(uint32_t)__atomic_load_n(
+            &v->table[slot * db->entry_words + db->nwords], __ATOMIC_ACQUIRE);
+    return found;
+}
+
+void resultdb_insert(ResultDB *db, const uint64_t *key, int len) {
+    if (!db->writable) return;
+    pthread_mutex_lock(&db->lock);
+    uint64_t slot;
+    if (rdb_probe(db->table, db->hdr.nslots, db->nwords, key, &slot)) {
+        uint64_t *e = db->table + slot * db->entry_words;
+        if (len > (int32_t)(uint32_t)e[db->nwords])
+            __atomic_store_n(&e[db->nwords], rdb_entry_meta(key, db->nwords, len),
+                             __ATOMIC_RELEASE);
+    } else {
+        /* Keep the load below 7/10; the key is written before its meta */
+        if ((db->hdr.count + 1) * 10 > db->hdr.nslots * 7) {
+            if (!rdb_grow(db)) {
+                pthread_mutex_unlock(&db->lock);
+                return;
+            }
+            rdb_probe(db->table, db->hdr.nslots, db->nwords, key, &slot);
+        }
+        uint64_t *e = db->table + slot * db->entry_words;
+        memcpy(e, key, db->nwords * sizeof(uint64_t));
+        __atomic_store_n(&e[db->nwords], rdb_entry_meta(key, db->nwords, len),
+                         __ATOMIC_RELEASE);
+        db->hdr.count++;
+    }
+    pthread_mutex_unlock(&db->lock);
+}
+
+void resultdb_foreach(ResultDB *db,
+                      void (*fn)(const uint64_t *key, int len, void *ctx),
+                      void *ctx) {
+    for (uint64_t i = 0; i < db->hdr.nslots; i++) {
+        const uint64_t *e = db->table + i * db->entry_words;
+        if (rdb_entry_valid(e, db->nwords))
+            fn(e, (int32_t)(uint32_t)e[db->nwords], ctx);
+    }
+}
+
+void resultdb_stats(ResultDB *db, ResultDBStats *st) {
+    st->nterm = (int)db->hdr.nterm;
+    st->nwords = db->nwords;
+    st->count = db->hdr.count;
+    st->nslots = db->hdr.nslots;
+    st->file_bytes = db->map_bytes;
+    st->dead_bytes = db->hdr.table_off - RDB_DATA_OFF;
+    st->generation = db->hdr.generation;
+}
@@ -0,0 +1,88 @@
+/*
+ * resultdb.h -- persistent database of solved mazes.
+ *
+ * A result database maps canonical bit-packed mazes (see maze_to_bits) of
+ * one nterm to their shortest path length, so that repeated search
+ * campaigns can reuse earlier solves. The file is memory-mapped and holds
+ * an open-addressing table; when the table fills up, a table twice the
+ * size is appended to the file and the header is switched to it, so the
+ * file only ever grows.
+ *
+ * Crash safety:
+ *   - The header is stored twice with a generation number and a checksum;
+ *     an update writes the older copy, so one valid copy always survives.
+ *   - Every entry carries a check word over its key and length that is
+ *     written last; a torn entry fails the check and is ignored.
+ *   - A database that was not closed cleanly is recounted on open.
+ *
+ * Lengths are stored as given; -1 records a maze without a path.
+ * One process at a time may open a database for writing (flock).
+ */
+#ifndef RESULTDB_H
+#define RESULTDB_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct ResultDB ResultDB;
+
+/*
+ * ResultDBStats -- summary of a database for "db stats".
+ *
+ * Fields:
+ *   nterm, nwords -- maze size and key length in 64-bit words
+ *   count, nslots -- live entries and table capacity
+ *   file_bytes    -- size of the file
+ *   dead_bytes    -- bytes held by tables superseded by growth
+ *   generation    -- number of header updates so far
+ */
+typedef struct {
+    int nterm;
+    int nwords;
+    uint64_t count;
+    uint64_t nslots;
+    uint64_t file_bytes;
+    uint64_t dead_bytes;
+    uint64_t generation;
+} ResultDBStats;
+
+/*
+ * resultdb_open -- open or create a result database.
+ *
+ * nterm is the maze size the caller works with; an existing file of a
+ * different nterm is rejected. With nterm 0 the file must exist and its
+ * own nterm is used. Returns NULL (with a message on stderr) on failure.
+ */
+ResultDB *resultdb_open(const char *path, int nterm, int writable);
+
+/* resultdb_close -- flush, mark the database clean and unmap it. */
+void resultdb_close(ResultDB *db);
+
+/* resultdb_nterm -- maze size of the database. */
+int resultdb_nterm(const ResultDB *db);
+
+/*
+ * resultdb_lookup -- find a canonical maze. Returns 1 and sets *len if it
+ * is stored, 0 otherwise. Thread-safe and lock-free; a lookup racing an
+ * insert of the same key may miss it.
+ */
+int resultdb_lookup(ResultDB *db, const uint64_t *key, int *len);
+
+/*
+ * resultdb_insert -- store a canonical maze and its length. An existing
+ * entry is only overwritten by a larger length. Thread-safe.
+ */
+void resultdb_insert(ResultDB *db, const uint64_t *key, int len);
+
+/*
+ * resultdb_foreach -- call fn(key, len, ctx) for every stored maze, in
+ * table order.
+ */
+void resultdb_foreach(ResultDB *db,
+                      void (*fn)(const uint64_t *key, int len, void *ctx),
+                      void *ctx);
+
+/* resultdb_stats -- fill in a summary of the database. */
+void resultdb_stats(ResultDB *db, ResultDBStats *st);
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ * shard.c -- mergeable result files of sharded searches.
+ *
+ * File format (text, one record per line):
+ *   repeated-maze-shard 1
+ *   mode exhaustive|random
+ *   nterm <n>
+ *   directed <0|1>
+ *   aport <min> <max>
+ *   max_len <n>
+ *   bfs <0|1>
+ *   seed <n>
+ *   shards <N> <ranges>        e.g. "shards 8 0-2,5"
+ *   complete <0|1>
+ *   best <len> [<maze string>]
+ *   k <k> <evaluated> <solved> <pruned> <skipped> <cut>
+ *   h <k> <len>:<count> ...    nonzero histogram cells of k
+ *   end
+ * A file without the final "end" line is rejected as truncated.
+ */
+#include "shard.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define SHARD_VERSION 1
+
+static const char *shard_mode_name[] = { "exhaustive", "random" };
+
+ShardResult *shard_result_create(int mode, int nterm, int directed,
+                                 int min_aport, int max_aport, int max_len,
+                                 int use_bfs, unsigned int seed,
+                                 int index, int nshards) {
+    if (max_aport < 0) max_aport = 0;
+    if (nshards < 1) nshards = 1;
+    ShardResult *r = calloc(1, sizeof(ShardResult));
+    r->mode = mode;
+    r->nterm = nterm;
+    r->directed = directed;
+    r->min_aport = min_aport;
+    r->max_aport = max_aport;
+    r->max_len = max_len;
+    r->use_bfs = use_bfs;
+    r->seed = seed;
+    r->nshards = nshards;
+    r->have = calloc(nshards, 1);
+    if (index >= 0 && index < nshards) r->have[index] = 1;
+    r->complete = 1;
+    r->counts = calloc((size_t)(max_aport + 1) * SHARD_NCOUNTS, sizeof(uint64_t));
+    r->hist = calloc((size_t)(max_aport + 1) * SHARD_HIST_LEN, sizeof(uint64_t));
+    return r;
+}
+
+void shard_result_free(ShardResult *r) {
+    if (!r) return;
+    free(r->have);
+    free(r->best_maze);
+    free(r->counts);
+    free(r->hist);
+    free(r);
+}
+
+void shard_result_set_best(ShardResult *r, const Maze *m, int len) {
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buf, &size);
+    if (!fp) return;
+    maze_fprint(fp, m);
+    fclose(fp);
+    while (size > 0 && buf[size - 1] == '\n') buf[--size] = '\0';
+    free(r->best_maze);
+    r->best_maze = buf;
+    r->best_len = len;
+}
+
+/* shard_fprint_ranges -- print the included shards as "0-2,5". */
+static void shard_fprint_ranges(FILE *fp, const ShardResult *r) {
+    int first = 1;
+    for (int i = 0; i < r->nshards; i++) {
+        if (!r->have[i]) continue;
+        int j = i;
+        while (j + 1 < r->nshards && r->have[j + 1]) j++;
+        fprintf(fp, "%s%d", first ? "" : ",", i);
+        if (j > i) fprintf(fp, "-%d", j);
+        first = 0;
+        i = j;
+    }
+    if (first) fprintf(fp, "-");
+}
+
+int shard_result_write(const ShardResult *r, const char *path) {
+    size_t plen = strlen(path);
+    char *tmp = malloc(plen + 5);
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        fprintf(stderr, "Cannot write %s: %s\n", tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+    fprintf(fp, "repeated-maze-shard %d\n", SHARD_VERSION);
+    fprintf(fp, "mode %s\n", shard_mode_name[r->mode]);
+    fprintf(fp, "nterm %d\n", r->nterm);
+    fprintf(fp, "directed %d\n", r->directed);
+    fprintf(fp, "aport %d %d\n", r->min_aport, r->max_aport);
+    fprintf(fp, "max_len %d\n", r->max_len);
+    fprintf(fp, "bfs %d\n", r->use_bfs);
+    fprintf(fp, "seed %u\n", r->seed);
+    fprintf(fp, "shards %d ", r->nshards);
+    shard_fprint_ranges(fp, r);
+    fprintf(fp, "\ncomplete %d\n", r->complete);
+    if (r->best_maze)
+        fprintf(fp, "best %d %s\n", r->best_len, r->best_maze);
+    else
+        fprintf(fp, "best 0\n");
+    for (int k = 0; k <= r->max_aport; k++) {
+        const uint64_t *c = r->counts + (size_t)k * SHARD_NCOUNTS;
+        const uint64_t *h = r->hist + (size_t)k * SHARD_HIST_LEN;
+        int any = 0;
+        for (int i = 0; i < SHARD_NCOUNTS; i++) any |= c[i] != 0;
+        if (!any) continue;
+        fprintf(fp, "k %d", k);
+        for (int i = 0; i < SHARD_NCOUNTS; i++)
+            fprintf(fp, " %llu", (unsigned long long)c[i]);
+        fprintf(fp, "\nh %d", k);
+        for (int len = 0; len < SHARD_HIST_LEN; len++)
+            if (h[len])
+                fprintf(fp, " %d:%llu", len, (unsigned long long)h[len]);
+        fprintf(fp, "\n");
+    }
+    fprintf(fp, "end\n");
+
+    int err = ferror(fp);
+    if (fclose(fp) != 0) err = 1;
+    if (err || rename(tmp, path) != 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+        remove(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+/* shard_parse_ranges -- parse "0-2,5" into r->have. Returns 0 or -1. */
+static int shard_parse_ranges(ShardResult *r, const char *s) {
+    if (strcmp(s, "-") == 0) return 0;
+    while (*s) {
+        char *end;
+        long a = strtol(s, &end, 10);
+        long b = a;
+        if (end == s) return -1;
+        s = end;
+        if (*s == '-') {
+            b = strtol(s + 1, &end, 10);
+            if (end == s + 1) return -1;
+            s = end;
+        }
+        if (a < 0 || b < a || b >= r->nshards) return -1;
+        for (long i = a; i <= b; i++) r->have[i] = 1;
+        if (*s == ',') s++;
+        else if (*s) return -1;
+    }
+    return 0;
+}
+
+ShardResult *shard_result_read(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    ShardResult *r = NULL;
+    int mode = -1, nterm = 0, directed = 0, min_aport = 0, max_aport = -1;
+    int max_len = 0, use_bfs = 0, version = 0, ended = 0, bad = 0;
+    unsigned int seed = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while (!bad && !ended && (n = getline(&line, &cap, fp)) > 0) {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+            line[--n] = '\0';
+        char word[32];
+        int pos = 0;
+        if (sscanf(line, "%31s %n", word, &pos) < 1) continue;
+        const char *arg = line + pos;
+
+        if (strcmp(word, "repeated-maze-shard") == 0) {
+            version = atoi(arg);
+        } else if (strcmp(word, "mode") == 0) {
+            for (int i = 0; i < 2; i++)
+                if (strcmp(arg, shard_mode_name[i]) == 0) mode = i;
+        } else if (strcmp(word, "nterm") == 0) {
+            nterm = atoi(arg);
+        } else if (strcmp(word, "directed") == 0) {
+            directed = atoi(arg);
+        } else if (strcmp(word, "aport") == 0) {
+            bad = sscanf(arg, "%d %d", &min_aport, &max_aport) != 2;
+        } else if (strcmp(word, "max_len") == 0) {
+            max_len = atoi(arg);
+        } else if (strcmp(word, "bfs") == 0) {
+            use_bfs = atoi(arg);
+        } else if (strcmp(word, "seed") == 0) {
+            seed = (unsigned int)strtoul(arg, NULL, 10);
+        } else if (strcmp(word, "shards") == 0) {
+            int nshards, len = 0;
+            if (r || mode < 0 || max_aport < 0 ||
+                sscanf(arg, "%d %n", &nshards, &len) < 1 || nshards < 1) {
+                bad = 1;
+                break;
+            }
+            r = shard_result_create(mode, nterm, directed, min_aport, max_aport,
+                                    max_len, use_bfs, seed, -1, nshards);
+            bad = shard_parse_ranges(r, arg + len) != 0;
+        } else if (!r) {
+            bad = 1;
+        } else if (strcmp(word, "complete") == 0) {
+            r->complete = atoi(arg);
+        } else if (strcmp(word, "best") == 0) {
+            int len = 0;
+            r->best_len = (int)strtol(arg, NULL, 10);
+            sscanf(arg, "%*d %n", &len);
+            if (len > 0 && arg[len]) {
+                free(r->best_maze);
+                r->best_maze = strdup(arg + len);
+            }
+        } else if (strcmp(word, "k") == 0) {
+            char *end;
+            long k = strtol(arg, &end, 10);
+            if (end == arg || k < 0 || k > r->max_aport) {
+                bad = 1;
+                break;
+            }
+            uint64_t *c = r->counts + (size_t)k * SHARD_NCOUNTS;
+            for (int i = 0; i < SHARD_NCOUNTS; i++)
+                c[i] = strtoull(end, &end, 10);
+        } else if (strcmp(word, "h") == 0) {
+            char *end;
+            long k = strtol(arg, &end, 10);
+            if (end == arg || k < 0 || k > r->max_aport) {
+                bad = 1;
+                break;
+            }
+            uint64_t *h = r->hist + (size_t)k * SHARD_HIST_LEN;
+            const char *p = end;
+            while (*p == ' ') {
+                long len = strtol(p, &end, 10);
+                if (*end != ':' || len < 0 || len >= SHARD_HIST_LEN) {
+                    bad = 1;
+                    break;
+                }
+                h[len] = strtoull(end + 1, &end, 10);
+                p = end;
+            }
+        } else if (strcmp(word, "end") == 0) {
+            ended = 1;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    if (version != SHARD_VERSION || !r || bad || !ended) {
+        fprintf(stderr, "%s: not a complete shard result file\n", path);
+        shard_result_free(r);
+        return NULL;
+    }
+    return r;
+}
+
+int shard_result_merge(ShardResult *dst, const ShardResult *src) {
+    if (dst->mode != src->mode || dst->nterm != src->nterm ||
+        dst->directed != src->directed || dst->min_aport != src->min_aport ||
+        dst->max_aport != src->max_aport || dst->max_len != src->max_len ||
+        dst->use_bfs != src->use_bfs || dst->seed != src->seed ||
+        dst->nshards != src->nshards) {
+        fprintf(stderr, "Shard results come from different searches\n");
+        return -1;
+    }
+    for (int i = 0; i < dst->nshards; i++)
+        if (dst->have[i] && src->have[i]) {
+            fprintf(stderr, "Shard %d/%d is included twice\n", i, dst->nshards);
+            return -1;
+        }
+
+    for (int i = 0; i < dst->nshards; i++)
+        dst->have[i] |= src->have[i];
+    dst->complete &= src->complete;
+    if (src->best_maze && src->best_len > dst->best_len) {
+        free(dst->best_maze);
+        dst->best_maze = strdup(src->best_maze);
+        dst->best_len = src->best_len;
+    }
+    for (size_t i = 0; i < (size_t)(dst->max_aport + 1) * SHARD_NCOUNTS; i++)
+        dst->counts[i] += src->counts[i];
+    for (size_t i = 0; i < (size_t)(dst->max_aport + 1) * SHARD_HIST_LEN; i++)
+        dst->hist[i] += src->hist[i];
+    return 0;
+}
+
+void shard_result_fprint(FILE *fp, const ShardResult *r) {
+    int nhave = 0;
+    for (int i = 0; i < r->nshards; i++) nhave += r->have[i] != 0;
+    fprintf(fp, "%s search: nterm=%d min_aport=%d max_aport=%d max_len=%d",
+            r->mode == SHARD_RANDOM ? "Random" : "Exhaustive",
+            r->nterm, r->min_aport, r->max_aport, r->max_len);
+    if (r->mode == SHARD_RANDOM) fprintf(fp, " seed=%u", r->seed);
+    fprintf(fp, " bfs=%d directed=%d\n", r->use_bfs, r->directed);
+    fprintf(fp, "Shards: %d/%d (", nhave, r->nshards);
+    shard_fprint_ranges(fp, r);
+    fprintf(fp, ")%s%s\n", nhave < r->nshards ? ", INCOMPLETE" : "",
+            r->complete ? "" : ", stopped early");
+
+    uint64_t tot[SHARD_NCOUNTS] = {0};
+    int max_hist = 0;
+    fprintf(fp, "%4s %14s %14s %14s %14s %14s\n",
+            "k", "evaluated", "solved", "pruned", "skipped", "cut");
+    for (int k = 0; k <= r->max_aport; k++) {
+        const uint64_t *c = r->counts + (size_t)k * SHARD_NCOUNTS;
+        const uint64_t *h = r->hist + (size_t)k * SHARD_HIST_LEN;
+        for (int len = 0; len < SHARD_HIST_LEN; len++)
+            if (h[len] && len > max_hist) max_hist = len;
+        if (!c[SHARD_EVALUATED] && !c[SHARD_CUT]) continue;
+        fprintf(fp, "%4d", k);
+        for (int i = 0; i < SHARD_NCOUNTS; i++) {
+            fprintf(fp, " %14llu", (unsigned long long)c[i]);
+            tot[i] += c[i];
+        }
+        fprintf(fp, "\n");
+    }
+    fprintf(fp, "%4s", "all");
+    for (int i = 0; i < SHARD_NCOUNTS; i++)
+        fprintf(fp, " %14llu", (unsigned long long)tot[i]);
+    fprintf(fp, "\n");
+
+    fprintf(fp, "Length histogram of solved mazes (0 = no path):\n");
+    for (int len = 0; len <= max_hist; len++) {
+        uint64_t sum = 0;
+        for (int k = 0; k <= r->max_aport; k++)
+            sum += r->hist[(size_t)k * SHARD_HIST_LEN + len];
+        if (sum)
+            fprintf(fp, "  len %3d%s: %llu\n", len,
+                    len == SHARD_HIST_LEN - 1 ? "+" : "", (unsigned long long)sum);
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * shard.h -- mergeable result files of sharded searches.
+ *
+ * A search run with --shard i/N covers a deterministic 1/N slice of its
+ * search space and summarizes it in a small text file: the search
+ * parameters, which shards it covers, the best maze, per-k counters and
+ * per-k path length histograms. Files of the same search merge by summing
+ * counters and keeping the longer best maze, so any number of nodes that
+ * share a filesystem can split a search without talking to each other.
+ */
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "maze.h"
+
+/* Search modes that can be sharded. */
+#define SHARD_EXHAUSTIVE 0
+#define SHARD_RANDOM     1
+
+/* Per-k counters (mazes with k port units). */
+enum {
+    SHARD_EVALUATED,    /* mazes visited (exhaustive) or sampled (random) */
+    SHARD_SOLVED,       /* mazes solved; these make up the histogram */
+    SHARD_PRUNED,       /* no abstract start->goal path */
+    SHARD_SKIPPED,      /* symmetric, dead-port or duplicate mazes */
+    SHARD_CUT,          /* combinations cut by branch-and-bound */
+    SHARD_NCOUNTS
+};
+
+/* Histogram columns: lengths 0 (no path) .. SHARD_HIST_LEN - 1 (and up). */
+#define SHARD_HIST_LEN 256
+
+/*
+ * ShardResult -- summary of one shard, or of several merged shards.
+ *
+ * Fields:
+ *   mode .. seed -- search parameters; only files with equal parameters
+ *                   and nshards merge (seed is 0 for exhaustive search)
+ *   nshards      -- N of --shard i/N
+ *   have         -- have[i] is nonzero if shard i is included
+ *   complete     -- nonzero unless an included exhaustive shard stopped
+ *                   early at max_len (random shards have no end and
+ *                   always count as complete)
+ *   best_len     -- longest shortest path found (0 = none)
+ *   best_maze    -- that maze as a maze string (NULL = none)
+ *   counts       -- [(max_aport + 1) * SHARD_NCOUNTS], indexed by k
+ *   hist         -- [(max_aport + 1) * SHARD_HIST_LEN], indexed by k, length
+ */
+typedef struct {
+    int mode;
+    int nterm;
+    int directed;
+    int min_aport;
+    int max_aport;
+    int max_len;
+    int use_bfs;
+    unsigned int seed;
+    int nshards;
+    unsigned char *have;
+    int complete;
+    int best_len;
+    char *best_maze;
+    uint64_t *counts;
+    uint64_t *hist;
+} ShardResult;
+
+/*
+ * shard_result_create -- empty result of shard `index` of `nshards`
+ * (index -1 = no shard included yet).
+ */
+ShardResult *shard_result_create(int mode, int nterm, int directed,
+                                 int min_aport, int max_aport, int max_len,
+                                 int use_bfs, unsigned int seed,
+                                 int index, int nshards);
+
+/* shard_result_free -- release a result. */
+void shard_result_free(ShardResult *r);
+
+/* shard_result_set_best -- record m (with path length len) as best maze. */
+void shard_result_set_best(ShardResult *r, const Maze *m, int len);
+
+/*
+ * shard_result_write -- write a result file (via a temporary file and
+ * rename, so readers never see a partial file). Returns 0 on success, -1
+ * with a message on stderr on failure.
+ */
+int shard_result_write(const ShardResult *r, const char *path);
+
+/* shard_result_read -- read a result file; NULL with a message on error. */
+ShardResult *shard_result_read(const char *path);
+
+/*
+ * shard_result_merge -- add src into dst. Fails (-1, with a message) if
+ * the parameters differ or a shard is included in both.
+ */
+int shard_result_merge(ShardResult *dst, const ShardResult *src);
+
+/* shard_result_fprint -- human-readable summary: coverage, counters, histogram. */
+void shard_result_fprint(FILE *fp, const ShardResult *r);
+
+#endif
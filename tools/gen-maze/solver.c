@@ -127,6 +127,19 @@ static int tt_update(TT *tt, State s, int depth) {
     return 1;
 }
 
+/*
+ * tt_find -- min_depth stored for state s, or -1 if s is not in the table.
+ */
+static int tt_find(const TT *tt, State s) {
+    uint64_t h = state_hash(s) & (uint64_t)(tt->size - 1);
+    while (tt->entries[h].occupied) {
+        if (state_eq(tt->entries[h].state, s))
+            return tt->entries[h].min_depth;
+        h = (h + 1) & (uint64_t)(tt->size - 1);
+    }
+    return -1;
+}
+
 /* --- Canonical conversion --- */
 
 /*
@@ -175,10 +188,11 @@ static State to_canonical(int bx, int by, int tdir, int tidx) {
  *   m         -- maze configuration
  *   s         -- current state
  *   nbrs      -- output array (must hold at least 8*nterm entries)
+ *   ports     -- if non-NULL, receives the flat port index of each move
  *
  * Returns the number of neighbors written to nbrs[].
  */
-static int get_neighbors(const Maze *m, State s, State *nbrs) {
+static int get_neighbors(const Maze *m, State s, State *nbrs, int *ports) {
     int n = m->nterm;
     int n4 = 4 * n;
     int cnt = 0;
@@ -194,16 +208,20 @@ static int get_neighbors(const Maze *m, State s, State *nbrs) {
                     for (int dst = 0; dst < n4; dst++) {
                         if (!m->normal_ports[src * n4 + dst]) continue;
                         State ns = to_canonical(bx, by, dst / n, dst % n);
-                        if (ns.x >= 0 && ns.y >= 0)
+                        if (ns.x >= 0 && ns.y >= 0) {
+                            if (ports) ports[cnt] = src * n4 + dst;
                             nbrs[cnt++] = ns;
+                        }
                     }
                 } else {
                     /* nx block (bx==0) */
                     for (int dj = 0; dj < n; dj++) {
                         if (dj == s.idx) continue;
                         int adj = dj < s.idx ? dj : dj - 1;
-                        if (m->nx_ports[s.idx * (n - 1) + adj])
+                        if (m->nx_ports[s.idx * (n - 1) + adj]) {
+                            if (ports) ports[cnt] = m->normal_nports + s.idx * (n - 1) + adj;
                             nbrs[cnt++] = (State){0, by, CDIR_E, dj};
+                        }
                     }
                 }
             }
@@ -217,8 +235,10 @@ static int get_neighbors(const Maze *m, State s, State *nbrs) {
                 for (int dst = 0; dst < n4; dst++) {
                     if (!m->normal_ports[src * n4 + dst]) continue;
                     State ns = to_canonical(bx, by, dst / n, dst % n);
-                    if (ns.x >= 0 && ns.y >= 0)
+                    if (ns.x >= 0 && ns.y >= 0) {
+                        if (ports) ports[cnt] = src * n4 + dst;
                         nbrs[cnt++] = ns;
+                    }
                 }
             }
         }
@@ -234,16 +254,21 @@ static int get_neighbors(const Maze *m, State s, State *nbrs) {
                     for (int dst = 0; dst < n4; dst++) {
                         if (!m->normal_ports[src * n4 + dst]) continue;
                         State ns = to_canonical(bx, by, dst / n, dst % n);
-                        if (ns.x >= 0 && ns.y >= 0)
+                        if (ns.x >= 0 && ns.y >= 0) {
+                            if (ports) ports[cnt] = src * n4 + dst;
                             nbrs[cnt++] = ns;
+                        }
                     }
                 } else {
                     /* ny block (by==0) */
                     for (int dj = 0; dj < n; dj++) {
                         if (dj == s.idx) continue;
                         int adj = dj < s.idx ? dj : dj - 1;
-                        if (m->ny_ports[s.idx * (n - 1) + adj])
+                        if (m->ny_ports[s.idx * (n - 1) + adj]) {
+                            if (ports) ports[cnt] = m->normal_nports + m->nx_nports +
+                                                    s.idx * (n - 1) + adj;
                             nbrs[cnt++] = (State){bx, 0, CDIR_N, dj};
+                        }
                     }
                 }
             }
@@ -257,8 +282,10 @@ static int get_neighbors(const Maze *m, State s, State *nbrs) {
                 for (int dst = 0; dst < n4; dst++) {
                     if (!m->normal_ports[src * n4 + dst]) continue;
                     State ns = to_canonical(bx, by, dst / n, dst % n);
-                    if (ns.x >= 0 && ns.y >= 0)
+                    if (ns.x >= 0 && ns.y >= 0) {
+                        if (ports) ports[cnt] = src * n4 + dst;
                         nbrs[cnt++] = ns;
+                    }
                 }
             }
         }
@@ -299,7 +326,7 @@ static int dfs(DFSCtx *ctx, State cur, int depth, int depth_limit) {
     ctx->path_stack[depth] = cur;
 
     State *nbrs = ctx->nbrs_buf + depth * ctx->max_nbrs;
-    int nn = get_neighbors(ctx->m, cur, nbrs);
+    int nn = get_neighbors(ctx->m, cur, nbrs, NULL);
 
     for (int i = 0; i < nn; i++) {
         if (!tt_update(ctx->tt, nbrs[i], depth + 1)) continue;
@@ -502,7 +529,7 @@ int solve_bfs(const Maze *m, State **path_out, int *path_len_out) {
             break;
         }
 
-        int nn = get_neighbors(m, cur, nbrs);
+        int nn = get_neighbors(m, cur, nbrs, NULL);
         for (int i = 0; i < nn; i++) {
             if (!tt_update(&visited, nbrs[i], 0)) continue;
             if (tail >= cap) {
@@ -582,7 +609,7 @@ int solve_bfs_len(const Maze *m) {
             goto bfs_len_done;
         }
 
-        int nn = get_neighbors(m, cur, nbrs);
+        int nn = get_neighbors(m, cur, nbrs, NULL);
         for (int i = 0; i < nn; i++) {
             if (!tt_update(&visited, nbrs[i], 0)) continue;
             if (tail >= cap) {
@@ -600,6 +627,290 @@ bfs_len_done:
     return result;
 }
 
+/* --- Bit-parallel batch BFS --- */
+
+/*
+ * BMTable -- states of the union state space of a batch, numbered in
+ * order of discovery. The hash slots map a state to its number; the masks
+ * live in arrays indexed by number, so rehashing never moves them:
+ *   seen[id] -- mazes that have reached the state
+ *   next[id] -- mazes that reached it at the level being built
+ */
+typedef struct {
+    int *slots;                 /* id + 1, 0 = empty */
+    int size;                   /* power of 2 */
+    State *states;
+    uint64_t *seen;
+    uint64_t *next;
+    int count;
+    int cap;
+} BMTable;
+
+static void bm_init(BMTable *t) {
+    t->size = 8192;
+    t->slots = calloc(t->size, sizeof(int));
+    t->cap = 4096;
+    t->count = 0;
+    t->states = malloc(t->cap * sizeof(State));
+    t->seen = malloc(t->cap * sizeof(uint64_t));
+    t->next = malloc(t->cap * sizeof(uint64_t));
+}
+
+static void bm_free(BMTable *t) {
+    free(t->slots);
+    free(t->states);
+    free(t->seen);
+    free(t->next);
+}
+
+/* bm_id -- number of state s, added with empty masks if absent. */
+static int bm_id(BMTable *t, State s) {
+    if (t->count * 2 >= t->size) {
+        int new_size = t->size * 2;
+        int *ns = calloc(new_size, sizeof(int));
+        for (int id = 0; id < t->count; id++) {
+            uint64_t h = state_hash(t->states[id]) & (uint64_t)(new_size - 1);
+            while (ns[h])
+                h = (h + 1) & (uint64_t)(new_size - 1);
+            ns[h] = id + 1;
+        }
+        free(t->slots);
+        t->slots = ns;
+        t->size = new_size;
+    }
+    uint64_t h = state_hash(s) & (uint64_t)(t->size - 1);
+    while (t->slots[h]) {
+        if (state_eq(t->states[t->slots[h] - 1], s))
+            return t->slots[h] - 1;
+        h = (h + 1) & (uint64_t)(t->size - 1);
+    }
+    if (t->count >= t->cap) {
+        t->cap *= 2;
+        t->states = realloc(t->states, t->cap * sizeof(State));
+        t->seen = realloc(t->seen, t->cap * sizeof(uint64_t));
+        t->next = realloc(t->next, t->cap * sizeof(uint64_t));
+    }
+    int id = t->count++;
+    t->states[id] = s;
+    t->seen[id] = 0;
+    t->next[id] = 0;
+    t->slots[h] = id + 1;
+    return id;
+}
+
+/*
+ * solve_bfs_batch -- BFS over the union of the mazes' ports, one bit per
+ * maze.
+ *
+ * Bit i of a state's mask means maze i reaches the state. A frontier state
+ * with mask M moves through port p to a neighbor with the bits
+ * M & has_port[p] that have not reached the neighbor yet, so each maze's
+ * bits spread exactly as its own BFS would. Maze i's length is the level
+ * at which its bit first reaches the goal. A maze drops out of the batch
+ * once it has reached the goal or its frontier is empty.
+ */
+void solve_bfs_batch(const Maze *const *mazes, int n, int *lens) {
+    for (int i = 0; i < n; i++) lens[i] = -1;
+    if (n <= 0 || mazes[0]->nterm < 2) return;
+    if (n > SOLVE_BATCH_MAX) n = SOLVE_BATCH_MAX;
+
+    int nterm = mazes[0]->nterm;
+    Maze *u = maze_create(nterm);
+    int nwords = maze_bits_nwords(u);
+    uint64_t *bits = malloc(nwords * sizeof(uint64_t));
+    uint64_t *ubits = calloc(nwords, sizeof(uint64_t));
+    uint64_t *has_port = calloc(u->total_nports, sizeof(uint64_t));
+    for (int i = 0; i < n; i++) {
+        maze_to_bits(mazes[i], bits);
+        for (int w = 0; w < nwords; w++) {
+            ubits[w] |= bits[w];
+            for (uint64_t b = bits[w]; b; b &= b - 1)
+                has_port[w * 64 + __builtin_ctzll(b)] |= 1ULL << i;
+        }
+    }
+    maze_from_bits(u, ubits);
+
+    State start = {0, 1, CDIR_E, 0};
+    State goal  = {0, 1, CDIR_E, 1};
+    uint64_t active = n == 64 ? ~0ULL : (1ULL << n) - 1;
+
+    BMTable t;
+    bm_init(&t);
+    int start_id = bm_id(&t, start);
+    t.seen[start_id] = active;
+    int goal_id = bm_id(&t, goal);
+
+    int max_nbrs = 8 * nterm;
+    State *nbrs = malloc(max_nbrs * sizeof(State));
+    int *ports = malloc(max_nbrs * sizeof(int));
+
+    /* Frontier of the current level and of the next one, as state ids */
+    int cap = 4096, ncur = 0, nnext = 0;
+    int *cur = malloc(cap * sizeof(int));
+    uint64_t *cur_mask = malloc(cap * sizeof(uint64_t));
+    int *next = malloc(cap * sizeof(int));
+    cur[ncur] = start_id;
+    cur_mask[ncur++] = active;
+
+    for (int depth = 0; ncur > 0 && active && depth < MAX_DEPTH; depth++) {
+        nnext = 0;
+        for (int q = 0; q < ncur; q++) {
+            uint64_t mask = cur_mask[q] & active;
+            if (!mask) continue;
+            int nn = get_neighbors(u, t.states[cur[q]], nbrs, ports);
+            for (int i = 0; i < nn; i++) {
+                uint64_t nm = mask & has_port[ports[i]];
+                if (!nm) continue;
+                int id = bm_id(&t, nbrs[i]);
+                nm &= ~t.seen[id];
+                if (!nm) continue;
+                if (!t.next[id]) {
+                    if (nnext >= cap) {
+                        cap *= 2;
+                        next = realloc(next, cap * sizeof(int));
+                        cur = realloc(cur, cap * sizeof(int));
+                        cur_mask = realloc(cur_mask, cap * sizeof(uint64_t));
+                    }
+                    next[nnext++] = id;
+                }
+                t.seen[id] |= nm;
+                t.next[id] |= nm;
+            }
+        }
+
+        /* Mazes whose bit reached the goal are done */
+        uint64_t at_goal = t.next[goal_id];
+        for (uint64_t b = at_goal; b; b &= b - 1)
+            lens[__builtin_ctzll(b)] = depth + 1;
+        active &= ~at_goal;
+
+        /* The new level becomes the frontier; mazes without one are done */
+        uint64_t alive = 0;
+        for (int q = 0; q < nnext; q++) {
+            cur_mask[q] = t.next[next[q]];
+            t.next[next[q]] = 0;
+            alive |= cur_mask[q];
+        }
+        active &= alive;
+        int *tmp = cur;
+        cur = next;
+        next = tmp;
+        ncur = nnext;
+    }
+
+    free(cur);
+    free(cur_mask);
+    free(next);
+    free(nbrs);
+    free(ports);
+    bm_free(&t);
+    free(has_port);
+    free(ubits);
+    free(bits);
+    maze_destroy(u);
+}
+
+/*
+ * solve_bfs_critical -- BFS length plus the ports of the shortest-path DAG.
+ *
+ * The forward BFS stores each state's distance in the TT and stops after
+ * the level that reaches the goal (distance L). The queue then holds every
+ * state with distance <= L in level order, so walking it backwards finds
+ * the states that lie on a shortest path: u is on one if some move u -> v
+ * with dist(v) = dist(u) + 1 leads to a state already known to be on one
+ * (initially only the goal). Every such move's port is marked critical.
+ */
+int solve_bfs_critical(const Maze *m, uint64_t *crit) {
+    memset(crit, 0, maze_bits_nwords(m) * sizeof(uint64_t));
+    if (m->nterm < 2) return -1;
+
+    State start = {0, 1, CDIR_E, 0};
+    State goal  = {0, 1, CDIR_E, 1};
+
+    TT dist;
+    tt_init(&dist);
+    tt_update(&dist, start, 0);
+
+    int max_nbrs = 8 * m->nterm;
+    State *nbrs = malloc(max_nbrs * sizeof(State));
+    int *ports = malloc(max_nbrs * sizeof(int));
+
+    int cap = 4096;
+    State *queue = malloc(cap * sizeof(State));
+    int head = 0, tail = 0;
+    queue[tail++] = start;
+
+    int level_end = tail;
+    int depth = 0;
+    int result = -1;
+    int found = state_eq(start, goal);
+
+    /* Forward: expand whole levels until the goal has been enqueued */
+    while (!found && head < tail) {
+        if (head == level_end) {
+            depth++;
+            level_end = tail;
+            if (depth >= MAX_DEPTH) break;
+        }
+        State cur = queue[head++];
+        int nn = get_neighbors(m, cur, nbrs, NULL);
+        for (int i = 0; i < nn; i++) {
+            if (!tt_update(&dist, nbrs[i], depth + 1)) continue;
+            if (tail >= cap) {
+                cap *= 2;
+                queue = realloc(queue, cap * sizeof(State));
+            }
+            queue[tail++] = nbrs[i];
+            if (state_eq(nbrs[i], goal)) found = 1;
+        }
+        /* Finish the level so every state of distance depth+1 is queued */
+        if (found) {
+            while (head < level_end) {
+                cur = queue[head++];
+                nn = get_neighbors(m, cur, nbrs, NULL);
+                for (int i = 0; i < nn; i++) {
+                    if (!tt_update(&dist, nbrs[i], depth + 1)) continue;
+                    if (tail >= cap) {
+                        cap *= 2;
+                        queue = realloc(queue, cap * sizeof(State));
+                    }
+                    queue[tail++] = nbrs[i];
+                }
+            }
+        }
+    }
+
+    if (found) {
+        result = tt_find(&dist, goal);
+
+        /* Backward: states at distance < L, in reverse level order */
+        TT on_path;
+        tt_init(&on_path);
+        tt_update(&on_path, goal, 0);
+        for (int q = head - 1; q >= 0; q--) {
+            State u = queue[q];
+            int du = tt_find(&dist, u);
+            if (du >= result) continue;
+            int on = 0;
+            int nn = get_neighbors(m, u, nbrs, ports);
+            for (int i = 0; i < nn; i++) {
+                if (tt_find(&dist, nbrs[i]) != du + 1) continue;
+                if (tt_find(&on_path, nbrs[i]) < 0) continue;
+                maze_bits_set(crit, ports[i]);
+                on = 1;
+            }
+            if (on) tt_update(&on_path, u, 0);
+        }
+        tt_free(&on_path);
+    }
+
+    free(nbrs);
+    free(ports);
+    free(queue);
+    tt_free(&dist);
+    return result;
+}
+
 /* state_print -- print a state in compact "(x,y,Dir Idx)" format. */
 void state_print(State s) {
     printf("(%d,%d,%s%d)", s.x, s.y,
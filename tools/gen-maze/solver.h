@@ -98,6 +98,32 @@ int solve_bfs(const Maze *m, State **path_out, int *path_len_out);
  */
 int solve_bfs_len(const Maze *m);
 
+/* Maximum number of mazes per solve_bfs_batch() call. */
+#define SOLVE_BATCH_MAX 64
+
+/*
+ * solve_bfs_batch -- shortest path lengths of up to SOLVE_BATCH_MAX mazes
+ * of the same nterm in one bit-parallel BFS.
+ *
+ * Every state carries a 64-bit mask of the mazes that reach it, and a move
+ * passes on only the bits of mazes that have the port it uses. Mazes that
+ * share most of their ports then share most of the traversal. Sets
+ * lens[i] to the length solve_bfs_len(mazes[i]) would return.
+ */
+void solve_bfs_batch(const Maze *const *mazes, int n, int *lens);
+
+/*
+ * solve_bfs_critical -- shortest path length and its critical ports.
+ *
+ * Sets bit idx of crit (maze_bits_nwords(m) words, bit-packed like
+ * maze_to_bits) for every port idx used by at least one shortest path.
+ * Removing a port whose bit is clear leaves the shortest path length and
+ * the set of shortest paths unchanged. crit is all zero if there is no path.
+ *
+ * Returns the path length, or -1 if no path exists.
+ */
+int solve_bfs_critical(const Maze *m, uint64_t *crit);
+
 /* state_print -- print a single state as "(x,y,E0)" or "(x,y,N1)" to stdout. */
 void state_print(State s);
 